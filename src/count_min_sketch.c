@@ -13,22 +13,226 @@
 #include <limits.h>
 #include <inttypes.h>       /* PRIu64 */
 #include <math.h>
+#include <pthread.h>
+#if defined(__linux__)
+#include <sys/mman.h>       /* huge pages */
+#include <sys/syscall.h>    /* NUMA placement */
+#include <unistd.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CMS_X86_KERNELS     /* SSE2, AVX2 and AVX-512 kernels selected at runtime */
+#define CMS_TARGET(isa) __attribute__((target(isa)))
+#include <immintrin.h>
+#endif
 #include "count_min_sketch.h"
 
 #define LOG_TWO 0.6931471805599453
+#define CMS_SNAPSHOT_CHUNK 16384    /* bins copied per copy-on-write chunk (64 KiB) */
+#define CMS_MERGE_FILE_CHUNK 16384  /* bins read per file per pass when merging files (64 KiB) */
+#define CMS_MERGE_TILE 2048         /* bins of the base merged from every sketch at a time (8 KiB) */
+#define CMS_MERGE_MIN_THREAD_BINS (1 << 20)  /* do not split merges smaller than this across threads */
+#define CMS_WINDOW_RETIRE_CHUNK 256 /* bins of the expiring slice retired per insertion */
+#define CMS_AGE_BLOCK 16            /* bins aged together when touched during a lazy aging pass (64 bytes) */
+#define CMS_AGE_STEP 16             /* blocks swept per insertion during a lazy aging pass */
+#define CMS_AGE_CLEAR 32            /* shift of a lazy aging pass that clears the bins */
+#define CMS_TINYLFU_DEPTH 4         /* rows of 4-bit counters in the TinyLFU */
+#define CMS_TINYLFU_DOORKEEPER 16   /* doorkeeper bits per counter in a row */
+#define CMS_COUNTSKETCH_STACK 16    /* depth up to which the median is taken without allocating */
+#define CMS_SPARSE_MIN_SLOTS 16     /* initial slots of the map of a sparse count-min sketch */
+#define CMS_SPARSE_EXPORT_CHUNK 16384  /* bins written at a time when exporting a sparse count-min sketch (64 KiB) */
+#define CMS_SCALABLE_MAX_STAGES 32  /* stages of a scalable count-min sketch; each is twice as wide as the last */
+#define CMS_CACHE_LINE 64           /* alignment of bins allocated with CMS_ALLOC_ALIGNED */
+#define CMS_HUGE_PAGE (2 << 20)     /* bins allocated with huge pages are rounded up to this */
+#define CMS_NUMA_MAX_NODES 64       /* nodes supported by the NUMA replicated count-min sketch */
+#define CMS_NUMA_NODE_REFRESH 4096  /* lookups between checks of the node a thread runs on */
+#define CMS_MPOL_PREFERRED 1        /* MPOL_PREFERRED of mbind, without needing numaif.h */
+#define CMS_IO_CHUNK (1 << 18)      /* bins read or written at a time by export and import */
+#define CMS_BATCH_TILE 256          /* keys mapped to bins at a time by the batch functions */
+#define CMS_BATCH_PREFETCH 8        /* keys ahead whose bins are prefetched by the batch functions */
+#define CMS_FNV_OFFSET 14695981039346656037ULL
+#define CMS_FILE_TRAILER ((sizeof(int32_t) * 2) + sizeof(int64_t))
+#define CMS_ARENA_FILE_TRAILER (sizeof(uint32_t) * 4)
+
+#if defined(__GNUC__)
+#define CMS_PREFETCH(addr) __builtin_prefetch((addr), 1)
+#else
+#define CMS_PREFETCH(addr) ((void)(addr))
+#endif
+
+/* copy-on-write state of each chunk during a background export */
+#define CMS_CHUNK_PENDING 0
+#define CMS_CHUNK_COPYING 1
+#define CMS_CHUNK_COPIED  2
+
+/* implementations of the hot loops for one instruction set; see `__cms_kernels` */
+struct cms_kernels {
+    const char* name;
+    void (*hash)(const char* key, unsigned int num_hashes, uint64_t* results);
+    void (*add_bins)(int32_t* dst, const int32_t* a, const int32_t* b, uint64_t len);
+    void (*subtract_bins)(int32_t* dst, const int32_t* a, const int32_t* b, uint64_t len);
+    void (*age_bins)(int32_t* bins, uint64_t len, unsigned int shift);
+    int64_t (*dot_product)(const int32_t* a, const int32_t* b, uint64_t len);
+    void (*bin_indexes)(uint32_t width, uint32_t depth, const uint64_t* hashes, unsigned int stride, size_t num_keys, uint64_t* bins);
+    void (*add_batch)(int32_t* bins, uint32_t depth, const uint64_t* indexes, size_t num_keys, uint32_t x, int32_t* results);
+    void (*check_batch)(const int32_t* bins, uint32_t depth, const uint64_t* indexes, size_t num_keys, int32_t* results);
+    size_t (*changes)(const int32_t* bins, uint64_t len, uint32_t width, uint32_t threshold, cms_change* changes, size_t max_changes);
+};
+
+struct cms_alloc {
+    cms_allocator allocator;
+    uint64_t size;              /* bytes allocated for the bins */
+    bool mapped;                /* the bins are mapped rather than from the heap */
+};
+
+struct cms_snapshot {
+    pthread_t thread;
+    CountMinSketch* cms;
+    FILE* fp;
+    char* filepath;
+    int32_t* bins;
+    uint8_t* chunk_state;
+    uint64_t num_chunks;
+    uint64_t num_bins;
+    uint32_t width;
+    uint32_t depth;
+    int64_t elements_added;
+    cms_export_callback callback;
+    void* data;
+    int status;
+};
+
+/* a tracked heavy hitter; `hash` is the first hash of the key */
+typedef struct {
+    uint64_t hash;
+    int32_t count;
+    char* key;
+} cms_topk_entry;
+
+/* min-heap of the top-k keys by estimate plus an open addressing index from hash to heap position */
+struct cms_topk {
+    uint32_t k;
+    uint32_t size;
+    uint32_t index_mask;
+    cms_topk_entry* heap;
+    uint64_t* index_hash;
+    uint32_t* index_pos;        /* UINT32_MAX marks an empty slot */
+};
+
+/* open addressing map of bin index + 1 (0 marks an empty slot) to count */
+struct cms_sparse {
+    uint64_t mask;              /* slots - 1; slots are a power of two */
+    uint64_t size;
+    uint64_t threshold;         /* size past which to convert to dense */
+    uint64_t* keys;
+    int32_t* counts;
+};
+
+/* range of bins merged by a single thread */
+typedef struct {
+    CountMinSketch* base;
+    CountMinSketch** sketches;
+    size_t num_sketches;
+    uint64_t start;
+    uint64_t end;
+} cms_merge_range;
 
 /* private functions */
 static int __setup_cms(CountMinSketch* cms, uint32_t width, uint32_t depth, double error_rate, double confidence, cms_hash_function hash_function);
-static void __write_to_file(CountMinSketch* cms, FILE *fp, short on_disk);
-static void __read_from_file(CountMinSketch* cms, FILE *fp, short on_disk, const char* filename);
-static void __merge_cms(CountMinSketch* base, int num_sketches, va_list* args);
-static int __validate_merge(CountMinSketch* base, int num_sketches, va_list* args);
+static int __write_to_file(CountMinSketch* cms, FILE *fp, short on_disk);
+static int __read_from_file(CountMinSketch* cms, FILE *fp, short on_disk, const char* filename, const cms_allocator* allocator, cms_hash_function hash_function);
+static int __write_bins(const int32_t* bins, uint64_t length, FILE* fp);
+static int __read_bins(int32_t* bins, uint64_t length, FILE* fp);
+static __inline__ int __bins_zero(const int32_t* bins, uint64_t length);
+static __inline__ uint64_t __bin_index(uint32_t width, unsigned int row, uint64_t hash);
+static void __fold_bins(const int32_t* src, uint32_t src_width, int32_t* dst, uint32_t dst_width, uint32_t depth);
+static int __read_trailer(FILE* fp, uint32_t* width, uint32_t* depth, int64_t* elements_added);
+static CountMinSketch** __collect_sketches(int num_sketches, va_list* args);
+static void __merge_cms(CountMinSketch* base, CountMinSketch** sketches, size_t num_sketches, unsigned int num_threads);
+static void __merge_cms_dense(CountMinSketch* base, CountMinSketch** sketches, size_t num_sketches, unsigned int num_threads);
+static void* __merge_cms_worker(void* arg);
+static void __merge_cms_range(CountMinSketch* base, CountMinSketch** sketches, size_t num_sketches, uint64_t start, uint64_t end);
+static int __validate_merge(CountMinSketch* base, CountMinSketch** sketches, size_t num_sketches);
+static void* __snapshot_worker(void* arg);
+static void __snapshot_copy_chunk(struct cms_snapshot* snap, uint64_t chunk);
+static void __snapshot_complete(CountMinSketch* cms);
+static __inline__ void __snapshot_touch(CountMinSketch* cms, uint64_t bin);
+static __inline__ int32_t __bin_value(const CountMinSketch* cms, uint64_t bin);
+static __inline__ void __bin_prepare(CountMinSketch* cms, uint64_t bin);
+static void __age_block(CountMinSketch* cms, uint64_t block);
+static void __age_step(CountMinSketch* cms, uint64_t num_blocks);
+static void __age_complete(CountMinSketch* cms);
+static int __age_start(CountMinSketch* cms, unsigned int shift);
+static void __age_bins(int32_t* bins, uint64_t len, unsigned int shift);
+static __inline__ int32_t __age_value(int32_t val, unsigned int shift);
 static uint64_t* __default_hash(unsigned int num_hashes, const char* key);
+static int __batch_hashes(CountMinSketch* cms, const char** keys, size_t num_keys, uint64_t* hashes);
 static uint64_t __fnv_1a(const char* key, int seed);
 static int __compare(const void * a, const void * b);
 static int32_t __safe_add(int32_t a, uint32_t b);
 static int32_t __safe_sub(int32_t a, uint32_t b);
 static int32_t __safe_add_2(int32_t a, int32_t b);
+static int32_t __safe_sub_2(int32_t a, int32_t b);
+static void __window_retire(CountMinSketchWindow* win, uint64_t num_bins);
+static __inline__ int32_t __window_bin(const CountMinSketchWindow* win, uint64_t bin);
+static __inline__ double __decay_factor(const CountMinSketchDecay* cds, uint32_t elapsed);
+static __inline__ uint64_t __tinylfu_hash(const TinyLFU* tlfu, const char* key);
+static __inline__ int __tinylfu_doorkeeper(const TinyLFU* tlfu, uint64_t hash, int set);
+static __inline__ uint64_t __tinylfu_counter(const TinyLFU* tlfu, unsigned int row, uint64_t hash);
+static uint64_t __next_power_of_two(uint64_t x);
+static __inline__ uint64_t __mix64(uint64_t x);
+static void __topk_update(struct cms_topk* topk, const char* key, uint64_t hash, int32_t count, int inserted);
+static uint32_t __topk_find(const struct cms_topk* topk, uint64_t hash);
+static void __topk_index_set(struct cms_topk* topk, uint64_t hash, uint32_t pos);
+static void __topk_index_remove(struct cms_topk* topk, uint64_t hash);
+static void __topk_sift_down(struct cms_topk* topk, uint32_t pos);
+static void __topk_sift_up(struct cms_topk* topk, uint32_t pos);
+static void __topk_swap(struct cms_topk* topk, uint32_t a, uint32_t b);
+static void __topk_clear(struct cms_topk* topk);
+static int __compare_heavy_hitters(const void* a, const void* b);
+static uint32_t __augmented_find(const CountMinSketchAugmented* acms, const uint64_t* hashes);
+static void __augmented_set(CountMinSketchAugmented* acms, uint32_t pos, const uint64_t* hashes, int32_t count);
+static __inline__ int __dyadic_exact(const CountMinSketchDyadic* dcms, unsigned int level);
+static __inline__ uint64_t* __dyadic_hashes(CountMinSketchDyadic* dcms, unsigned int level, uint64_t prefix);
+static __inline__ int32_t __dyadic_count(CountMinSketchDyadic* dcms, unsigned int level, uint64_t prefix);
+static int64_t __dot_product(const int32_t* a, const int32_t* b, uint64_t len);
+static int32_t __countsketch_update(CountSketch* cs, uint64_t* hashes, uint32_t x, int remove);
+static int32_t __countsketch_median(CountSketch* cs, uint64_t* hashes);
+static int64_t __select_int64(int64_t* values, uint32_t n, uint32_t k);
+static void __add_bins(int32_t* dst, const int32_t* a, const int32_t* b, uint64_t len);
+static void __subtract_bins(int32_t* dst, const int32_t* a, const int32_t* b, uint64_t len);
+static __inline__ uint32_t __abs_bin(int32_t val);
+static void __init_cms_fields(CountMinSketch* cms, uint32_t width, uint32_t depth, double error_rate, double confidence, cms_hash_function hash_function);
+static struct cms_sparse* __sparse_alloc(uint64_t slots, uint64_t threshold);
+static void __sparse_free(struct cms_sparse* sparse);
+static int __sparse_grow(struct cms_sparse* sparse);
+static __inline__ int32_t* __sparse_slot(struct cms_sparse* sparse, uint64_t bin);
+static __inline__ int32_t __sparse_get(const struct cms_sparse* sparse, uint64_t bin);
+static int32_t __sparse_update(CountMinSketch* cms, uint64_t* hashes, uint32_t x, int remove);
+static void __sparse_write(CountMinSketch* cms, FILE* fp);
+static int __compare_bins(const void* a, const void* b);
+static int __scalable_grow(CountMinSketchScalable* scms);
+static int __arena_grow(CountMinSketchArena* arena);
+static void __arena_setup_sketch(CountMinSketchArena* arena, uint64_t id);
+static int __arena_file_size(const uint32_t trailer[4], uint64_t* size);
+static int32_t* __bins_alloc(struct cms_alloc* alloc, uint64_t length);
+static void __bins_free(struct cms_alloc* alloc, int32_t* bins);
+static int __alloc_bins(CountMinSketch* cms);
+static uint32_t __numa_nodes(void);
+static uint32_t __numa_current_node(void);
+static void* __numa_alloc(size_t size, void* data);
+static void __numa_free(void* ptr, size_t size, void* data);
+static const struct cms_kernels* __cms_kernels(void);
+static void __hash_scalar(const char* key, unsigned int num_hashes, uint64_t* results);
+static void __age_bins_scalar(int32_t* bins, uint64_t len, unsigned int shift);
+static int64_t __dot_product_scalar(const int32_t* a, const int32_t* b, uint64_t len);
+static void __add_bins_scalar(int32_t* dst, const int32_t* a, const int32_t* b, uint64_t len);
+static void __subtract_bins_scalar(int32_t* dst, const int32_t* a, const int32_t* b, uint64_t len);
+static void __bin_indexes_scalar(uint32_t width, uint32_t depth, const uint64_t* hashes, unsigned int stride, size_t num_keys, uint64_t* bins);
+static void __add_batch_scalar(int32_t* bins, uint32_t depth, const uint64_t* indexes, size_t num_keys, uint32_t x, int32_t* results);
+static void __check_batch_scalar(const int32_t* bins, uint32_t depth, const uint64_t* indexes, size_t num_keys, int32_t* results);
+static size_t __changes_scalar(const int32_t* bins, uint64_t len, uint32_t width, uint32_t threshold, cms_change* changes, size_t max_changes);
+static size_t __changes_range(const int32_t* bins, uint64_t start, uint64_t len, uint32_t width, uint32_t threshold, cms_change* changes, size_t max_changes, size_t found);
+static __inline__ size_t __change_add(const int32_t* bins, uint64_t bin, uint32_t width, cms_change* changes, size_t max_changes, size_t found);
 
 // Compatibility with non-clang compilers
 #ifndef __has_builtin
@@ -42,6 +246,10 @@ int cms_init_optimal_alt(CountMinSketch* cms, double error_rate, double confiden
         fprintf(stderr, "Unable to initialize the count-min sketch since both error_rate and confidence must be positive!\n");
         return CMS_ERROR;
     }
+    if (ceil(2 / error_rate) > UINT32_MAX || ceil((-1 * log(1 - confidence)) / LOG_TWO) > UINT32_MAX) {
+        fprintf(stderr, "Unable to initialize the count-min sketch since the error_rate or confidence require more than %" PRIu32 " bins per row or rows!\n", UINT32_MAX);
+        return CMS_ERROR;
+    }
     uint32_t width = ceil(2 / error_rate);
     uint32_t depth = ceil((-1 * log(1 - confidence)) / LOG_TWO);
     return __setup_cms(cms, width, depth, error_rate, confidence, hash_function);
@@ -57,8 +265,80 @@ int cms_init_alt(CountMinSketch* cms, uint32_t width, uint32_t depth, cms_hash_f
     return __setup_cms(cms, width, depth, error_rate, confidence, hash_function);
 }
 
+int cms_init_sparse_alt(CountMinSketch* cms, uint32_t width, uint32_t depth, uint64_t threshold, cms_hash_function hash_function) {
+    if (depth < 1 || width < 1) {
+        fprintf(stderr, "Unable to initialize the count-min sketch since either width or depth is 0!\n");
+        return CMS_ERROR;
+    }
+    double confidence = 1 - (1 / pow(2, depth));
+    double error_rate = 2 / (double) width;
+    __init_cms_fields(cms, width, depth, error_rate, confidence, hash_function);
+    if (threshold == 0) {
+        threshold = (uint64_t)width * depth / 16;
+    }
+    cms->sparse = __sparse_alloc(__next_power_of_two((uint64_t)depth * 4 > CMS_SPARSE_MIN_SLOTS ? (uint64_t)depth * 4 : CMS_SPARSE_MIN_SLOTS), threshold);
+    if (cms->sparse == NULL) {
+        fprintf(stderr, "Failed to allocate the sparse count-min sketch!\n");
+        return CMS_ERROR;
+    }
+    return CMS_SUCCESS;
+}
+
+int cms_init_allocator_alt(CountMinSketch* cms, uint32_t width, uint32_t depth, const cms_allocator* allocator, cms_hash_function hash_function) {
+    if (depth < 1 || width < 1) {
+        fprintf(stderr, "Unable to initialize the count-min sketch since either width or depth is 0!\n");
+        return CMS_ERROR;
+    }
+    double confidence = 1 - (1 / pow(2, depth));
+    double error_rate = 2 / (double) width;
+    __init_cms_fields(cms, width, depth, error_rate, confidence, hash_function);
+    if (allocator != NULL) {  /* otherwise the bins are from calloc as in `cms_init` */
+        cms->alloc = (struct cms_alloc*)calloc(1, sizeof(struct cms_alloc));
+        if (cms->alloc == NULL) {
+            fprintf(stderr, "Failed to allocate the count-min sketch allocator!\n");
+            return CMS_ERROR;
+        }
+        cms->alloc->allocator = *allocator;
+    }
+    if (__alloc_bins(cms) == CMS_ERROR) {
+        free(cms->alloc);
+        cms->alloc = NULL;
+        return CMS_ERROR;
+    }
+    return CMS_SUCCESS;
+}
+
+int cms_densify(CountMinSketch* cms) {
+    struct cms_sparse* sparse = cms->sparse;
+    if (sparse == NULL) {
+        return CMS_SUCCESS;
+    }
+    uint64_t length = (uint64_t)cms->width * cms->depth;
+    int32_t* bins = __bins_alloc(cms->alloc, length);
+    if (bins == NULL) {
+        fprintf(stderr, "Failed to allocate %" PRIu64 " bytes for bins!", length * sizeof(int32_t));
+        return CMS_ERROR;
+    }
+    for (uint64_t i = 0; i <= sparse->mask; ++i) {
+        if (sparse->keys[i] != 0) {
+            bins[sparse->keys[i] - 1] = sparse->counts[i];
+        }
+    }
+    __sparse_free(sparse);
+    cms->sparse = NULL;
+    cms->bins = bins;
+    return CMS_SUCCESS;
+}
+
 int cms_destroy(CountMinSketch* cms) {
-    free(cms->bins);
+    cms_export_wait(cms);
+    cms_topk_disable(cms);
+    __bins_free(cms->alloc, cms->bins);
+    free(cms->alloc);
+    cms->alloc = NULL;
+    free(cms->age_blocks);
+    __sparse_free(cms->sparse);
+    cms->sparse = NULL;
     cms->width = 0;
     cms->depth = 0;
     cms->confidence = 0.0;
@@ -66,16 +346,87 @@ int cms_destroy(CountMinSketch* cms) {
     cms->elements_added = 0;
     cms->hash_function = NULL;
     cms->bins = NULL;
+    cms->age_shift = 0;
+    cms->age_blocks = NULL;
 
     return CMS_SUCCESS;
 }
 
 int cms_clear(CountMinSketch* cms) {
-    uint32_t i, j = cms->width * cms->depth;
-    for (i = 0; i < j; ++i) {
-        cms->bins[i] = 0;
+    __snapshot_complete(cms);
+    if (cms->sparse != NULL) {
+        memset(cms->sparse->keys, 0, (cms->sparse->mask + 1) * sizeof(uint64_t));
+        cms->sparse->size = 0;
+    } else {
+        memset(cms->bins, 0, (uint64_t)cms->width * cms->depth * sizeof(int32_t));
+    }
+    cms->elements_added = 0;
+    cms->age_shift = 0;  /* nothing left to age */
+    if (cms->topk != NULL) {
+        __topk_clear(cms->topk);
+    }
+    return CMS_SUCCESS;
+}
+
+int cms_clear_lazy(CountMinSketch* cms) {
+    /* a pending pass need not finish; every block is cleared regardless */
+    if (cms->sparse != NULL || __age_start(cms, CMS_AGE_CLEAR) == CMS_ERROR) {
+        return cms_clear(cms);
     }
     cms->elements_added = 0;
+    if (cms->topk != NULL) {
+        __topk_clear(cms->topk);
+    }
+    return CMS_SUCCESS;
+}
+
+int cms_age(CountMinSketch* cms, unsigned int shift) {
+    if (shift > 31) {
+        fprintf(stderr, "Unable to age the count-min sketch by a shift of %d; it must be less than 32!\n", shift);
+        return CMS_ERROR;
+    }
+    __age_complete(cms);
+    if (shift == 0) {
+        return CMS_SUCCESS;
+    }
+    __snapshot_complete(cms);
+    if (cms->sparse != NULL) {
+        for (uint64_t i = 0; i <= cms->sparse->mask; ++i) {
+            cms->sparse->counts[i] = __age_value(cms->sparse->counts[i], shift);
+        }
+    } else {
+        __age_bins(cms->bins, (uint64_t)cms->width * cms->depth, shift);
+    }
+    cms->elements_added /= ((int64_t)1 << shift);
+    if (cms->topk != NULL) {  /* order is unchanged by aging */
+        for (uint32_t i = 0; i < cms->topk->size; ++i) {
+            cms->topk->heap[i].count = __age_value(cms->topk->heap[i].count, shift);
+        }
+    }
+    return CMS_SUCCESS;
+}
+
+int cms_age_lazy(CountMinSketch* cms, unsigned int shift) {
+    if (shift > 31) {
+        fprintf(stderr, "Unable to age the count-min sketch by a shift of %d; it must be less than 32!\n", shift);
+        return CMS_ERROR;
+    }
+    __age_complete(cms);
+    if (shift == 0) {
+        return CMS_SUCCESS;
+    }
+    if (cms->sparse != NULL) {
+        return cms_age(cms, shift);  /* the map is small enough to age now */
+    }
+    if (__age_start(cms, shift) == CMS_ERROR) {
+        return cms_age(cms, shift);  /* fall back to aging everything now */
+    }
+    cms->elements_added /= ((int64_t)1 << shift);
+    if (cms->topk != NULL) {
+        for (uint32_t i = 0; i < cms->topk->size; ++i) {
+            cms->topk->heap[i].count = __age_value(cms->topk->heap[i].count, shift);
+        }
+    }
     return CMS_SUCCESS;
 }
 
@@ -84,9 +435,13 @@ int32_t cms_add_inc_alt(CountMinSketch* cms, uint64_t* hashes, unsigned int num_
         fprintf(stderr, "Insufficient hashes to complete the addition of the element to the count-min sketch!");
         return CMS_ERROR;
     }
+    if (cms->sparse != NULL) {
+        return __sparse_update(cms, hashes, x, 0);
+    }
     int num_add = INT32_MAX;
     for (unsigned int i = 0; i < cms->depth; ++i) {
-        uint64_t bin = (hashes[i] % cms->width) + (i * cms->width);
+        uint64_t bin = __bin_index(cms->width, i, hashes[i]);
+        __bin_prepare(cms, bin);
         cms->bins[bin] = __safe_add(cms->bins[bin], x);
         /* currently a standard min strategy */
         if (cms->bins[bin] < num_add) {
@@ -94,12 +449,18 @@ int32_t cms_add_inc_alt(CountMinSketch* cms, uint64_t* hashes, unsigned int num_
         }
     }
     cms->elements_added += x;
+    if (cms->age_shift != 0) {
+        __age_step(cms, CMS_AGE_STEP);
+    }
     return num_add;
 }
 
 int32_t cms_add_inc(CountMinSketch* cms, const char* key, unsigned int x) {
     uint64_t* hashes = cms_get_hashes(cms, key);
     int32_t num_add = cms_add_inc_alt(cms, hashes, cms->depth, x);
+    if (cms->topk != NULL && num_add != CMS_ERROR) {
+        __topk_update(cms->topk, key, hashes[0], num_add, 1);
+    }
     free(hashes);
     return num_add;
 }
@@ -109,21 +470,31 @@ int32_t cms_remove_inc_alt(CountMinSketch* cms, uint64_t* hashes, unsigned int n
         fprintf(stderr, "Insufficient hashes to complete the removal of the element to the count-min sketch!");
         return CMS_ERROR;
     }
+    if (cms->sparse != NULL) {
+        return __sparse_update(cms, hashes, x, 1);
+    }
     int32_t num_add = INT32_MAX;
     for (unsigned int i = 0; i < cms->depth; ++i) {
-        uint32_t bin = (hashes[i] % cms->width) + (i * cms->width);
+        uint64_t bin = __bin_index(cms->width, i, hashes[i]);
+        __bin_prepare(cms, bin);
         cms->bins[bin] = __safe_sub(cms->bins[bin], x);
         if (cms->bins[bin] < num_add) {
             num_add = cms->bins[bin];
         }
     }
     cms->elements_added -= x;
+    if (cms->age_shift != 0) {
+        __age_step(cms, CMS_AGE_STEP);
+    }
     return num_add;
 }
 
 int32_t cms_remove_inc(CountMinSketch* cms, const char* key, uint32_t x) {
     uint64_t* hashes = cms_get_hashes(cms, key);
     int32_t num_add = cms_remove_inc_alt(cms, hashes, cms->depth, x);
+    if (cms->topk != NULL && num_add != CMS_ERROR) {
+        __topk_update(cms->topk, key, hashes[0], num_add, 0);
+    }
     free(hashes);
     return num_add;
 }
@@ -135,9 +506,9 @@ int32_t cms_check_alt(CountMinSketch* cms, uint64_t* hashes, unsigned int num_ha
     }
     int32_t num_add = INT32_MAX;
     for (unsigned int i = 0; i < cms->depth; ++i) {
-        uint32_t bin = (hashes[i] % cms->width) + (i * cms->width);
-        if (cms->bins[bin] < num_add) {
-            num_add = cms->bins[bin];
+        int32_t val = __bin_value(cms, __bin_index(cms->width, i, hashes[i]));
+        if (val < num_add) {
+            num_add = val;
         }
     }
     return num_add;
@@ -157,8 +528,7 @@ int32_t cms_check_mean_alt(CountMinSketch* cms, uint64_t* hashes, unsigned int n
     }
     int32_t num_add = 0;
     for (unsigned int i = 0; i < cms->depth; ++i) {
-        uint32_t bin = (hashes[i] % cms->width) + (i * cms->width);
-        num_add += cms->bins[bin];
+        num_add += __bin_value(cms, __bin_index(cms->width, i, hashes[i]));
     }
     return num_add / cms->depth;
 }
@@ -178,8 +548,7 @@ int32_t cms_check_mean_min_alt(CountMinSketch* cms, uint64_t* hashes, unsigned i
     int32_t num_add = 0;
     int64_t* mean_min_values = (int64_t*)calloc(cms->depth, sizeof(int64_t));
     for (unsigned int i = 0; i < cms->depth; ++i) {
-        uint32_t bin = (hashes[i] % cms->width) + (i * cms->width);
-        int32_t val = cms->bins[bin];
+        int32_t val = __bin_value(cms, __bin_index(cms->width, i, hashes[i]));
         mean_min_values[i] = val - ((cms->elements_added - val) / (cms->width - 1));
     }
     // return the median of the mean_min_value array... need to sort first
@@ -201,206 +570,3664 @@ int32_t cms_check_mean_min(CountMinSketch* cms, const char* key) {
     return num_add;
 }
 
-uint64_t* cms_get_hashes_alt(CountMinSketch* cms, unsigned int num_hashes, const char* key) {
-    return cms->hash_function(num_hashes, key);
-}
+int cms_topk_enable(CountMinSketch* cms, unsigned int k) {
+    if (k < 1) {
+        fprintf(stderr, "Unable to track the heavy hitters since k is 0!\n");
+        return CMS_ERROR;
+    }
+    cms_topk_disable(cms);
 
-int cms_export(CountMinSketch* cms, const char* filepath) {
-    FILE *fp;
-    fp = fopen(filepath, "w+b");
-    if (fp == NULL) {
-        fprintf(stderr, "Can't open file %s!\n", filepath);
+    /* keep the index at most half full */
+    uint64_t slots = __next_power_of_two((uint64_t)k * 2);
+    struct cms_topk* topk = (struct cms_topk*)calloc(1, sizeof(struct cms_topk));
+    if (topk == NULL) {
+        fprintf(stderr, "Failed to allocate the heavy hitter tracker!\n");
         return CMS_ERROR;
     }
-    __write_to_file(cms, fp, 0);
-    fclose(fp);
+    topk->k = k;
+    topk->size = 0;
+    topk->index_mask = (uint32_t)(slots - 1);
+    topk->heap = (cms_topk_entry*)calloc(k, sizeof(cms_topk_entry));
+    topk->index_hash = (uint64_t*)calloc(slots, sizeof(uint64_t));
+    topk->index_pos = (uint32_t*)malloc(slots * sizeof(uint32_t));
+    if (topk->heap == NULL || topk->index_hash == NULL || topk->index_pos == NULL) {
+        fprintf(stderr, "Failed to allocate the heavy hitter tracker!\n");
+        free(topk->heap);
+        free(topk->index_hash);
+        free(topk->index_pos);
+        free(topk);
+        return CMS_ERROR;
+    }
+    memset(topk->index_pos, 0xFF, slots * sizeof(uint32_t));
+    cms->topk = topk;
     return CMS_SUCCESS;
 }
 
-int cms_import_alt(CountMinSketch* cms, const char* filepath, cms_hash_function hash_function) {
-    FILE *fp;
-    fp = fopen(filepath, "r+b");
-    if (fp == NULL) {
-        fprintf(stderr, "Can't open file %s!\n", filepath);
-        return CMS_ERROR;
+int cms_topk_disable(CountMinSketch* cms) {
+    if (cms->topk == NULL) {
+        return CMS_SUCCESS;
     }
-    __read_from_file(cms, fp, 0, NULL);
-    cms->hash_function = (hash_function == NULL) ? __default_hash : hash_function;
-    fclose(fp);
+    __topk_clear(cms->topk);
+    free(cms->topk->heap);
+    free(cms->topk->index_hash);
+    free(cms->topk->index_pos);
+    free(cms->topk);
+    cms->topk = NULL;
     return CMS_SUCCESS;
 }
 
-int cms_merge(CountMinSketch* cms, int num_sketches, ...) {
-    CountMinSketch* base;
-    va_list ap;
+size_t cms_topk(CountMinSketch* cms, cms_heavy_hitter* results, size_t max_results) {
+    if (cms->topk == NULL) {
+        return 0;
+    }
+    size_t i, n = cms->topk->size;
+    if (n == 0 || max_results == 0) {
+        return 0;
+    }
+    /* sort a copy so that `results` need only hold `max_results` entries */
+    cms_heavy_hitter* sorted = (cms_heavy_hitter*)malloc(n * sizeof(cms_heavy_hitter));
+    if (sorted == NULL) {
+        fprintf(stderr, "Failed to allocate the heavy hitters to sort!\n");
+        return 0;
+    }
+    for (i = 0; i < n; ++i) {
+        sorted[i].key = cms->topk->heap[i].key;
+        sorted[i].count = cms->topk->heap[i].count;
+    }
+    qsort(sorted, n, sizeof(cms_heavy_hitter), __compare_heavy_hitters);
+    n = (n < max_results) ? n : max_results;
+    memcpy(results, sorted, n * sizeof(cms_heavy_hitter));
+    free(sorted);
+    return n;
+}
 
-    /* Test compatibility */
-    va_start(ap, num_sketches);
-    int res = __validate_merge(NULL, num_sketches, &ap);
-    va_end(ap);
+uint64_t* cms_get_hashes_alt(CountMinSketch* cms, unsigned int num_hashes, const char* key) {
+    return cms->hash_function(num_hashes, key);
+}
 
-    if (CMS_ERROR == res)
+int cms_add_inc_batch_alt(CountMinSketch* cms, const uint64_t* hashes, unsigned int num_hashes, size_t num_keys, uint32_t x, int32_t* results) {
+    if (num_hashes < cms->depth) {
+        fprintf(stderr, "Insufficient hashes to complete the addition of the elements to the count-min sketch!");
         return CMS_ERROR;
+    }
+    uint64_t* bins = NULL;
+    if (cms->sparse == NULL && cms->age_shift == 0 && cms->snapshot == NULL) {
+        bins = (uint64_t*)malloc((size_t)CMS_BATCH_TILE * cms->depth * sizeof(uint64_t));
+    }
+    if (bins == NULL) {  /* every key needs the full treatment of `cms_add_inc_alt` */
+        for (size_t k = 0; k < num_keys; ++k) {
+            int32_t num_add = cms_add_inc_alt(cms, (uint64_t*)hashes + k * num_hashes, num_hashes, x);
+            if (results != NULL) {
+                results[k] = num_add;
+            }
+        }
+        return CMS_SUCCESS;
+    }
+    const struct cms_kernels* kernels = __cms_kernels();
+    for (size_t start = 0; start < num_keys; start += CMS_BATCH_TILE) {
+        size_t n = (num_keys - start < CMS_BATCH_TILE) ? num_keys - start : CMS_BATCH_TILE;
+        kernels->bin_indexes(cms->width, cms->depth, hashes + start * num_hashes, num_hashes, n, bins);
+        kernels->add_batch(cms->bins, cms->depth, bins, n, x, (results != NULL) ? results + start : NULL);
+    }
+    cms->elements_added += (int64_t)x * (int64_t)num_keys;
+    free(bins);
+    return CMS_SUCCESS;
+}
 
-    /* Merge */
-    va_start(ap, num_sketches);
-    base = (CountMinSketch *) va_arg(ap, CountMinSketch *);
-    if (CMS_ERROR == __setup_cms(cms, base->width, base->depth, base->error_rate, base->confidence, base->hash_function)) {
-        va_end(ap);
+int cms_add_inc_batch(CountMinSketch* cms, const char** keys, size_t num_keys, uint32_t x, int32_t* results) {
+    if (cms->topk != NULL) {  /* the heavy hitters need each key */
+        for (size_t k = 0; k < num_keys; ++k) {
+            int32_t num_add = cms_add_inc(cms, keys[k], x);
+            if (results != NULL) {
+                results[k] = num_add;
+            }
+        }
+        return CMS_SUCCESS;
+    }
+    uint64_t* hashes = (uint64_t*)malloc((size_t)CMS_BATCH_TILE * cms->depth * sizeof(uint64_t));
+    if (hashes == NULL) {
+        fprintf(stderr, "Failed to allocate the hashes of the batch!\n");
         return CMS_ERROR;
     }
-    va_end(ap);
-
-    va_start(ap, num_sketches);
-    __merge_cms(cms, num_sketches, &ap);
-    va_end(ap);
+    int res = CMS_SUCCESS;
+    for (size_t start = 0; start < num_keys && res == CMS_SUCCESS; start += CMS_BATCH_TILE) {
+        size_t n = (num_keys - start < CMS_BATCH_TILE) ? num_keys - start : CMS_BATCH_TILE;
+        res = __batch_hashes(cms, keys + start, n, hashes);
+        if (res == CMS_SUCCESS) {
+            res = cms_add_inc_batch_alt(cms, hashes, cms->depth, n, x, (results != NULL) ? results + start : NULL);
+        }
+    }
+    free(hashes);
+    return res;
+}
 
+int cms_check_batch_alt(CountMinSketch* cms, const uint64_t* hashes, unsigned int num_hashes, size_t num_keys, int32_t* results) {
+    if (num_hashes < cms->depth) {
+        fprintf(stderr, "Insufficient hashes to complete the min lookup of the elements to the count-min sketch!");
+        return CMS_ERROR;
+    }
+    uint64_t* bins = NULL;
+    if (cms->sparse == NULL && cms->age_shift == 0) {
+        bins = (uint64_t*)malloc((size_t)CMS_BATCH_TILE * cms->depth * sizeof(uint64_t));
+    }
+    if (bins == NULL) {
+        for (size_t k = 0; k < num_keys; ++k) {
+            results[k] = cms_check_alt(cms, (uint64_t*)hashes + k * num_hashes, num_hashes);
+        }
+        return CMS_SUCCESS;
+    }
+    const struct cms_kernels* kernels = __cms_kernels();
+    for (size_t start = 0; start < num_keys; start += CMS_BATCH_TILE) {
+        size_t n = (num_keys - start < CMS_BATCH_TILE) ? num_keys - start : CMS_BATCH_TILE;
+        kernels->bin_indexes(cms->width, cms->depth, hashes + start * num_hashes, num_hashes, n, bins);
+        kernels->check_batch(cms->bins, cms->depth, bins, n, results + start);
+    }
+    free(bins);
     return CMS_SUCCESS;
 }
 
-int cms_merge_into(CountMinSketch* cms, int num_sketches, ...) {
-    va_list ap;
-
-    /* validate all the count-min sketches are of the same dimensions and hash function */
-    va_start(ap, num_sketches);
-    int res = __validate_merge(cms, num_sketches, &ap);
-    va_end(ap);
-
-    if (CMS_ERROR == res)
+int cms_check_batch(CountMinSketch* cms, const char** keys, size_t num_keys, int32_t* results) {
+    uint64_t* hashes = (uint64_t*)malloc((size_t)CMS_BATCH_TILE * cms->depth * sizeof(uint64_t));
+    if (hashes == NULL) {
+        fprintf(stderr, "Failed to allocate the hashes of the batch!\n");
         return CMS_ERROR;
+    }
+    int res = CMS_SUCCESS;
+    for (size_t start = 0; start < num_keys && res == CMS_SUCCESS; start += CMS_BATCH_TILE) {
+        size_t n = (num_keys - start < CMS_BATCH_TILE) ? num_keys - start : CMS_BATCH_TILE;
+        res = __batch_hashes(cms, keys + start, n, hashes);
+        if (res == CMS_SUCCESS) {
+            res = cms_check_batch_alt(cms, hashes, cms->depth, n, results + start);
+        }
+    }
+    free(hashes);
+    return res;
+}
 
-    /* merge */
-    va_start(ap, num_sketches);
-    __merge_cms(cms, num_sketches, &ap);
-    va_end(ap);
+const char* cms_simd_level(void) {
+    return __cms_kernels()->name;
+}
 
+int cms_export(CountMinSketch* cms, const char* filepath) {
+    FILE *fp;
+    fp = fopen(filepath, "w+b");
+    if (fp == NULL) {
+        fprintf(stderr, "Can't open file %s!\n", filepath);
+        return CMS_ERROR;
+    }
+    __age_complete(cms);
+    int res = __write_to_file(cms, fp, 0);
+    if (fclose(fp) != 0 || res == CMS_ERROR) {
+        fprintf(stderr, "Failed to export the count-min sketch to %s!\n", filepath);
+        return CMS_ERROR;
+    }
     return CMS_SUCCESS;
 }
 
+int cms_export_async(CountMinSketch* cms, const char* filepath, cms_export_callback callback, void* data) {
+    cms_export_wait(cms);
+    __age_complete(cms);
+    if (cms_densify(cms) == CMS_ERROR)
+        return CMS_ERROR;
 
-/*******************************************************************************
-*    PRIVATE FUNCTIONS
-*******************************************************************************/
-static int __setup_cms(CountMinSketch* cms, unsigned int width, unsigned int depth, double error_rate, double confidence, cms_hash_function hash_function) {
-    cms->width = width;
-    cms->depth = depth;
-    cms->confidence = confidence;
-    cms->error_rate = error_rate;
-    cms->elements_added = 0;
-    cms->bins = (int32_t*)calloc((width * depth), sizeof(int32_t));
-    cms->hash_function = (hash_function == NULL) ? __default_hash : hash_function;
-
-    if (NULL == cms->bins) {
-        fprintf(stderr, "Failed to allocate %zu bytes for bins!", ((width * depth) * sizeof(int32_t)));
+    struct cms_snapshot* snap = (struct cms_snapshot*)calloc(1, sizeof(struct cms_snapshot));
+    if (snap == NULL) {
+        fprintf(stderr, "Failed to allocate the background export!\n");
         return CMS_ERROR;
     }
+    snap->cms = cms;
+    snap->width = cms->width;
+    snap->depth = cms->depth;
+    snap->elements_added = cms->elements_added;
+    snap->num_bins = (uint64_t)cms->width * cms->depth;
+    snap->num_chunks = (snap->num_bins + CMS_SNAPSHOT_CHUNK - 1) / CMS_SNAPSHOT_CHUNK;
+    snap->callback = callback;
+    snap->data = data;
+    snap->status = CMS_SUCCESS;
+    snap->filepath = (char*)malloc(strlen(filepath) + 1);
+    snap->bins = (int32_t*)malloc(snap->num_bins * sizeof(int32_t));
+    snap->chunk_state = (uint8_t*)calloc(snap->num_chunks, sizeof(uint8_t));
+    if (snap->filepath == NULL || snap->bins == NULL || snap->chunk_state == NULL) {
+        fprintf(stderr, "Failed to allocate %" PRIu64 " bytes for the background export!\n", snap->num_bins * sizeof(int32_t));
+        goto error;
+    }
+    strcpy(snap->filepath, filepath);
+
+    snap->fp = fopen(filepath, "w+b");
+    if (snap->fp == NULL) {
+        fprintf(stderr, "Can't open file %s!\n", filepath);
+        goto error;
+    }
+
+    /* the snapshot must be visible to the writers before the copy starts */
+    cms->snapshot = snap;
+    if (pthread_create(&snap->thread, NULL, __snapshot_worker, snap) != 0) {
+        fprintf(stderr, "Unable to start the background export thread!\n");
+        cms->snapshot = NULL;
+        fclose(snap->fp);
+        remove(filepath);
+        goto error;
+    }
     return CMS_SUCCESS;
+
+error:
+    free(snap->filepath);
+    free(snap->bins);
+    free(snap->chunk_state);
+    free(snap);
+    return CMS_ERROR;
 }
 
-static void __write_to_file(CountMinSketch* cms, FILE *fp, short on_disk) {
-    unsigned long long length = cms->depth * cms->width;
-    if (on_disk == 0) {
-        for (unsigned long long i = 0; i < length; ++i) {
-            fwrite(&cms->bins[i], sizeof(int32_t), 1, fp);
-        }
-    } else {
-        // TODO: decide if this should be done directly on disk or not
-        // will need to write out everything by hand
-        // uint64_t i;
-        // int q = 0;
-        // for (i = 0; i < length; ++i) {
-        //     fwrite(&q, sizeof(int), 1, fp);
-        // }
+int cms_export_wait(CountMinSketch* cms) {
+    struct cms_snapshot* snap = cms->snapshot;
+    if (snap == NULL) {
+        return CMS_SUCCESS;
     }
-    fwrite(&cms->width, sizeof(int32_t), 1, fp);
-    fwrite(&cms->depth, sizeof(int32_t), 1, fp);
-    fwrite(&cms->elements_added, sizeof(int64_t), 1, fp);
+    pthread_join(snap->thread, NULL);
+    int status = snap->status;
+    cms->snapshot = NULL;
+    free(snap->filepath);
+    free(snap->bins);
+    free(snap->chunk_state);
+    free(snap);
+    return status;
 }
 
-static void __read_from_file(CountMinSketch* cms, FILE *fp, short on_disk, const char* filename) {
-    /* read in the values from the file before getting the sketch itself */
-    int offset = (sizeof(int32_t) * 2) + sizeof(long);
-    fseek(fp, offset * -1, SEEK_END);
+int cms_fold(CountMinSketch* cms, unsigned int factor) {
+    if (factor < 1 || cms->width % factor != 0) {
+        fprintf(stderr, "Unable to fold the count-min sketch since the width (%d) is not divisible by %d!\n", cms->width, factor);
+        return CMS_ERROR;
+    }
+    if (factor == 1) {
+        return CMS_SUCCESS;
+    }
+    if (cms_densify(cms) == CMS_ERROR)
+        return CMS_ERROR;
+    __age_complete(cms);
+    __snapshot_complete(cms);
+    free(cms->age_blocks);  /* sized for the previous width */
+    cms->age_blocks = NULL;
 
-    fread(&cms->width, sizeof(int32_t), 1, fp);
-    fread(&cms->depth, sizeof(int32_t), 1, fp);
-    cms->confidence = 1 - (1 / pow(2, cms->depth));
-    cms->error_rate = 2 / (double) cms->width;
-    fread(&cms->elements_added, sizeof(int64_t), 1, fp);
+    uint32_t width = cms->width / factor;
+    __fold_bins(cms->bins, cms->width, cms->bins, width, cms->depth);
 
-    rewind(fp);
-    size_t length = cms->width * cms->depth;
-    if (on_disk == 0) {
-        cms->bins = (int32_t*)malloc(length * sizeof(int32_t));
-        size_t read = fread(cms->bins, sizeof(int32_t), length, fp);
-        if (read != length) {
-            perror("__read_from_file: ");
-            exit(1);
+    if (cms->alloc == NULL) {  /* custom allocations keep the larger size */
+        int32_t* bins = (int32_t*)realloc(cms->bins, (uint64_t)width * cms->depth * sizeof(int32_t));
+        if (bins != NULL) {  /* otherwise keep the larger allocation */
+            cms->bins = bins;
         }
-    } else {
-        // TODO: decide if this should be done directly on disk or not
     }
+    cms->width = width;
+    cms->error_rate = 2 / (double) width;
+    return CMS_SUCCESS;
 }
 
-static void __merge_cms(CountMinSketch* base, int num_sketches, va_list* args) {
-    int i;
-    uint32_t bin, bins = (base->width * base->depth);
+int cms_merge_into_folded(CountMinSketch* cms, CountMinSketch** sketches, size_t num_sketches) {
+    size_t i;
+    if (num_sketches < 1 || sketches == NULL) {
+        fprintf(stderr, "Unable to merge count-min sketches since no sketches were provided!\n");
+        return CMS_ERROR;
+    }
+    for (i = 0; i < num_sketches; ++i) {
+        if (!(cms->depth == sketches[i]->depth
+            && sketches[i]->width % cms->width == 0
+            && cms->hash_function == sketches[i]->hash_function)) {
 
-    va_list ap;
-    va_copy(ap, *args);
+            fprintf(stderr, "Cannot fold sketches due to incompatible definitions (depth=(%d/%d) width=(%d/%d) hash=(0x%" PRIXPTR "/0x%" PRIXPTR "))",
+                cms->depth, sketches[i]->depth,
+                cms->width, sketches[i]->width,
+                (uintptr_t) cms->hash_function, (uintptr_t) sketches[i]->hash_function);
+            return CMS_ERROR;
+        }
+    }
+    for (i = 0; i < num_sketches; ++i) {
+        if (cms_densify(sketches[i]) == CMS_ERROR)
+            return CMS_ERROR;
+        __age_complete(sketches[i]);
+    }
+    if (cms_densify(cms) == CMS_ERROR)
+        return CMS_ERROR;
+    __age_complete(cms);
+    __snapshot_complete(cms);
 
+    /* fold directly into the base so that no narrower copy is needed */
     for (i = 0; i < num_sketches; ++i) {
-        CountMinSketch *individual_cms = va_arg(ap, CountMinSketch *);
-        base->elements_added += individual_cms->elements_added;
-        for (bin = 0; bin < bins; ++bin) {
-            base->bins[bin] = __safe_add_2(base->bins[bin], individual_cms->bins[bin]);
+        CountMinSketch* individual_cms = sketches[i];
+        uint32_t factor = individual_cms->width / cms->width;
+        for (uint32_t r = 0; r < cms->depth; ++r) {
+            int32_t* dst = cms->bins + (uint64_t)r * cms->width;
+            const int32_t* src = individual_cms->bins + (uint64_t)r * individual_cms->width;
+            for (uint32_t k = 0; k < factor; ++k, src += cms->width) {
+                __add_bins(dst, dst, src, cms->width);
+            }
         }
+        cms->elements_added += individual_cms->elements_added;
     }
-    va_end(ap);
+    return CMS_SUCCESS;
 }
 
-
-static int __validate_merge(CountMinSketch* base, int num_sketches, va_list* args) {
-    int i = 0;
-    va_list ap;
-    va_copy(ap, *args);
-
-    if (base == NULL) {
-        base = (CountMinSketch *) va_arg(ap, CountMinSketch *);
-        ++i;
+int cms_merge_files(const char* filepath, const char** filepaths, size_t num_files) {
+    if (num_files == 0) {
+        fprintf(stderr, "Unable to merge count-min sketch files since no files were provided!\n");
+        return CMS_ERROR;
     }
 
-    for (/* skip */; i < num_sketches; ++i) {
-        CountMinSketch *individual_cms = va_arg(ap, CountMinSketch *);
-        if (!(base->depth == individual_cms->depth
-            && base->width == individual_cms->width
-            && base->hash_function == individual_cms->hash_function)) {
+    int res = CMS_ERROR;
+    size_t i;
+    uint32_t width = 0, depth = 0;
+    uint64_t start, num_bins;
+    int64_t elements_added = 0;
+    FILE* out = NULL;
+    int32_t* merged = NULL;
+    int32_t* chunk = NULL;
+    FILE** fps = (FILE**)calloc(num_files, sizeof(FILE*));
+    if (fps == NULL) {
+        fprintf(stderr, "Failed to allocate the file handles for the merge!\n");
+        return CMS_ERROR;
+    }
 
-            fprintf(stderr, "Cannot merge sketches due to incompatible definitions (depth=(%d/%d) width=(%d/%d) hash=(0x%" PRIXPTR "/0x%" PRIXPTR "))",
-                base->depth, individual_cms->depth,
-                base->width, individual_cms->width,
-                (uintptr_t) base->hash_function, (uintptr_t) individual_cms->hash_function);
-            va_end(ap);
-            return CMS_ERROR;
+    /* validate the dimensions of each file from its trailer */
+    for (i = 0; i < num_files; ++i) {
+        uint32_t w, d;
+        int64_t elements;
+        if (strcmp(filepath, filepaths[i]) == 0) {
+            fprintf(stderr, "Cannot merge count-min sketch files into one of the inputs (%s)!\n", filepath);
+            goto cleanup;
+        }
+        fps[i] = fopen(filepaths[i], "rb");
+        if (fps[i] == NULL) {
+            fprintf(stderr, "Can't open file %s!\n", filepaths[i]);
+            goto cleanup;
+        }
+        if (__read_trailer(fps[i], &w, &d, &elements) == CMS_ERROR) {
+            fprintf(stderr, "File %s is not a valid count-min sketch export!\n", filepaths[i]);
+            goto cleanup;
         }
+        if (i == 0) {
+            width = w;
+            depth = d;
+        } else if (w != width || d != depth) {
+            fprintf(stderr, "Cannot merge sketches due to incompatible definitions (depth=(%d/%d) width=(%d/%d)) in %s",
+                depth, d, width, w, filepaths[i]);
+            goto cleanup;
+        }
+        elements_added += elements;
     }
-    return CMS_SUCCESS;
-}
 
-/* NOTE: The caller will free the results */
-static uint64_t* __default_hash(unsigned int num_hashes, const char* str) {
-    uint64_t* results = (uint64_t*)calloc(num_hashes, sizeof(uint64_t));
-    int i;
-    for (i = 0; i < num_hashes; ++i) {
-        results[i] = __fnv_1a(str, i);
+    merged = (int32_t*)malloc(CMS_MERGE_FILE_CHUNK * sizeof(int32_t));
+    chunk = (int32_t*)malloc(CMS_MERGE_FILE_CHUNK * sizeof(int32_t));
+    if (merged == NULL || chunk == NULL) {
+        fprintf(stderr, "Failed to allocate the buffers for the merge!\n");
+        goto cleanup;
     }
-    return results;
-}
+
+    out = fopen(filepath, "w+b");
+    if (out == NULL) {
+        fprintf(stderr, "Can't open file %s!\n", filepath);
+        goto cleanup;
+    }
+
+    /* stream matching chunks of bins from every file into the output */
+    num_bins = (uint64_t)width * depth;
+    for (start = 0; start < num_bins; start += CMS_MERGE_FILE_CHUNK) {
+        size_t len = (start + CMS_MERGE_FILE_CHUNK > num_bins) ? num_bins - start : CMS_MERGE_FILE_CHUNK;
+        if (fread(merged, sizeof(int32_t), len, fps[0]) != len) {
+            fprintf(stderr, "Failed to read from %s!\n", filepaths[0]);
+            goto cleanup;
+        }
+        for (i = 1; i < num_files; ++i) {
+            if (fread(chunk, sizeof(int32_t), len, fps[i]) != len) {
+                fprintf(stderr, "Failed to read from %s!\n", filepaths[i]);
+                goto cleanup;
+            }
+            __add_bins(merged, merged, chunk, len);
+        }
+        if (fwrite(merged, sizeof(int32_t), len, out) != len) {
+            fprintf(stderr, "Failed to write to %s!\n", filepath);
+            goto cleanup;
+        }
+    }
+    if (fwrite(&width, sizeof(int32_t), 1, out) != 1
+        || fwrite(&depth, sizeof(int32_t), 1, out) != 1
+        || fwrite(&elements_added, sizeof(int64_t), 1, out) != 1) {
+        fprintf(stderr, "Failed to write to %s!\n", filepath);
+        goto cleanup;
+    }
+    res = CMS_SUCCESS;
+
+cleanup:
+    if (out != NULL && fclose(out) != 0) {
+        res = CMS_ERROR;
+    }
+    if (out != NULL && res == CMS_ERROR) {
+        remove(filepath);
+    }
+    for (i = 0; i < num_files; ++i) {
+        if (fps[i] != NULL) {
+            fclose(fps[i]);
+        }
+    }
+    free(fps);
+    free(merged);
+    free(chunk);
+    return res;
+}
+
+int cms_import_alt(CountMinSketch* cms, const char* filepath, cms_hash_function hash_function) {
+    return cms_import_allocator_alt(cms, filepath, NULL, hash_function);
+}
+
+int cms_import_allocator_alt(CountMinSketch* cms, const char* filepath, const cms_allocator* allocator, cms_hash_function hash_function) {
+    FILE *fp;
+    fp = fopen(filepath, "r+b");
+    if (fp == NULL) {
+        fprintf(stderr, "Can't open file %s!\n", filepath);
+        return CMS_ERROR;
+    }
+    int res = __read_from_file(cms, fp, 0, filepath, allocator, hash_function);
+    fclose(fp);
+    return res;
+}
+
+int cms_merge(CountMinSketch* cms, int num_sketches, ...) {
+    va_list ap;
+    va_start(ap, num_sketches);
+    CountMinSketch** sketches = __collect_sketches(num_sketches, &ap);
+    va_end(ap);
+
+    if (sketches == NULL)
+        return CMS_ERROR;
+
+    int res = cms_merge_array(cms, sketches, num_sketches, 1);
+    free(sketches);
+    return res;
+}
+
+int cms_merge_into(CountMinSketch* cms, int num_sketches, ...) {
+    va_list ap;
+    va_start(ap, num_sketches);
+    CountMinSketch** sketches = __collect_sketches(num_sketches, &ap);
+    va_end(ap);
+
+    if (sketches == NULL)
+        return CMS_ERROR;
+
+    int res = cms_merge_into_array(cms, sketches, num_sketches, 1);
+    free(sketches);
+    return res;
+}
+
+int cms_merge_array(CountMinSketch* cms, CountMinSketch** sketches, size_t num_sketches, unsigned int num_threads) {
+    /* Test compatibility */
+    if (CMS_ERROR == __validate_merge(NULL, sketches, num_sketches))
+        return CMS_ERROR;
+
+    /* Merge */
+    CountMinSketch* base = sketches[0];
+    if (CMS_ERROR == __setup_cms(cms, base->width, base->depth, base->error_rate, base->confidence, base->hash_function))
+        return CMS_ERROR;
+
+    __merge_cms(cms, sketches, num_sketches, num_threads);
+    return CMS_SUCCESS;
+}
+
+int cms_merge_into_array(CountMinSketch* cms, CountMinSketch** sketches, size_t num_sketches, unsigned int num_threads) {
+    /* validate all the count-min sketches are of the same dimensions and hash function */
+    if (CMS_ERROR == __validate_merge(cms, sketches, num_sketches))
+        return CMS_ERROR;
+
+    if (CMS_ERROR == cms_densify(cms))
+        return CMS_ERROR;
+    __snapshot_complete(cms);
+
+    /* merge */
+    __merge_cms(cms, sketches, num_sketches, num_threads);
+    return CMS_SUCCESS;
+}
+
+
+int64_t cms_inner_product(CountMinSketch* a, CountMinSketch* b) {
+    if (CMS_ERROR == __validate_merge(a, &b, 1))
+        return CMS_ERROR;
+
+    if (CMS_ERROR == cms_densify(a) || CMS_ERROR == cms_densify(b))
+        return CMS_ERROR;
+    __age_complete(a);
+    __age_complete(b);
+    int64_t res = INT64_MAX;
+    for (uint32_t i = 0; i < a->depth; ++i) {
+        uint64_t offset = (uint64_t)i * a->width;
+        int64_t row = __dot_product(a->bins + offset, b->bins + offset, a->width);
+        if (row < res) {
+            res = row;
+        }
+    }
+    return res;
+}
+
+
+int cms_subtract(CountMinSketch* cms, CountMinSketch* a, CountMinSketch* b) {
+    if (CMS_ERROR == __validate_merge(a, &b, 1))
+        return CMS_ERROR;
+
+    if (CMS_ERROR == cms_densify(a) || CMS_ERROR == cms_densify(b))
+        return CMS_ERROR;
+    if (CMS_ERROR == __setup_cms(cms, a->width, a->depth, a->error_rate, a->confidence, a->hash_function))
+        return CMS_ERROR;
+
+    __age_complete(a);
+    __age_complete(b);
+    __subtract_bins(cms->bins, a->bins, b->bins, (uint64_t)a->width * a->depth);
+    cms->elements_added = a->elements_added - b->elements_added;
+    return CMS_SUCCESS;
+}
+
+int cms_subtract_into(CountMinSketch* a, CountMinSketch* b) {
+    if (CMS_ERROR == __validate_merge(a, &b, 1))
+        return CMS_ERROR;
+
+    if (CMS_ERROR == cms_densify(a) || CMS_ERROR == cms_densify(b))
+        return CMS_ERROR;
+    __snapshot_complete(a);
+    __age_complete(a);
+    __age_complete(b);
+    __subtract_bins(a->bins, a->bins, b->bins, (uint64_t)a->width * a->depth);
+    a->elements_added -= b->elements_added;
+    return CMS_SUCCESS;
+}
+
+size_t cms_changes(CountMinSketch* cms, uint32_t threshold, cms_change* changes, size_t max_changes) {
+    if (cms_densify(cms) == CMS_ERROR) {
+        return 0;
+    }
+    __age_complete(cms);
+    return __cms_kernels()->changes(cms->bins, (uint64_t)cms->width * cms->depth, cms->width, threshold, changes, max_changes);
+}
+
+
+/*******************************************************************************
+*    SLIDING WINDOW COUNT-MIN SKETCH
+*******************************************************************************/
+int cms_window_init_alt(CountMinSketchWindow* win, unsigned int width, unsigned int depth, unsigned int num_slices, cms_hash_function hash_function) {
+    if (num_slices < 1) {
+        fprintf(stderr, "Unable to initialize the sliding window count-min sketch since the number of slices is 0!\n");
+        return CMS_ERROR;
+    }
+    win->num_slices = num_slices;
+    win->head = 0;
+    win->elements_added = 0;
+    win->slices = (CountMinSketch*)calloc(num_slices + 1, sizeof(CountMinSketch));
+    if (win->slices == NULL) {
+        fprintf(stderr, "Failed to allocate the sliding window slices!\n");
+        return CMS_ERROR;
+    }
+    if (cms_init_alt(&win->total, width, depth, hash_function) == CMS_ERROR) {
+        free(win->slices);
+        win->slices = NULL;
+        return CMS_ERROR;
+    }
+    for (unsigned int i = 0; i <= num_slices; ++i) {
+        if (cms_init_alt(&win->slices[i], width, depth, hash_function) == CMS_ERROR) {
+            cms_window_destroy(win);  /* slices not yet set up are zeroed */
+            return CMS_ERROR;
+        }
+    }
+    win->width = win->total.width;
+    win->depth = win->total.depth;
+    win->retire_cursor = (uint64_t)win->width * win->depth;  /* the spare slice starts empty */
+    return CMS_SUCCESS;
+}
+
+int cms_window_destroy(CountMinSketchWindow* win) {
+    if (win->slices != NULL) {
+        for (unsigned int i = 0; i <= win->num_slices; ++i) {
+            cms_destroy(&win->slices[i]);
+        }
+        free(win->slices);
+    }
+    cms_destroy(&win->total);
+    win->slices = NULL;
+    win->num_slices = 0;
+    win->head = 0;
+    win->width = 0;
+    win->depth = 0;
+    win->elements_added = 0;
+    win->retire_cursor = 0;
+    return CMS_SUCCESS;
+}
+
+int cms_window_clear(CountMinSketchWindow* win) {
+    for (unsigned int i = 0; i <= win->num_slices; ++i) {
+        cms_clear(&win->slices[i]);
+    }
+    cms_clear(&win->total);
+    win->elements_added = 0;
+    win->retire_cursor = (uint64_t)win->width * win->depth;
+    return CMS_SUCCESS;
+}
+
+int cms_window_rotate(CountMinSketchWindow* win) {
+    /* finish whatever is left of the previous rotation; normally nothing */
+    __window_retire(win, (uint64_t)win->width * win->depth);
+
+    /* the retired (empty) slice becomes the head; the oldest starts retiring */
+    win->head = (win->head + 1) % (win->num_slices + 1);
+    CountMinSketch* oldest = &win->slices[(win->head + 1) % (win->num_slices + 1)];
+    win->elements_added -= oldest->elements_added;
+    win->total.elements_added -= oldest->elements_added;
+    win->retire_cursor = 0;
+    return CMS_SUCCESS;
+}
+
+int32_t cms_window_add_inc_alt(CountMinSketchWindow* win, uint64_t* hashes, unsigned int num_hashes, uint32_t x) {
+    if (num_hashes < win->depth) {
+        fprintf(stderr, "Insufficient hashes to complete the addition of the element to the sliding window count-min sketch!");
+        return CMS_ERROR;
+    }
+    __window_retire(win, CMS_WINDOW_RETIRE_CHUNK);
+
+    CountMinSketch* head = &win->slices[win->head];
+    int32_t num_add = INT32_MAX;
+    for (unsigned int i = 0; i < win->depth; ++i) {
+        /* all slices share dimensions so the bin is computed once */
+        uint64_t bin = __bin_index(win->width, i, hashes[i]);
+        head->bins[bin] = __safe_add(head->bins[bin], x);
+        win->total.bins[bin] = __safe_add(win->total.bins[bin], x);
+        int32_t val = __window_bin(win, bin);
+        if (val < num_add) {
+            num_add = val;
+        }
+    }
+    head->elements_added += x;
+    win->total.elements_added += x;
+    win->elements_added += x;
+    return num_add;
+}
+
+int32_t cms_window_add_inc(CountMinSketchWindow* win, const char* key, uint32_t x) {
+    uint64_t* hashes = win->total.hash_function(win->depth, key);
+    int32_t num_add = cms_window_add_inc_alt(win, hashes, win->depth, x);
+    free(hashes);
+    return num_add;
+}
+
+int32_t cms_window_check_alt(CountMinSketchWindow* win, uint64_t* hashes, unsigned int num_hashes) {
+    if (num_hashes < win->depth) {
+        fprintf(stderr, "Insufficient hashes to complete the min lookup of the element to the sliding window count-min sketch!");
+        return CMS_ERROR;
+    }
+    int32_t num_add = INT32_MAX;
+    for (unsigned int i = 0; i < win->depth; ++i) {
+        int32_t val = __window_bin(win, __bin_index(win->width, i, hashes[i]));
+        if (val < num_add) {
+            num_add = val;
+        }
+    }
+    return num_add;
+}
+
+int32_t cms_window_check(CountMinSketchWindow* win, const char* key) {
+    uint64_t* hashes = win->total.hash_function(win->depth, key);
+    int32_t num_add = cms_window_check_alt(win, hashes, win->depth);
+    free(hashes);
+    return num_add;
+}
+
+
+/*******************************************************************************
+*    TIME DECAYED COUNT-MIN SKETCH
+*******************************************************************************/
+int cms_decay_init_alt(CountMinSketchDecay* cds, unsigned int width, unsigned int depth, double half_life, cms_hash_function hash_function) {
+    if (depth < 1 || width < 1 || !(half_life > 0)) {
+        fprintf(stderr, "Unable to initialize the decayed count-min sketch since either width, depth, or half_life is 0!\n");
+        return CMS_ERROR;
+    }
+    cds->width = width;
+    cds->depth = depth;
+    cds->half_life = half_life;
+    cds->now = 0;
+    cds->elements_added = 0;
+    cds->hash_function = (hash_function == NULL) ? __default_hash : hash_function;
+    for (unsigned int i = 0; i < CMS_DECAY_POWERS; ++i) {
+        cds->powers[i] = exp2(-(double)i / half_life);
+    }
+    cds->bins = (double*)calloc((uint64_t)width * depth, sizeof(double));
+    cds->ticks = (uint32_t*)calloc((uint64_t)width * depth, sizeof(uint32_t));
+    if (cds->bins == NULL || cds->ticks == NULL) {
+        fprintf(stderr, "Failed to allocate %" PRIu64 " bytes for bins!", (uint64_t)width * depth * (sizeof(double) + sizeof(uint32_t)));
+        cms_decay_destroy(cds);
+        return CMS_ERROR;
+    }
+    return CMS_SUCCESS;
+}
+
+int cms_decay_destroy(CountMinSketchDecay* cds) {
+    free(cds->bins);
+    free(cds->ticks);
+    cds->width = 0;
+    cds->depth = 0;
+    cds->half_life = 0.0;
+    cds->now = 0;
+    cds->elements_added = 0.0;
+    cds->hash_function = NULL;
+    cds->bins = NULL;
+    cds->ticks = NULL;
+    return CMS_SUCCESS;
+}
+
+int cms_decay_clear(CountMinSketchDecay* cds) {
+    uint64_t bins = (uint64_t)cds->width * cds->depth;
+    memset(cds->bins, 0, bins * sizeof(double));
+    memset(cds->ticks, 0, bins * sizeof(uint32_t));
+    cds->now = 0;
+    cds->elements_added = 0.0;
+    return CMS_SUCCESS;
+}
+
+int cms_decay_advance(CountMinSketchDecay* cds, uint32_t ticks) {
+    /* only the total is decayed now; each bin catches up when next touched */
+    cds->now += ticks;
+    cds->elements_added *= __decay_factor(cds, ticks);
+    return CMS_SUCCESS;
+}
+
+double cms_decay_add_inc_alt(CountMinSketchDecay* cds, uint64_t* hashes, unsigned int num_hashes, double x) {
+    if (num_hashes < cds->depth) {
+        fprintf(stderr, "Insufficient hashes to complete the addition of the element to the decayed count-min sketch!");
+        return CMS_ERROR;
+    }
+    double num_add = HUGE_VAL;
+    for (unsigned int i = 0; i < cds->depth; ++i) {
+        uint64_t bin = __bin_index(cds->width, i, hashes[i]);
+        cds->bins[bin] = cds->bins[bin] * __decay_factor(cds, cds->now - cds->ticks[bin]) + x;
+        cds->ticks[bin] = cds->now;
+        if (cds->bins[bin] < num_add) {
+            num_add = cds->bins[bin];
+        }
+    }
+    cds->elements_added += x;
+    return num_add;
+}
+
+double cms_decay_add_inc(CountMinSketchDecay* cds, const char* key, double x) {
+    uint64_t* hashes = cds->hash_function(cds->depth, key);
+    double num_add = cms_decay_add_inc_alt(cds, hashes, cds->depth, x);
+    free(hashes);
+    return num_add;
+}
+
+double cms_decay_check_alt(CountMinSketchDecay* cds, uint64_t* hashes, unsigned int num_hashes) {
+    if (num_hashes < cds->depth) {
+        fprintf(stderr, "Insufficient hashes to complete the min lookup of the element to the decayed count-min sketch!");
+        return CMS_ERROR;
+    }
+    double num_add = HUGE_VAL;
+    for (unsigned int i = 0; i < cds->depth; ++i) {
+        uint64_t bin = __bin_index(cds->width, i, hashes[i]);
+        double val = cds->bins[bin] * __decay_factor(cds, cds->now - cds->ticks[bin]);
+        if (val < num_add) {
+            num_add = val;
+        }
+    }
+    return num_add;
+}
+
+double cms_decay_check(CountMinSketchDecay* cds, const char* key) {
+    uint64_t* hashes = cds->hash_function(cds->depth, key);
+    double num_add = cms_decay_check_alt(cds, hashes, cds->depth);
+    free(hashes);
+    return num_add;
+}
+
+
+/*******************************************************************************
+*    TINYLFU ADMISSION FILTER
+*******************************************************************************/
+int cms_tinylfu_init_alt(TinyLFU* tlfu, uint64_t capacity, uint64_t sample_size, cms_hash_function hash_function) {
+    if (capacity < 1 || sample_size < 1) {
+        fprintf(stderr, "Unable to initialize the TinyLFU since either capacity or sample_size is 0!\n");
+        return CMS_ERROR;
+    }
+    /* whole 64-bit words of 4-bit counters per row */
+    uint64_t width = __next_power_of_two(capacity < 16 ? 16 : capacity);
+    if (width > UINT32_MAX) {
+        fprintf(stderr, "Unable to initialize the TinyLFU since the capacity is too large!\n");
+        return CMS_ERROR;
+    }
+    tlfu->depth = CMS_TINYLFU_DEPTH;
+    tlfu->width = (uint32_t)width;
+    tlfu->sample_size = sample_size;
+    tlfu->additions = 0;
+    tlfu->doorkeeper_bits = width * CMS_TINYLFU_DOORKEEPER;
+    tlfu->hash_function = (hash_function == NULL) ? __default_hash : hash_function;
+    tlfu->counters = (uint64_t*)calloc(width * CMS_TINYLFU_DEPTH / 16, sizeof(uint64_t));
+    tlfu->doorkeeper = (uint64_t*)calloc(tlfu->doorkeeper_bits / 64, sizeof(uint64_t));
+    if (tlfu->counters == NULL || tlfu->doorkeeper == NULL) {
+        fprintf(stderr, "Failed to allocate the TinyLFU counters!\n");
+        cms_tinylfu_destroy(tlfu);
+        return CMS_ERROR;
+    }
+    return CMS_SUCCESS;
+}
+
+int cms_tinylfu_destroy(TinyLFU* tlfu) {
+    free(tlfu->counters);
+    free(tlfu->doorkeeper);
+    tlfu->depth = 0;
+    tlfu->width = 0;
+    tlfu->sample_size = 0;
+    tlfu->additions = 0;
+    tlfu->doorkeeper_bits = 0;
+    tlfu->hash_function = NULL;
+    tlfu->counters = NULL;
+    tlfu->doorkeeper = NULL;
+    return CMS_SUCCESS;
+}
+
+int cms_tinylfu_clear(TinyLFU* tlfu) {
+    memset(tlfu->counters, 0, (uint64_t)tlfu->width * tlfu->depth / 16 * sizeof(uint64_t));
+    memset(tlfu->doorkeeper, 0, tlfu->doorkeeper_bits / 64 * sizeof(uint64_t));
+    tlfu->additions = 0;
+    return CMS_SUCCESS;
+}
+
+int cms_tinylfu_reset(TinyLFU* tlfu) {
+    /* halve all sixteen 4-bit counters in each word at once */
+    uint64_t i, words = (uint64_t)tlfu->width * tlfu->depth / 16;
+    for (i = 0; i < words; ++i) {
+        tlfu->counters[i] = (tlfu->counters[i] >> 1) & 0x7777777777777777ULL;
+    }
+    memset(tlfu->doorkeeper, 0, tlfu->doorkeeper_bits / 64 * sizeof(uint64_t));
+    tlfu->additions /= 2;
+    return CMS_SUCCESS;
+}
+
+int cms_tinylfu_record_alt(TinyLFU* tlfu, uint64_t hash) {
+    /* the first occurrence within the sample only sets the doorkeeper */
+    if (__tinylfu_doorkeeper(tlfu, hash, 1)) {
+        for (unsigned int i = 0; i < tlfu->depth; ++i) {
+            uint64_t pos = __tinylfu_counter(tlfu, i, hash);
+            uint64_t shift = (pos % 16) * 4;
+            if (((tlfu->counters[pos / 16] >> shift) & 0xF) != 0xF) {
+                tlfu->counters[pos / 16] += (uint64_t)1 << shift;
+            }
+        }
+    }
+    if (++tlfu->additions >= tlfu->sample_size) {
+        cms_tinylfu_reset(tlfu);
+    }
+    return CMS_SUCCESS;
+}
+
+int cms_tinylfu_record(TinyLFU* tlfu, const char* key) {
+    return cms_tinylfu_record_alt(tlfu, __tinylfu_hash(tlfu, key));
+}
+
+uint32_t cms_tinylfu_frequency_alt(const TinyLFU* tlfu, uint64_t hash) {
+    uint32_t freq = 0xF;
+    for (unsigned int i = 0; i < tlfu->depth; ++i) {
+        uint64_t pos = __tinylfu_counter(tlfu, i, hash);
+        uint32_t val = (uint32_t)((tlfu->counters[pos / 16] >> ((pos % 16) * 4)) & 0xF);
+        if (val < freq) {
+            freq = val;
+        }
+    }
+    return freq + (uint32_t)__tinylfu_doorkeeper(tlfu, hash, 0);
+}
+
+uint32_t cms_tinylfu_frequency(const TinyLFU* tlfu, const char* key) {
+    return cms_tinylfu_frequency_alt(tlfu, __tinylfu_hash(tlfu, key));
+}
+
+int cms_tinylfu_admit_alt(const TinyLFU* tlfu, uint64_t candidate, uint64_t victim) {
+    return cms_tinylfu_frequency_alt(tlfu, candidate) > cms_tinylfu_frequency_alt(tlfu, victim);
+}
+
+int cms_tinylfu_admit(const TinyLFU* tlfu, const char* candidate, const char* victim) {
+    return cms_tinylfu_admit_alt(tlfu, __tinylfu_hash(tlfu, candidate), __tinylfu_hash(tlfu, victim));
+}
+
+
+/*******************************************************************************
+*    AUGMENTED COUNT-MIN SKETCH
+*******************************************************************************/
+int cms_augmented_init_alt(CountMinSketchAugmented* acms, unsigned int width, unsigned int depth, unsigned int filter_size, cms_hash_function hash_function) {
+    if (filter_size < 1) {
+        fprintf(stderr, "Unable to initialize the augmented count-min sketch since the filter size is 0!\n");
+        return CMS_ERROR;
+    }
+    acms->filter_size = filter_size;
+    acms->filter_used = 0;
+    acms->elements_added = 0;
+    acms->filter_ids = NULL;
+    acms->filter_hashes = NULL;
+    acms->new_counts = NULL;
+    acms->old_counts = NULL;
+    if (cms_init_alt(&acms->cms, width, depth, hash_function) == CMS_ERROR) {
+        return CMS_ERROR;
+    }
+    acms->width = acms->cms.width;
+    acms->depth = acms->cms.depth;
+    acms->filter_ids = (uint64_t*)calloc(filter_size, sizeof(uint64_t));
+    acms->filter_hashes = (uint64_t*)calloc((uint64_t)filter_size * depth, sizeof(uint64_t));
+    acms->new_counts = (int32_t*)calloc(filter_size, sizeof(int32_t));
+    acms->old_counts = (int32_t*)calloc(filter_size, sizeof(int32_t));
+    if (acms->filter_ids == NULL || acms->filter_hashes == NULL || acms->new_counts == NULL || acms->old_counts == NULL) {
+        fprintf(stderr, "Failed to allocate the augmented count-min sketch filter!\n");
+        cms_augmented_destroy(acms);
+        return CMS_ERROR;
+    }
+    return CMS_SUCCESS;
+}
+
+int cms_augmented_destroy(CountMinSketchAugmented* acms) {
+    cms_destroy(&acms->cms);
+    free(acms->filter_ids);
+    free(acms->filter_hashes);
+    free(acms->new_counts);
+    free(acms->old_counts);
+    acms->filter_ids = NULL;
+    acms->filter_hashes = NULL;
+    acms->new_counts = NULL;
+    acms->old_counts = NULL;
+    acms->width = 0;
+    acms->depth = 0;
+    acms->filter_size = 0;
+    acms->filter_used = 0;
+    acms->elements_added = 0;
+    return CMS_SUCCESS;
+}
+
+int cms_augmented_clear(CountMinSketchAugmented* acms) {
+    cms_clear(&acms->cms);
+    acms->filter_used = 0;
+    acms->elements_added = 0;
+    return CMS_SUCCESS;
+}
+
+int cms_augmented_flush(CountMinSketchAugmented* acms) {
+    for (uint32_t i = 0; i < acms->filter_used; ++i) {
+        int32_t delta = acms->new_counts[i] - acms->old_counts[i];
+        if (delta > 0) {
+            cms_add_inc_alt(&acms->cms, &acms->filter_hashes[(uint64_t)i * acms->depth], acms->depth, (uint32_t)delta);
+        }
+        acms->old_counts[i] = acms->new_counts[i];
+    }
+    return CMS_SUCCESS;
+}
+
+int32_t cms_augmented_add_inc_alt(CountMinSketchAugmented* acms, uint64_t* hashes, unsigned int num_hashes, uint32_t x) {
+    if (num_hashes < acms->depth) {
+        fprintf(stderr, "Insufficient hashes to complete the addition of the element to the augmented count-min sketch!");
+        return CMS_ERROR;
+    }
+    acms->elements_added += x;
+
+    /* hot keys: a single exact update */
+    uint32_t pos = __augmented_find(acms, hashes);
+    if (pos != UINT32_MAX) {
+        acms->new_counts[pos] = __safe_add(acms->new_counts[pos], x);
+        return acms->new_counts[pos];
+    }
+    if (acms->filter_used < acms->filter_size) {
+        __augmented_set(acms, acms->filter_used++, hashes, 0);
+        acms->new_counts[acms->filter_used - 1] = __safe_add(0, x);
+        return acms->new_counts[acms->filter_used - 1];
+    }
+
+    /* cold keys go to the sketch and may displace the smallest filtered key */
+    int32_t num_add = cms_add_inc_alt(&acms->cms, hashes, acms->depth, x);
+    uint32_t smallest = 0;
+    for (uint32_t i = 1; i < acms->filter_used; ++i) {
+        if (acms->new_counts[i] < acms->new_counts[smallest]) {
+            smallest = i;
+        }
+    }
+    if (num_add > acms->new_counts[smallest]) {
+        int32_t delta = acms->new_counts[smallest] - acms->old_counts[smallest];
+        if (delta > 0) {
+            cms_add_inc_alt(&acms->cms, &acms->filter_hashes[(uint64_t)smallest * acms->depth], acms->depth, (uint32_t)delta);
+        }
+        /* the estimate is already in the sketch */
+        __augmented_set(acms, smallest, hashes, num_add);
+    }
+    return num_add;
+}
+
+int32_t cms_augmented_add_inc(CountMinSketchAugmented* acms, const char* key, uint32_t x) {
+    uint64_t* hashes = acms->cms.hash_function(acms->depth, key);
+    int32_t num_add = cms_augmented_add_inc_alt(acms, hashes, acms->depth, x);
+    free(hashes);
+    return num_add;
+}
+
+int32_t cms_augmented_check_alt(CountMinSketchAugmented* acms, uint64_t* hashes, unsigned int num_hashes) {
+    if (num_hashes < acms->depth) {
+        fprintf(stderr, "Insufficient hashes to complete the min lookup of the element to the augmented count-min sketch!");
+        return CMS_ERROR;
+    }
+    uint32_t pos = __augmented_find(acms, hashes);
+    if (pos != UINT32_MAX) {
+        return acms->new_counts[pos];
+    }
+    return cms_check_alt(&acms->cms, hashes, acms->depth);
+}
+
+int32_t cms_augmented_check(CountMinSketchAugmented* acms, const char* key) {
+    uint64_t* hashes = acms->cms.hash_function(acms->depth, key);
+    int32_t num_add = cms_augmented_check_alt(acms, hashes, acms->depth);
+    free(hashes);
+    return num_add;
+}
+
+
+/*******************************************************************************
+*    DYADIC RANGE COUNT-MIN SKETCH
+*******************************************************************************/
+int cms_dyadic_init(CountMinSketchDyadic* dcms, unsigned int width, unsigned int depth, unsigned int bits) {
+    if (depth < 1 || width < 1 || bits < 1 || bits > 64) {
+        fprintf(stderr, "Unable to initialize the dyadic count-min sketch since either width or depth is 0 or bits is not between 1 and 64!\n");
+        return CMS_ERROR;
+    }
+    dcms->width = width;
+    dcms->depth = depth;
+    dcms->bits = bits;
+    dcms->elements_added = 0;
+    dcms->levels = (CountMinSketch*)calloc(bits, sizeof(CountMinSketch));
+    dcms->hashes = (uint64_t*)calloc(depth, sizeof(uint64_t));
+    if (dcms->levels == NULL || dcms->hashes == NULL) {
+        fprintf(stderr, "Failed to allocate the dyadic count-min sketch levels!\n");
+        cms_dyadic_destroy(dcms);
+        return CMS_ERROR;
+    }
+    for (unsigned int l = 0; l < bits; ++l) {
+        int res;
+        if (__dyadic_exact(dcms, l)) {
+            res = cms_init(&dcms->levels[l], 1U << (bits - l), 1);
+        } else {
+            res = cms_init(&dcms->levels[l], width, depth);
+        }
+        if (res == CMS_ERROR) {
+            cms_dyadic_destroy(dcms);  /* levels not yet set up are zeroed */
+            return CMS_ERROR;
+        }
+    }
+    return CMS_SUCCESS;
+}
+
+int cms_dyadic_destroy(CountMinSketchDyadic* dcms) {
+    if (dcms->levels != NULL) {
+        for (unsigned int l = 0; l < dcms->bits; ++l) {
+            cms_destroy(&dcms->levels[l]);
+        }
+        free(dcms->levels);
+    }
+    free(dcms->hashes);
+    dcms->levels = NULL;
+    dcms->hashes = NULL;
+    dcms->width = 0;
+    dcms->depth = 0;
+    dcms->bits = 0;
+    dcms->elements_added = 0;
+    return CMS_SUCCESS;
+}
+
+int cms_dyadic_clear(CountMinSketchDyadic* dcms) {
+    for (unsigned int l = 0; l < dcms->bits; ++l) {
+        cms_clear(&dcms->levels[l]);
+    }
+    dcms->elements_added = 0;
+    return CMS_SUCCESS;
+}
+
+int32_t cms_dyadic_add_inc(CountMinSketchDyadic* dcms, uint64_t value, uint32_t x) {
+    if (dcms->bits < 64 && (value >> dcms->bits) != 0) {
+        fprintf(stderr, "Unable to add the value to the dyadic count-min sketch since it does not fit in %u bits!\n", dcms->bits);
+        return CMS_ERROR;
+    }
+    int32_t num_add = 0;
+    for (unsigned int l = 0; l < dcms->bits; ++l) {
+        CountMinSketch* level = &dcms->levels[l];
+        int32_t res = cms_add_inc_alt(level, __dyadic_hashes(dcms, l, value >> l), level->depth, x);
+        if (l == 0) {
+            num_add = res;
+        }
+    }
+    dcms->elements_added += x;
+    return num_add;
+}
+
+int32_t cms_dyadic_check(CountMinSketchDyadic* dcms, uint64_t value) {
+    if (dcms->bits < 64 && (value >> dcms->bits) != 0) {
+        return 0;  /* never inserted */
+    }
+    return __dyadic_count(dcms, 0, value);
+}
+
+int64_t cms_dyadic_range(CountMinSketchDyadic* dcms, uint64_t low, uint64_t high) {
+    if (low > high || (dcms->bits < 64 && (high >> dcms->bits) != 0)) {
+        fprintf(stderr, "Unable to estimate the range of the dyadic count-min sketch since it is empty or out of bounds!\n");
+        return CMS_ERROR;
+    }
+    /* take the unpaired end points of each level and move up a level */
+    int64_t res = 0;
+    unsigned int l = 0;
+    for (;;) {
+        if (l == dcms->bits) {  /* the whole domain */
+            res += dcms->elements_added;
+            break;
+        }
+        if (low & 1) {
+            res += __dyadic_count(dcms, l, low);
+            if (low == high) {
+                break;
+            }
+            ++low;
+        }
+        if (!(high & 1)) {
+            res += __dyadic_count(dcms, l, high);
+            if (low == high) {
+                break;
+            }
+            --high;
+        }
+        low >>= 1;
+        high >>= 1;
+        ++l;
+    }
+    return res;
+}
+
+uint64_t cms_dyadic_quantile(CountMinSketchDyadic* dcms, double q) {
+    if (dcms->elements_added <= 0) {
+        return 0;
+    }
+    q = (q < 0.0) ? 0.0 : (q > 1.0) ? 1.0 : q;
+    int64_t rank = (int64_t)ceil(q * (double)dcms->elements_added);
+    rank = (rank < 1) ? 1 : rank;
+
+    /* descend from the top level, going right past the count of the left child */
+    uint64_t prefix = 0;
+    for (unsigned int l = dcms->bits; l-- > 0;) {
+        uint64_t left = prefix << 1;
+        int32_t count = __dyadic_count(dcms, l, left);
+        if (count >= rank) {
+            prefix = left;
+        } else {
+            rank -= count;
+            prefix = left | 1;
+        }
+    }
+    return prefix;
+}
+
+
+/*******************************************************************************
+*    COUNT SKETCH
+*******************************************************************************/
+int cms_countsketch_init_alt(CountSketch* cs, unsigned int width, unsigned int depth, cms_hash_function hash_function) {
+    if (cms_init_alt(&cs->cms, width, depth, hash_function) == CMS_ERROR) {
+        return CMS_ERROR;
+    }
+    cs->width = cs->cms.width;
+    cs->depth = cs->cms.depth;
+    return CMS_SUCCESS;
+}
+
+int cms_countsketch_destroy(CountSketch* cs) {
+    cms_destroy(&cs->cms);
+    cs->width = 0;
+    cs->depth = 0;
+    return CMS_SUCCESS;
+}
+
+int cms_countsketch_clear(CountSketch* cs) {
+    return cms_clear(&cs->cms);
+}
+
+int cms_countsketch_import_alt(CountSketch* cs, const char* filepath, cms_hash_function hash_function) {
+    if (cms_import_alt(&cs->cms, filepath, hash_function) == CMS_ERROR) {
+        return CMS_ERROR;
+    }
+    cs->width = cs->cms.width;
+    cs->depth = cs->cms.depth;
+    return CMS_SUCCESS;
+}
+
+int32_t cms_countsketch_add_inc_alt(CountSketch* cs, uint64_t* hashes, unsigned int num_hashes, uint32_t x) {
+    if (num_hashes < cs->depth) {
+        fprintf(stderr, "Insufficient hashes to complete the addition of the element to the Count-Sketch!");
+        return CMS_ERROR;
+    }
+    return __countsketch_update(cs, hashes, x, 0);
+}
+
+int32_t cms_countsketch_add_inc(CountSketch* cs, const char* key, uint32_t x) {
+    uint64_t* hashes = cms_get_hashes(&cs->cms, key);
+    int32_t num_add = cms_countsketch_add_inc_alt(cs, hashes, cs->depth, x);
+    free(hashes);
+    return num_add;
+}
+
+int32_t cms_countsketch_remove_inc_alt(CountSketch* cs, uint64_t* hashes, unsigned int num_hashes, uint32_t x) {
+    if (num_hashes < cs->depth) {
+        fprintf(stderr, "Insufficient hashes to complete the removal of the element from the Count-Sketch!");
+        return CMS_ERROR;
+    }
+    return __countsketch_update(cs, hashes, x, 1);
+}
+
+int32_t cms_countsketch_remove_inc(CountSketch* cs, const char* key, uint32_t x) {
+    uint64_t* hashes = cms_get_hashes(&cs->cms, key);
+    int32_t num_add = cms_countsketch_remove_inc_alt(cs, hashes, cs->depth, x);
+    free(hashes);
+    return num_add;
+}
+
+int32_t cms_countsketch_check_alt(CountSketch* cs, uint64_t* hashes, unsigned int num_hashes) {
+    if (num_hashes < cs->depth) {
+        fprintf(stderr, "Insufficient hashes to complete the median lookup of the element to the Count-Sketch!");
+        return CMS_ERROR;
+    }
+    return __countsketch_median(cs, hashes);
+}
+
+int32_t cms_countsketch_check(CountSketch* cs, const char* key) {
+    uint64_t* hashes = cms_get_hashes(&cs->cms, key);
+    int32_t num_add = cms_countsketch_check_alt(cs, hashes, cs->depth);
+    free(hashes);
+    return num_add;
+}
+
+
+/*******************************************************************************
+*    SCALABLE COUNT-MIN SKETCH
+*******************************************************************************/
+int cms_scalable_init_alt(CountMinSketchScalable* scms, unsigned int width, unsigned int depth, uint64_t stage_capacity, cms_hash_function hash_function) {
+    if (stage_capacity < 1) {
+        fprintf(stderr, "Unable to initialize the scalable count-min sketch since the stage capacity is 0!\n");
+        return CMS_ERROR;
+    }
+    scms->width = width;
+    scms->depth = depth;
+    scms->stage_capacity = stage_capacity;
+    scms->elements_added = 0;
+    scms->num_stages = 0;
+    scms->hash_function = (hash_function == NULL) ? __default_hash : hash_function;
+    scms->stages = (CountMinSketch*)calloc(CMS_SCALABLE_MAX_STAGES, sizeof(CountMinSketch));
+    if (scms->stages == NULL) {
+        fprintf(stderr, "Failed to allocate the scalable count-min sketch stages!\n");
+        return CMS_ERROR;
+    }
+    if (__scalable_grow(scms) == CMS_ERROR) {
+        cms_scalable_destroy(scms);
+        return CMS_ERROR;
+    }
+    return CMS_SUCCESS;
+}
+
+int cms_scalable_destroy(CountMinSketchScalable* scms) {
+    if (scms->stages != NULL) {
+        for (uint32_t i = 0; i < scms->num_stages; ++i) {
+            cms_destroy(&scms->stages[i]);
+        }
+        free(scms->stages);
+    }
+    scms->stages = NULL;
+    scms->num_stages = 0;
+    scms->width = 0;
+    scms->depth = 0;
+    scms->stage_capacity = 0;
+    scms->elements_added = 0;
+    scms->hash_function = NULL;
+    return CMS_SUCCESS;
+}
+
+int cms_scalable_clear(CountMinSketchScalable* scms) {
+    for (uint32_t i = 1; i < scms->num_stages; ++i) {
+        cms_destroy(&scms->stages[i]);
+    }
+    scms->num_stages = 1;
+    cms_clear(&scms->stages[0]);
+    scms->elements_added = 0;
+    return CMS_SUCCESS;
+}
+
+int32_t cms_scalable_add_inc_alt(CountMinSketchScalable* scms, uint64_t* hashes, unsigned int num_hashes, uint32_t x) {
+    if (num_hashes < scms->depth) {
+        fprintf(stderr, "Insufficient hashes to complete the addition of the element to the scalable count-min sketch!");
+        return CMS_ERROR;
+    }
+    /* stage i takes stage_capacity * 2^i elements, saturating at UINT64_MAX */
+    uint32_t last = scms->num_stages - 1;
+    uint64_t capacity = (last >= 64 || scms->stage_capacity > (UINT64_MAX >> last)) ? UINT64_MAX : scms->stage_capacity << last;
+    if ((uint64_t)scms->stages[last].elements_added >= capacity) {
+        __scalable_grow(scms);  /* keep using the newest stage on failure */
+    }
+    cms_add_inc_alt(&scms->stages[scms->num_stages - 1], hashes, scms->depth, x);
+    scms->elements_added += x;
+    return cms_scalable_check_alt(scms, hashes, num_hashes);
+}
+
+int32_t cms_scalable_add_inc(CountMinSketchScalable* scms, const char* key, uint32_t x) {
+    uint64_t* hashes = scms->hash_function(scms->depth, key);
+    int32_t num_add = cms_scalable_add_inc_alt(scms, hashes, scms->depth, x);
+    free(hashes);
+    return num_add;
+}
+
+int32_t cms_scalable_check_alt(CountMinSketchScalable* scms, uint64_t* hashes, unsigned int num_hashes) {
+    if (num_hashes < scms->depth) {
+        fprintf(stderr, "Insufficient hashes to complete the min lookup of the element to the scalable count-min sketch!");
+        return CMS_ERROR;
+    }
+    int32_t num_add = 0;
+    for (uint32_t i = 0; i < scms->num_stages; ++i) {
+        num_add = __safe_add_2(num_add, cms_check_alt(&scms->stages[i], hashes, scms->depth));
+    }
+    return num_add;
+}
+
+int32_t cms_scalable_check(CountMinSketchScalable* scms, const char* key) {
+    uint64_t* hashes = scms->hash_function(scms->depth, key);
+    int32_t num_add = cms_scalable_check_alt(scms, hashes, scms->depth);
+    free(hashes);
+    return num_add;
+}
+
+
+/*******************************************************************************
+*    COUNT-MIN SKETCH GROUP
+*******************************************************************************/
+int cms_group_init_alt(CountMinSketchGroup* grp, unsigned int width, unsigned int depth, unsigned int num_sketches, int interleaved, cms_hash_function hash_function) {
+    if (depth < 1 || width < 1 || num_sketches < 1) {
+        fprintf(stderr, "Unable to initialize the count-min sketch group since either width, depth, or num_sketches is 0!\n");
+        return CMS_ERROR;
+    }
+    grp->width = width;
+    grp->depth = depth;
+    grp->num_sketches = num_sketches;
+    grp->interleaved = interleaved;
+    grp->elements_added = 0;
+    grp->hash_function = (hash_function == NULL) ? __default_hash : hash_function;
+    grp->sketches = NULL;
+    grp->bins = NULL;
+    if (interleaved) {
+        uint64_t length = (uint64_t)width * depth * num_sketches;
+        grp->bins = (int32_t*)calloc(length, sizeof(int32_t));
+        if (grp->bins == NULL) {
+            fprintf(stderr, "Failed to allocate %" PRIu64 " bytes for bins!", length * sizeof(int32_t));
+            return CMS_ERROR;
+        }
+        return CMS_SUCCESS;
+    }
+    grp->sketches = (CountMinSketch*)calloc(num_sketches, sizeof(CountMinSketch));
+    if (grp->sketches == NULL) {
+        fprintf(stderr, "Failed to allocate the count-min sketch group!\n");
+        return CMS_ERROR;
+    }
+    for (unsigned int i = 0; i < num_sketches; ++i) {
+        if (cms_init_alt(&grp->sketches[i], width, depth, grp->hash_function) == CMS_ERROR) {
+            cms_group_destroy(grp);  /* members not yet set up are zeroed */
+            return CMS_ERROR;
+        }
+    }
+    return CMS_SUCCESS;
+}
+
+int cms_group_destroy(CountMinSketchGroup* grp) {
+    if (grp->sketches != NULL) {
+        for (uint32_t i = 0; i < grp->num_sketches; ++i) {
+            cms_destroy(&grp->sketches[i]);
+        }
+        free(grp->sketches);
+    }
+    free(grp->bins);
+    grp->sketches = NULL;
+    grp->bins = NULL;
+    grp->width = 0;
+    grp->depth = 0;
+    grp->num_sketches = 0;
+    grp->elements_added = 0;
+    grp->hash_function = NULL;
+    return CMS_SUCCESS;
+}
+
+int cms_group_clear(CountMinSketchGroup* grp) {
+    if (grp->interleaved) {
+        memset(grp->bins, 0, (uint64_t)grp->width * grp->depth * grp->num_sketches * sizeof(int32_t));
+    } else {
+        for (uint32_t i = 0; i < grp->num_sketches; ++i) {
+            cms_clear(&grp->sketches[i]);
+        }
+    }
+    grp->elements_added = 0;
+    return CMS_SUCCESS;
+}
+
+int cms_group_add_inc_alt(CountMinSketchGroup* grp, uint64_t* hashes, unsigned int num_hashes, uint32_t x) {
+    if (num_hashes < grp->depth) {
+        fprintf(stderr, "Insufficient hashes to complete the addition of the element to the count-min sketch group!");
+        return CMS_ERROR;
+    }
+    uint32_t n = grp->num_sketches;
+    for (unsigned int i = 0; i < grp->depth; ++i) {
+        uint64_t bin = __bin_index(grp->width, i, hashes[i]);
+        if (grp->interleaved) {
+            int32_t* cell = grp->bins + bin * n;
+            for (uint32_t m = 0; m < n; ++m) {
+                cell[m] = __safe_add(cell[m], x);
+            }
+        } else {
+            for (uint32_t m = 0; m < n; ++m) {
+                CountMinSketch* cms = &grp->sketches[m];
+                __bin_prepare(cms, bin);
+                cms->bins[bin] = __safe_add(cms->bins[bin], x);
+            }
+        }
+    }
+    if (!grp->interleaved) {
+        for (uint32_t m = 0; m < n; ++m) {
+            CountMinSketch* cms = &grp->sketches[m];
+            cms->elements_added += x;
+            if (cms->age_shift != 0) {
+                __age_step(cms, CMS_AGE_STEP);
+            }
+        }
+    }
+    grp->elements_added += x;
+    return CMS_SUCCESS;
+}
+
+int cms_group_add_inc(CountMinSketchGroup* grp, const char* key, uint32_t x) {
+    uint64_t* hashes = grp->hash_function(grp->depth, key);
+    int res = cms_group_add_inc_alt(grp, hashes, grp->depth, x);
+    free(hashes);
+    return res;
+}
+
+int cms_group_check_alt(CountMinSketchGroup* grp, uint64_t* hashes, unsigned int num_hashes, int32_t* results) {
+    if (num_hashes < grp->depth) {
+        fprintf(stderr, "Insufficient hashes to complete the min lookup of the element to the count-min sketch group!");
+        return CMS_ERROR;
+    }
+    uint32_t n = grp->num_sketches;
+    for (uint32_t m = 0; m < n; ++m) {
+        results[m] = INT32_MAX;
+    }
+    for (unsigned int i = 0; i < grp->depth; ++i) {
+        uint64_t bin = __bin_index(grp->width, i, hashes[i]);
+        for (uint32_t m = 0; m < n; ++m) {
+            int32_t val = grp->interleaved ? grp->bins[bin * n + m] : __bin_value(&grp->sketches[m], bin);
+            if (val < results[m]) {
+                results[m] = val;
+            }
+        }
+    }
+    return CMS_SUCCESS;
+}
+
+int cms_group_check(CountMinSketchGroup* grp, const char* key, int32_t* results) {
+    uint64_t* hashes = grp->hash_function(grp->depth, key);
+    int res = cms_group_check_alt(grp, hashes, grp->depth, results);
+    free(hashes);
+    return res;
+}
+
+int cms_group_extract(CountMinSketchGroup* grp, unsigned int member, CountMinSketch* cms) {
+    if (member >= grp->num_sketches) {
+        fprintf(stderr, "Unable to extract member %u of a count-min sketch group of %u!\n", member, grp->num_sketches);
+        return CMS_ERROR;
+    }
+    if (!grp->interleaved) {
+        CountMinSketch* sketches[] = {&grp->sketches[member]};
+        return cms_merge_array(cms, sketches, 1, 1);
+    }
+    if (cms_init_alt(cms, grp->width, grp->depth, grp->hash_function) == CMS_ERROR) {
+        return CMS_ERROR;
+    }
+    uint64_t length = (uint64_t)grp->width * grp->depth;
+    for (uint64_t bin = 0; bin < length; ++bin) {
+        cms->bins[bin] = grp->bins[bin * grp->num_sketches + member];
+    }
+    cms->elements_added = grp->elements_added;
+    return CMS_SUCCESS;
+}
+
+
+/*******************************************************************************
+*    COUNT-MIN SKETCH ARENA
+*******************************************************************************/
+int cms_arena_init_alt(CountMinSketchArena* arena, unsigned int width, unsigned int depth, unsigned int slab_size, cms_hash_function hash_function) {
+    if (depth < 1 || width < 1 || slab_size < 1) {
+        fprintf(stderr, "Unable to initialize the count-min sketch arena since either width, depth, or slab_size is 0!\n");
+        return CMS_ERROR;
+    }
+    arena->width = width;
+    arena->depth = depth;
+    arena->slab_size = slab_size;
+    arena->num_slabs = 0;
+    arena->num_used = 0;
+    arena->num_free = 0;
+    arena->hash_function = (hash_function == NULL) ? __default_hash : hash_function;
+    arena->sketches = NULL;
+    arena->bins = NULL;
+    arena->in_use = NULL;
+    arena->free_ids = NULL;
+    return CMS_SUCCESS;
+}
+
+int cms_arena_destroy(CountMinSketchArena* arena) {
+    uint64_t num_ids = (uint64_t)arena->num_slabs * arena->slab_size;
+    for (uint64_t id = 0; id < num_ids; ++id) {
+        if (arena->in_use[id]) {
+            cms_arena_release(arena, id);  /* frees any per sketch state */
+        }
+    }
+    for (uint32_t i = 0; i < arena->num_slabs; ++i) {
+        free(arena->sketches[i]);
+        free(arena->bins[i]);
+    }
+    free(arena->sketches);
+    free(arena->bins);
+    free(arena->in_use);
+    free(arena->free_ids);
+    arena->sketches = NULL;
+    arena->bins = NULL;
+    arena->in_use = NULL;
+    arena->free_ids = NULL;
+    arena->num_slabs = 0;
+    arena->num_used = 0;
+    arena->num_free = 0;
+    return CMS_SUCCESS;
+}
+
+int cms_arena_acquire(CountMinSketchArena* arena, uint64_t* id) {
+    if (arena->num_free == 0 && __arena_grow(arena) == CMS_ERROR) {
+        return CMS_ERROR;
+    }
+    *id = arena->free_ids[--arena->num_free];
+    arena->in_use[*id] = 1;
+    ++arena->num_used;
+    __arena_setup_sketch(arena, *id);
+    return CMS_SUCCESS;
+}
+
+CountMinSketch* cms_arena_get(CountMinSketchArena* arena, uint64_t id) {
+    if (id >= (uint64_t)arena->num_slabs * arena->slab_size || !arena->in_use[id]) {
+        return NULL;
+    }
+    return &arena->sketches[id / arena->slab_size][id % arena->slab_size];
+}
+
+int cms_arena_release(CountMinSketchArena* arena, uint64_t id) {
+    CountMinSketch* cms = cms_arena_get(arena, id);
+    if (cms == NULL) {
+        fprintf(stderr, "Unable to release count-min sketch %" PRIu64 " since it is not in use!\n", id);
+        return CMS_ERROR;
+    }
+    cms_export_wait(cms);
+    cms_topk_disable(cms);
+    free(cms->age_blocks);
+    cms->age_blocks = NULL;
+    memset(cms->bins, 0, (uint64_t)arena->width * arena->depth * sizeof(int32_t));
+    arena->in_use[id] = 0;
+    arena->free_ids[arena->num_free++] = id;
+    --arena->num_used;
+    return CMS_SUCCESS;
+}
+
+int cms_arena_export(CountMinSketchArena* arena, const char* filepath) {
+    FILE* fp = fopen(filepath, "w+b");
+    if (fp == NULL) {
+        fprintf(stderr, "Can't open file %s!\n", filepath);
+        return CMS_ERROR;
+    }
+    uint64_t id, num_ids = (uint64_t)arena->num_slabs * arena->slab_size;
+    uint64_t slab_bins = (uint64_t)arena->width * arena->depth * arena->slab_size;
+    for (id = 0; id < num_ids; ++id) {
+        if (arena->in_use[id]) {
+            CountMinSketch* cms = cms_arena_get(arena, id);
+            cms_export_wait(cms);
+            __age_complete(cms);
+        }
+    }
+
+    /* the bins of each slab, then each sketch's element count and state */
+    int ok = 1;
+    for (uint32_t i = 0; i < arena->num_slabs && ok; ++i) {
+        ok = fwrite(arena->bins[i], sizeof(int32_t), slab_bins, fp) == slab_bins;
+    }
+    for (id = 0; id < num_ids && ok; ++id) {
+        int64_t elements_added = arena->in_use[id] ? cms_arena_get(arena, id)->elements_added : 0;
+        ok = fwrite(&elements_added, sizeof(int64_t), 1, fp) == 1;
+    }
+    ok = ok && (num_ids == 0 || fwrite(arena->in_use, sizeof(uint8_t), num_ids, fp) == num_ids);
+    ok = ok && fwrite(&arena->width, sizeof(uint32_t), 1, fp) == 1;
+    ok = ok && fwrite(&arena->depth, sizeof(uint32_t), 1, fp) == 1;
+    ok = ok && fwrite(&arena->slab_size, sizeof(uint32_t), 1, fp) == 1;
+    ok = ok && fwrite(&arena->num_slabs, sizeof(uint32_t), 1, fp) == 1;
+    if (fclose(fp) != 0 || !ok) {
+        fprintf(stderr, "Failed to export the count-min sketch arena to %s!\n", filepath);
+        return CMS_ERROR;
+    }
+    return CMS_SUCCESS;
+}
+
+int cms_arena_import_alt(CountMinSketchArena* arena, const char* filepath, cms_hash_function hash_function) {
+    uint32_t trailer[4];
+    FILE* fp = fopen(filepath, "r+b");
+    if (fp == NULL) {
+        fprintf(stderr, "Can't open file %s!\n", filepath);
+        return CMS_ERROR;
+    }
+    long size = -1;
+    if (fseek(fp, 0, SEEK_END) == 0) {
+        size = ftell(fp);
+    }
+    uint64_t expected = 0;
+    if (size < (long)CMS_ARENA_FILE_TRAILER
+        || fseek(fp, size - (long)CMS_ARENA_FILE_TRAILER, SEEK_SET) != 0
+        || fread(trailer, sizeof(uint32_t), 4, fp) != 4
+        || __arena_file_size(trailer, &expected) == CMS_ERROR
+        || (uint64_t)size != expected
+        || cms_arena_init_alt(arena, trailer[0], trailer[1], trailer[2], hash_function) == CMS_ERROR) {
+        fprintf(stderr, "File %s is not a valid count-min sketch arena export!\n", filepath);
+        fclose(fp);
+        return CMS_ERROR;
+    }
+    uint64_t slab_bins = (uint64_t)arena->width * arena->depth * arena->slab_size;
+    uint64_t num_ids = (uint64_t)trailer[3] * arena->slab_size;
+
+    int res = (fseek(fp, 0, SEEK_SET) == 0) ? CMS_SUCCESS : CMS_ERROR;
+    for (uint32_t i = 0; i < trailer[3] && res == CMS_SUCCESS; ++i) {
+        if (__arena_grow(arena) == CMS_ERROR || fread(arena->bins[i], sizeof(int32_t), slab_bins, fp) != slab_bins) {
+            res = CMS_ERROR;
+        }
+    }
+    int64_t* elements_added = NULL;
+    if (res == CMS_SUCCESS && num_ids != 0) {
+        elements_added = (int64_t*)malloc(num_ids * sizeof(int64_t));
+        if (elements_added == NULL
+            || fread(elements_added, sizeof(int64_t), num_ids, fp) != num_ids
+            || fread(arena->in_use, sizeof(uint8_t), num_ids, fp) != num_ids) {
+            res = CMS_ERROR;
+        }
+    }
+    fclose(fp);
+    if (res == CMS_ERROR) {
+        fprintf(stderr, "Failed to import the count-min sketch arena from %s!\n", filepath);
+        /* none of the sketches are set up yet; clear only the ids of the slabs that were added */
+        if (arena->num_slabs != 0) {
+            memset(arena->in_use, 0, (uint64_t)arena->num_slabs * arena->slab_size);
+        }
+        free(elements_added);
+        cms_arena_destroy(arena);
+        return CMS_ERROR;
+    }
+
+    /* rebuild the free ids so that the lowest are reused first */
+    arena->num_free = 0;
+    for (uint64_t id = num_ids; id-- > 0;) {
+        if (arena->in_use[id]) {
+            __arena_setup_sketch(arena, id);
+            cms_arena_get(arena, id)->elements_added = elements_added[id];
+            ++arena->num_used;
+        } else {
+            arena->free_ids[arena->num_free++] = id;
+        }
+    }
+    free(elements_added);
+    return CMS_SUCCESS;
+}
+
+
+/*******************************************************************************
+*    NUMA REPLICATED COUNT-MIN SKETCH
+*******************************************************************************/
+int cms_numa_init_alt(CountMinSketchNuma* ncms, unsigned int width, unsigned int depth, int mode, cms_hash_function hash_function) {
+    if (depth < 1 || width < 1) {
+        fprintf(stderr, "Unable to initialize the NUMA count-min sketch since either width or depth is 0!\n");
+        return CMS_ERROR;
+    }
+    if (mode != CMS_NUMA_WRITE_ALL && mode != CMS_NUMA_WRITE_SYNC) {
+        fprintf(stderr, "Unable to initialize the NUMA count-min sketch since the mode %d is unknown!\n", mode);
+        return CMS_ERROR;
+    }
+    ncms->width = width;
+    ncms->depth = depth;
+    ncms->mode = mode;
+    ncms->hash_function = (hash_function == NULL) ? __default_hash : hash_function;
+    ncms->num_replicas = 0;
+    uint32_t num_nodes = __numa_nodes();
+    ncms->replicas = (CountMinSketch*)calloc(num_nodes, sizeof(CountMinSketch));
+    if (ncms->replicas == NULL) {
+        fprintf(stderr, "Failed to allocate the NUMA count-min sketch!\n");
+        return CMS_ERROR;
+    }
+    for (uint32_t node = 0; node < num_nodes; ++node) {
+        cms_allocator allocator = {__numa_alloc, __numa_free, (void*)(uintptr_t)node, 0};
+        if (cms_init_allocator_alt(&ncms->replicas[node], width, depth, &allocator, ncms->hash_function) == CMS_ERROR) {
+            cms_numa_destroy(ncms);
+            return CMS_ERROR;
+        }
+        ++ncms->num_replicas;
+    }
+    return CMS_SUCCESS;
+}
+
+int cms_numa_destroy(CountMinSketchNuma* ncms) {
+    for (uint32_t i = 0; i < ncms->num_replicas; ++i) {
+        cms_destroy(&ncms->replicas[i]);
+    }
+    free(ncms->replicas);
+    ncms->replicas = NULL;
+    ncms->num_replicas = 0;
+    ncms->width = 0;
+    ncms->depth = 0;
+    ncms->mode = CMS_NUMA_WRITE_ALL;
+    ncms->hash_function = NULL;
+    return CMS_SUCCESS;
+}
+
+int cms_numa_clear(CountMinSketchNuma* ncms) {
+    for (uint32_t i = 0; i < ncms->num_replicas; ++i) {
+        cms_clear(&ncms->replicas[i]);
+    }
+    return CMS_SUCCESS;
+}
+
+int cms_numa_sync(CountMinSketchNuma* ncms) {
+    CountMinSketch* primary = &ncms->replicas[0];
+    __age_complete(primary);
+    __snapshot_complete(primary);
+    for (uint32_t i = 1; i < ncms->num_replicas; ++i) {
+        CountMinSketch* replica = &ncms->replicas[i];
+        __snapshot_complete(replica);
+        memcpy(replica->bins, primary->bins, (uint64_t)ncms->width * ncms->depth * sizeof(int32_t));
+        replica->elements_added = primary->elements_added;
+    }
+    return CMS_SUCCESS;
+}
+
+CountMinSketch* cms_numa_local(CountMinSketchNuma* ncms) {
+    uint32_t node = __numa_current_node();
+    return &ncms->replicas[node < ncms->num_replicas ? node : 0];
+}
+
+int32_t cms_numa_add_inc(CountMinSketchNuma* ncms, const char* key, uint32_t x) {
+    uint64_t* hashes = ncms->hash_function(ncms->depth, key);
+    int32_t num_add = cms_numa_add_inc_alt(ncms, hashes, ncms->depth, x);
+    free(hashes);
+    return num_add;
+}
+
+int32_t cms_numa_add_inc_alt(CountMinSketchNuma* ncms, uint64_t* hashes, unsigned int num_hashes, uint32_t x) {
+    if (ncms->mode == CMS_NUMA_WRITE_SYNC) {
+        return cms_add_inc_alt(&ncms->replicas[0], hashes, num_hashes, x);
+    }
+    CountMinSketch* local = cms_numa_local(ncms);
+    int32_t num_add = CMS_ERROR;
+    for (uint32_t i = 0; i < ncms->num_replicas; ++i) {
+        int32_t res = cms_add_inc_alt(&ncms->replicas[i], hashes, num_hashes, x);
+        if (&ncms->replicas[i] == local) {
+            num_add = res;
+        }
+    }
+    return num_add;
+}
+
+int32_t cms_numa_check(CountMinSketchNuma* ncms, const char* key) {
+    uint64_t* hashes = ncms->hash_function(ncms->depth, key);
+    int32_t num_add = cms_numa_check_alt(ncms, hashes, ncms->depth);
+    free(hashes);
+    return num_add;
+}
+
+int32_t cms_numa_check_alt(CountMinSketchNuma* ncms, uint64_t* hashes, unsigned int num_hashes) {
+    return cms_check_alt(cms_numa_local(ncms), hashes, num_hashes);
+}
+
+
+/*******************************************************************************
+*    PRIVATE FUNCTIONS
+*******************************************************************************/
+static int __setup_cms(CountMinSketch* cms, unsigned int width, unsigned int depth, double error_rate, double confidence, cms_hash_function hash_function) {
+    __init_cms_fields(cms, width, depth, error_rate, confidence, hash_function);
+    return __alloc_bins(cms);
+}
+
+/*  Allocate the bins for the width and depth of the count-min sketch; sizes
+    are 64-bit throughout, so only sketches whose bins do not fit in the
+    address space are refused */
+static int __alloc_bins(CountMinSketch* cms) {
+    uint64_t length = (uint64_t)cms->width * cms->depth;
+    if (length > SIZE_MAX / sizeof(int32_t)) {
+        fprintf(stderr, "Unable to allocate %" PRIu64 " bins since they do not fit in memory!\n", length);
+        return CMS_ERROR;
+    }
+    cms->bins = __bins_alloc(cms->alloc, length);
+    if (NULL == cms->bins) {
+        fprintf(stderr, "Failed to allocate %" PRIu64 " bytes for bins!", length * sizeof(int32_t));
+        return CMS_ERROR;
+    }
+    return CMS_SUCCESS;
+}
+
+static void __init_cms_fields(CountMinSketch* cms, uint32_t width, uint32_t depth, double error_rate, double confidence, cms_hash_function hash_function) {
+    cms->width = width;
+    cms->depth = depth;
+    cms->confidence = confidence;
+    cms->error_rate = error_rate;
+    cms->elements_added = 0;
+    cms->bins = NULL;
+    cms->snapshot = NULL;
+    cms->age_shift = 0;
+    cms->age_epoch = 0;
+    cms->age_cursor = 0;
+    cms->age_blocks = NULL;
+    cms->topk = NULL;
+    cms->sparse = NULL;
+    cms->alloc = NULL;
+    cms->hash_function = (hash_function == NULL) ? __default_hash : hash_function;
+}
+
+static int __write_to_file(CountMinSketch* cms, FILE *fp, short on_disk) {
+    uint64_t length = (uint64_t)cms->depth * cms->width;
+    int res = CMS_SUCCESS;
+    if (cms->sparse != NULL) {
+        __sparse_write(cms, fp);
+    } else if (on_disk == 0) {
+        res = __write_bins(cms->bins, length, fp);
+    } else {
+        // TODO: decide if this should be done directly on disk or not
+        // will need to write out everything by hand
+        // uint64_t i;
+        // int q = 0;
+        // for (i = 0; i < length; ++i) {
+        //     fwrite(&q, sizeof(int), 1, fp);
+        // }
+    }
+    if (res == CMS_ERROR
+        || fwrite(&cms->width, sizeof(int32_t), 1, fp) != 1
+        || fwrite(&cms->depth, sizeof(int32_t), 1, fp) != 1
+        || fwrite(&cms->elements_added, sizeof(int64_t), 1, fp) != 1) {
+        return CMS_ERROR;
+    }
+    return CMS_SUCCESS;
+}
+
+static int __read_from_file(CountMinSketch* cms, FILE *fp, short on_disk, const char* filename, const cms_allocator* allocator, cms_hash_function hash_function) {
+    /* read in the values from the file before getting the sketch itself */
+    uint32_t width = 0, depth = 0;
+    int64_t elements_added = 0;
+    if (__read_trailer(fp, &width, &depth, &elements_added) == CMS_ERROR || width == 0 || depth == 0) {
+        fprintf(stderr, "File %s is not a valid count-min sketch export!\n", filename);
+        return CMS_ERROR;
+    }
+    __init_cms_fields(cms, width, depth, 2 / (double) width, 1 - (1 / pow(2, depth)), hash_function);
+    cms->elements_added = elements_added;
+
+    uint64_t length = (uint64_t)cms->width * cms->depth;
+    if (on_disk == 0) {
+        if (allocator != NULL) {
+            cms->alloc = (struct cms_alloc*)calloc(1, sizeof(struct cms_alloc));
+            if (cms->alloc == NULL) {
+                fprintf(stderr, "Failed to allocate the count-min sketch allocator!\n");
+                return CMS_ERROR;
+            }
+            cms->alloc->allocator = *allocator;
+        }
+        if (__alloc_bins(cms) == CMS_ERROR || __read_bins(cms->bins, length, fp) == CMS_ERROR) {
+            fprintf(stderr, "Failed to read the bins of %s!\n", filename);
+            __bins_free(cms->alloc, cms->bins);
+            free(cms->alloc);
+            cms->alloc = NULL;
+            cms->bins = NULL;
+            return CMS_ERROR;
+        }
+    } else {
+        // TODO: decide if this should be done directly on disk or not
+    }
+    return CMS_SUCCESS;
+}
+
+/*  Write the bins a chunk at a time, seeking over chunks of zeros so that the
+    untouched bins of large count-min sketches become holes in the file */
+static int __write_bins(const int32_t* bins, uint64_t length, FILE* fp) {
+    for (uint64_t start = 0; start < length; start += CMS_IO_CHUNK) {
+        uint64_t n = (length - start < CMS_IO_CHUNK) ? length - start : CMS_IO_CHUNK;
+        if (__bins_zero(bins + start, n) && fseek(fp, (long)(n * sizeof(int32_t)), SEEK_CUR) == 0) {
+            continue;
+        }
+        if (fwrite(bins + start, sizeof(int32_t), n, fp) != n) {
+            return CMS_ERROR;
+        }
+    }
+    return CMS_SUCCESS;
+}
+
+/*  Read the bins a chunk at a time into zeroed bins, storing only the chunks
+    that are not all zeros so that untouched pages stay unused */
+static int __read_bins(int32_t* bins, uint64_t length, FILE* fp) {
+    int32_t* chunk = (int32_t*)malloc(CMS_IO_CHUNK * sizeof(int32_t));
+    if (chunk == NULL) {
+        return CMS_ERROR;
+    }
+    int res = CMS_SUCCESS;
+    for (uint64_t start = 0; start < length && res == CMS_SUCCESS; start += CMS_IO_CHUNK) {
+        uint64_t n = (length - start < CMS_IO_CHUNK) ? length - start : CMS_IO_CHUNK;
+        if (fread(chunk, sizeof(int32_t), n, fp) != n) {
+            res = CMS_ERROR;
+        } else if (!__bins_zero(chunk, n)) {
+            memcpy(bins + start, chunk, n * sizeof(int32_t));
+        }
+    }
+    free(chunk);
+    return res;
+}
+
+static __inline__ int __bins_zero(const int32_t* bins, uint64_t length) {
+    return length == 0 || (bins[0] == 0 && memcmp(bins, bins + 1, (length - 1) * sizeof(int32_t)) == 0);
+}
+
+/*  Map the hash into the row; power of two widths use a mask rather than the
+    (much slower) modulo, which gives the same result */
+static __inline__ uint64_t __bin_index(uint32_t width, unsigned int row, uint64_t hash) {
+    uint64_t col = ((width & (width - 1)) == 0) ? (hash & (width - 1)) : (hash % width);
+    return col + ((uint64_t)row * width);
+}
+
+/*  Sum the bins of each row that map to the same bin in the narrower width;
+    valid since (hash % src_width) % dst_width == hash % dst_width whenever
+    dst_width divides src_width. `dst` may be the same array as `src` as the
+    folded bins are always written at or before the bins still to be read */
+static void __fold_bins(const int32_t* src, uint32_t src_width, int32_t* dst, uint32_t dst_width, uint32_t depth) {
+    uint32_t factor = src_width / dst_width;
+    for (uint32_t r = 0; r < depth; ++r) {
+        const int32_t* row = src + (uint64_t)r * src_width;
+        int32_t* out = dst + (uint64_t)r * dst_width;
+        memmove(out, row, (uint64_t)dst_width * sizeof(int32_t));
+        for (uint32_t k = 1; k < factor; ++k) {
+            __add_bins(out, out, row + (uint64_t)k * dst_width, dst_width);
+        }
+    }
+}
+
+/*  Read the dimensions from the end of an exported file and leave the file
+    positioned at the start of the bins; the file size must match exactly */
+static int __read_trailer(FILE* fp, uint32_t* width, uint32_t* depth, int64_t* elements_added) {
+    if (fseek(fp, 0, SEEK_END) != 0) {
+        return CMS_ERROR;
+    }
+    long size = ftell(fp);
+    if (size < (long)CMS_FILE_TRAILER || fseek(fp, size - (long)CMS_FILE_TRAILER, SEEK_SET) != 0) {
+        return CMS_ERROR;
+    }
+    if (fread(width, sizeof(int32_t), 1, fp) != 1
+        || fread(depth, sizeof(int32_t), 1, fp) != 1
+        || fread(elements_added, sizeof(int64_t), 1, fp) != 1) {
+        return CMS_ERROR;
+    }
+    if ((uint64_t)*width * *depth > SIZE_MAX / sizeof(int32_t)
+        || (uint64_t)*width * *depth * sizeof(int32_t) + CMS_FILE_TRAILER != (uint64_t)size) {
+        return CMS_ERROR;
+    }
+    rewind(fp);
+    return CMS_SUCCESS;
+}
+
+static CountMinSketch** __collect_sketches(int num_sketches, va_list* args) {
+    if (num_sketches < 1) {
+        fprintf(stderr, "Unable to merge count-min sketches since no sketches were provided!\n");
+        return NULL;
+    }
+    CountMinSketch** sketches = (CountMinSketch**)malloc(num_sketches * sizeof(CountMinSketch*));
+    if (sketches == NULL) {
+        fprintf(stderr, "Failed to allocate the count-min sketches to merge!\n");
+        return NULL;
+    }
+    va_list ap;
+    va_copy(ap, *args);
+    for (int i = 0; i < num_sketches; ++i) {
+        sketches[i] = va_arg(ap, CountMinSketch *);
+    }
+    va_end(ap);
+    return sketches;
+}
+
+/*  Merge the sketches into the base splitting the bins across `num_threads`;
+    each thread owns a contiguous range of bins and applies every sketch in
+    order so the result is identical to a single threaded merge (the
+    saturating add is not associative so a tree reduction could differ) */
+static void __merge_cms(CountMinSketch* base, CountMinSketch** sketches, size_t num_sketches, unsigned int num_threads) {
+    size_t i;
+
+    __age_complete(base);
+    for (i = 0; i < num_sketches; ++i) {
+        __age_complete(sketches[i]);
+        base->elements_added += sketches[i]->elements_added;
+    }
+
+    /*  the sketches are added in order since saturation depends on it; sparse
+        count-min sketches only add their non-zero bins and each run of dense
+        ones is merged a tile at a time */
+    for (i = 0; i < num_sketches; /* advanced below */) {
+        const struct cms_sparse* sparse = sketches[i]->sparse;
+        if (sparse != NULL) {
+            for (uint64_t j = 0; j <= sparse->mask; ++j) {
+                if (sparse->keys[j] != 0) {
+                    uint64_t bin = sparse->keys[j] - 1;
+                    base->bins[bin] = __safe_add_2(base->bins[bin], sparse->counts[j]);
+                }
+            }
+            ++i;
+            continue;
+        }
+        size_t run = 1;
+        while (i + run < num_sketches && sketches[i + run]->sparse == NULL) {
+            ++run;
+        }
+        __merge_cms_dense(base, sketches + i, run, num_threads);
+        i += run;
+    }
+}
+
+/* Merge dense count-min sketches, splitting the bins across threads */
+static void __merge_cms_dense(CountMinSketch* base, CountMinSketch** sketches, size_t num_sketches, unsigned int num_threads) {
+    uint64_t bins = (uint64_t)base->width * base->depth;
+    if (num_threads > bins / CMS_MERGE_MIN_THREAD_BINS) {
+        num_threads = bins / CMS_MERGE_MIN_THREAD_BINS;
+    }
+    if (num_threads <= 1) {
+        __merge_cms_range(base, sketches, num_sketches, 0, bins);
+        return;
+    }
+
+    pthread_t* threads = (pthread_t*)malloc(num_threads * sizeof(pthread_t));
+    cms_merge_range* ranges = (cms_merge_range*)malloc(num_threads * sizeof(cms_merge_range));
+    if (threads == NULL || ranges == NULL) {
+        free(threads);
+        free(ranges);
+        __merge_cms_range(base, sketches, num_sketches, 0, bins);
+        return;
+    }
+
+    /* split on tile boundaries */
+    uint64_t tiles = (bins + CMS_MERGE_TILE - 1) / CMS_MERGE_TILE;
+    unsigned int t, started;
+    for (t = 0; t < num_threads; ++t) {
+        ranges[t].base = base;
+        ranges[t].sketches = sketches;
+        ranges[t].num_sketches = num_sketches;
+        ranges[t].start = (tiles * t / num_threads) * CMS_MERGE_TILE;
+        ranges[t].end = (t == num_threads - 1) ? bins : (tiles * (t + 1) / num_threads) * CMS_MERGE_TILE;
+    }
+    for (started = 1; started < num_threads; ++started) {
+        if (pthread_create(&threads[started], NULL, __merge_cms_worker, &ranges[started]) != 0)
+            break;
+    }
+    /* the calling thread merges the first range and any whose thread failed to start */
+    for (t = 0; t < num_threads; ++t) {
+        if (t == 0 || t >= started)
+            __merge_cms_range(base, sketches, num_sketches, ranges[t].start, ranges[t].end);
+    }
+    for (t = 1; t < started; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+    free(ranges);
+}
+
+static void* __merge_cms_worker(void* arg) {
+    cms_merge_range* range = (cms_merge_range*)arg;
+    __merge_cms_range(range->base, range->sketches, range->num_sketches, range->start, range->end);
+    return NULL;
+}
+
+/*  Merge the bins [start, end) a tile at a time; the tile of the base stays in
+    cache while the matching tile of every sketch is streamed through it */
+static void __merge_cms_range(CountMinSketch* base, CountMinSketch** sketches, size_t num_sketches, uint64_t start, uint64_t end) {
+    for (uint64_t tile = start; tile < end; tile += CMS_MERGE_TILE) {
+        uint64_t tile_end = (tile + CMS_MERGE_TILE > end) ? end : tile + CMS_MERGE_TILE;
+        for (size_t i = 0; i < num_sketches; ++i) {
+            __add_bins(base->bins + tile, base->bins + tile, sketches[i]->bins + tile, tile_end - tile);
+        }
+    }
+}
+
+static int __validate_merge(CountMinSketch* base, CountMinSketch** sketches, size_t num_sketches) {
+    size_t i = 0;
+
+    if (num_sketches < 1 || sketches == NULL) {
+        fprintf(stderr, "Unable to merge count-min sketches since no sketches were provided!\n");
+        return CMS_ERROR;
+    }
+
+    if (base == NULL) {
+        base = sketches[0];
+        ++i;
+    }
+
+    for (/* skip */; i < num_sketches; ++i) {
+        CountMinSketch *individual_cms = sketches[i];
+        if (!(base->depth == individual_cms->depth
+            && base->width == individual_cms->width
+            && base->hash_function == individual_cms->hash_function)) {
+
+            fprintf(stderr, "Cannot merge sketches due to incompatible definitions (depth=(%d/%d) width=(%d/%d) hash=(0x%" PRIXPTR "/0x%" PRIXPTR "))",
+                base->depth, individual_cms->depth,
+                base->width, individual_cms->width,
+                (uintptr_t) base->hash_function, (uintptr_t) individual_cms->hash_function);
+            return CMS_ERROR;
+        }
+    }
+    return CMS_SUCCESS;
+}
+
+static void* __snapshot_worker(void* arg) {
+    struct cms_snapshot* snap = (struct cms_snapshot*)arg;
+    int status = CMS_SUCCESS;
+
+    for (uint64_t chunk = 0; chunk < snap->num_chunks; ++chunk) {
+        __snapshot_copy_chunk(snap, chunk);
+        if (status == CMS_ERROR) {
+            continue;  /* keep copying so writers are not left paying for it */
+        }
+        uint64_t start = chunk * CMS_SNAPSHOT_CHUNK;
+        uint64_t len = (start + CMS_SNAPSHOT_CHUNK > snap->num_bins) ? snap->num_bins - start : CMS_SNAPSHOT_CHUNK;
+        if (fwrite(snap->bins + start, sizeof(int32_t), len, snap->fp) != len) {
+            status = CMS_ERROR;
+        }
+    }
+
+    if (status == CMS_SUCCESS) {
+        if (fwrite(&snap->width, sizeof(int32_t), 1, snap->fp) != 1
+            || fwrite(&snap->depth, sizeof(int32_t), 1, snap->fp) != 1
+            || fwrite(&snap->elements_added, sizeof(int64_t), 1, snap->fp) != 1) {
+            status = CMS_ERROR;
+        }
+    }
+    if (fclose(snap->fp) != 0) {
+        status = CMS_ERROR;
+    }
+    if (status == CMS_ERROR) {
+        fprintf(stderr, "Failed to write the background export to %s!\n", snap->filepath);
+    }
+
+    snap->status = status;
+    if (snap->callback != NULL) {
+        snap->callback(snap->cms, snap->filepath, status, snap->data);
+    }
+    return NULL;
+}
+
+/*  Copy a chunk of the bins into the snapshot exactly once; whichever of the
+    writer or the background thread gets there first does the copy and the
+    other waits for that single chunk to finish */
+static void __snapshot_copy_chunk(struct cms_snapshot* snap, uint64_t chunk) {
+    uint8_t expected = CMS_CHUNK_PENDING;
+    if (__atomic_load_n(&snap->chunk_state[chunk], __ATOMIC_ACQUIRE) == CMS_CHUNK_COPIED) {
+        return;
+    }
+    if (__atomic_compare_exchange_n(&snap->chunk_state[chunk], &expected, CMS_CHUNK_COPYING, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        uint64_t start = chunk * CMS_SNAPSHOT_CHUNK;
+        uint64_t len = (start + CMS_SNAPSHOT_CHUNK > snap->num_bins) ? snap->num_bins - start : CMS_SNAPSHOT_CHUNK;
+        memcpy(snap->bins + start, snap->cms->bins + start, len * sizeof(int32_t));
+        __atomic_store_n(&snap->chunk_state[chunk], CMS_CHUNK_COPIED, __ATOMIC_RELEASE);
+        return;
+    }
+    while (__atomic_load_n(&snap->chunk_state[chunk], __ATOMIC_ACQUIRE) != CMS_CHUNK_COPIED) {
+        /* spin; the other side is copying at most CMS_SNAPSHOT_CHUNK bins */
+    }
+}
+
+/* Used before bulk modifications of the bins (clear, merge, etc) */
+static void __snapshot_complete(CountMinSketch* cms) {
+    if (cms->snapshot == NULL) {
+        return;
+    }
+    for (uint64_t chunk = 0; chunk < cms->snapshot->num_chunks; ++chunk) {
+        __snapshot_copy_chunk(cms->snapshot, chunk);
+    }
+}
+
+static __inline__ void __snapshot_touch(CountMinSketch* cms, uint64_t bin) {
+    if (cms->snapshot != NULL) {
+        __snapshot_copy_chunk(cms->snapshot, bin / CMS_SNAPSHOT_CHUNK);
+    }
+}
+
+/* The current value of a bin including any aging not yet applied to it */
+static __inline__ int32_t __bin_value(const CountMinSketch* cms, uint64_t bin) {
+    if (cms->sparse != NULL) {
+        return __sparse_get(cms->sparse, bin);
+    }
+    if (cms->age_shift != 0 && cms->age_blocks[bin / CMS_AGE_BLOCK] != cms->age_epoch) {
+        return __age_value(cms->bins[bin], cms->age_shift);
+    }
+    return cms->bins[bin];
+}
+
+/* Bring a bin up to date before it is modified */
+static __inline__ void __bin_prepare(CountMinSketch* cms, uint64_t bin) {
+    __snapshot_touch(cms, bin);
+    if (cms->age_shift != 0) {
+        __age_block(cms, bin / CMS_AGE_BLOCK);
+    }
+}
+
+static void __age_block(CountMinSketch* cms, uint64_t block) {
+    if (cms->age_blocks[block] == cms->age_epoch) {
+        return;
+    }
+    uint64_t bins = (uint64_t)cms->width * cms->depth;
+    uint64_t start = block * CMS_AGE_BLOCK;
+    uint64_t len = (start + CMS_AGE_BLOCK > bins) ? bins - start : CMS_AGE_BLOCK;
+    __snapshot_touch(cms, start);  /* a block never spans copy-on-write chunks */
+    __age_bins(cms->bins + start, len, cms->age_shift);
+    cms->age_blocks[block] = cms->age_epoch;
+}
+
+/* Sweep the next `num_blocks` blocks of a lazy aging pass */
+static void __age_step(CountMinSketch* cms, uint64_t num_blocks) {
+    uint64_t blocks = ((uint64_t)cms->width * cms->depth + CMS_AGE_BLOCK - 1) / CMS_AGE_BLOCK;
+    uint64_t end = (cms->age_cursor + num_blocks > blocks) ? blocks : cms->age_cursor + num_blocks;
+    for (/* skip */; cms->age_cursor < end; ++cms->age_cursor) {
+        __age_block(cms, cms->age_cursor);
+    }
+    if (cms->age_cursor == blocks) {
+        cms->age_shift = 0;
+    }
+}
+
+/*  Start a lazy aging pass (or clear); every block then has a stale epoch and
+    is aged when touched or swept. The epochs restart before they wrap so that
+    a block left stale by an unfinished clear never matches a later epoch */
+static int __age_start(CountMinSketch* cms, unsigned int shift) {
+    uint64_t blocks = ((uint64_t)cms->width * cms->depth + CMS_AGE_BLOCK - 1) / CMS_AGE_BLOCK;
+    if (cms->age_blocks == NULL) {
+        cms->age_blocks = (uint8_t*)calloc(blocks, sizeof(uint8_t));
+        if (cms->age_blocks == NULL) {
+            return CMS_ERROR;
+        }
+        cms->age_epoch = 0;
+    } else if (cms->age_epoch == UINT8_MAX) {
+        __age_complete(cms);
+        memset(cms->age_blocks, 0, blocks * sizeof(uint8_t));
+        cms->age_epoch = 0;
+    }
+    ++cms->age_epoch;
+    cms->age_shift = shift;
+    cms->age_cursor = 0;
+    return CMS_SUCCESS;
+}
+
+/* Finish any lazy aging pass; used before the bins are read or written in bulk */
+static void __age_complete(CountMinSketch* cms) {
+    if (cms->age_shift != 0) {
+        __age_step(cms, UINT64_MAX);
+    }
+}
+
+/*  The hot loops; each has a scalar implementation and, on x86 with GCC or
+    clang, SSE2, AVX2 and AVX-512 implementations compiled for their own
+    target whatever the build flags. The best supported by the CPU is selected
+    on first use by `__cms_kernels`, so a single build of the library runs the
+    fastest path on every host. */
+static void __hash_scalar(const char* key, unsigned int num_hashes, uint64_t* results) {
+    for (unsigned int i = 0; i < num_hashes; ++i) {
+        results[i] = __fnv_1a(key, i);
+    }
+}
+
+/*  Divide the bins by 2^shift rounding towards zero; bins saturated at
+    INT32_MAX or INT32_MIN stay saturated as with all other operations.
+    A shift of CMS_AGE_CLEAR zeroes all the bins */
+static void __age_bins(int32_t* bins, uint64_t len, unsigned int shift) {
+    if (shift >= CMS_AGE_CLEAR) {
+        memset(bins, 0, len * sizeof(int32_t));
+        return;
+    }
+    __cms_kernels()->age_bins(bins, len, shift);
+}
+
+static void __age_bins_scalar(int32_t* bins, uint64_t len, unsigned int shift) {
+    for (uint64_t i = 0; i < len; ++i) {
+        bins[i] = __age_value(bins[i], shift);
+    }
+}
+
+/* Dot product of two rows using 64-bit products and sums */
+static int64_t __dot_product(const int32_t* a, const int32_t* b, uint64_t len) {
+    return __cms_kernels()->dot_product(a, b, len);
+}
+
+static int64_t __dot_product_scalar(const int32_t* a, const int32_t* b, uint64_t len) {
+    int64_t res = 0;
+    for (uint64_t i = 0; i < len; ++i) {
+        res += (int64_t)a[i] * b[i];
+    }
+    return res;
+}
+
+/*  dst = a + b (dst may be a) saturating at INT32_MAX and INT32_MIN; bins of
+    `a` that are already saturated stay saturated as in `__safe_add_2` */
+static void __add_bins(int32_t* dst, const int32_t* a, const int32_t* b, uint64_t len) {
+    __cms_kernels()->add_bins(dst, a, b, len);
+}
+
+static void __add_bins_scalar(int32_t* dst, const int32_t* a, const int32_t* b, uint64_t len) {
+    for (uint64_t i = 0; i < len; ++i) {
+        dst[i] = __safe_add_2(a[i], b[i]);
+    }
+}
+
+/*  dst = a - b (dst may be a) saturating at INT32_MAX and INT32_MIN; bins of
+    `a` that are already saturated stay saturated as in `__safe_sub_2` */
+static void __subtract_bins(int32_t* dst, const int32_t* a, const int32_t* b, uint64_t len) {
+    __cms_kernels()->subtract_bins(dst, a, b, len);
+}
+
+static void __subtract_bins_scalar(int32_t* dst, const int32_t* a, const int32_t* b, uint64_t len) {
+    for (uint64_t i = 0; i < len; ++i) {
+        dst[i] = __safe_sub_2(a[i], b[i]);
+    }
+}
+
+/*  The bin of each row for each of `num_keys` keys; the hashes of a key are
+    `stride` apart and its bins are written `depth` apart */
+static void __bin_indexes_scalar(uint32_t width, uint32_t depth, const uint64_t* hashes, unsigned int stride, size_t num_keys, uint64_t* bins) {
+    for (size_t k = 0; k < num_keys; ++k) {
+        for (uint32_t r = 0; r < depth; ++r) {
+            bins[k * depth + r] = __bin_index(width, r, hashes[k * stride + r]);
+        }
+    }
+}
+
+/*  Insert each key (given by its bins) `x` times, in order, writing the
+    estimate of each key as `cms_add_inc_alt` would; the bins of the keys a
+    few places ahead are prefetched to overlap the cache misses */
+static void __add_batch_scalar(int32_t* bins, uint32_t depth, const uint64_t* indexes, size_t num_keys, uint32_t x, int32_t* results) {
+    for (size_t k = 0; k < num_keys; ++k) {
+        if (k + CMS_BATCH_PREFETCH < num_keys) {
+            for (uint32_t r = 0; r < depth; ++r) {
+                CMS_PREFETCH(bins + indexes[(k + CMS_BATCH_PREFETCH) * depth + r]);
+            }
+        }
+        int32_t num_add = INT32_MAX;
+        for (uint32_t r = 0; r < depth; ++r) {
+            uint64_t bin = indexes[k * depth + r];
+            bins[bin] = __safe_add(bins[bin], x);
+            if (bins[bin] < num_add) {
+                num_add = bins[bin];
+            }
+        }
+        if (results != NULL) {
+            results[k] = num_add;
+        }
+    }
+}
+
+static void __check_batch_scalar(const int32_t* bins, uint32_t depth, const uint64_t* indexes, size_t num_keys, int32_t* results) {
+    for (size_t k = 0; k < num_keys; ++k) {
+        if (k + CMS_BATCH_PREFETCH < num_keys) {
+            for (uint32_t r = 0; r < depth; ++r) {
+                CMS_PREFETCH(bins + indexes[(k + CMS_BATCH_PREFETCH) * depth + r]);
+            }
+        }
+        int32_t num_add = INT32_MAX;
+        for (uint32_t r = 0; r < depth; ++r) {
+            int32_t val = bins[indexes[k * depth + r]];
+            if (val < num_add) {
+                num_add = val;
+            }
+        }
+        results[k] = num_add;
+    }
+}
+
+/*  The bins whose absolute value is larger than `threshold`, as `cms_changes`;
+    the vector kernels compare many bins at once and record the rare hits */
+static size_t __changes_scalar(const int32_t* bins, uint64_t len, uint32_t width, uint32_t threshold, cms_change* changes, size_t max_changes) {
+    return __changes_range(bins, 0, len, width, threshold, changes, max_changes, 0);
+}
+
+static size_t __changes_range(const int32_t* bins, uint64_t start, uint64_t len, uint32_t width, uint32_t threshold, cms_change* changes, size_t max_changes, size_t found) {
+    for (uint64_t i = start; i < len; ++i) {
+        if (__abs_bin(bins[i]) > threshold) {
+            found = __change_add(bins, i, width, changes, max_changes, found);
+        }
+    }
+    return found;
+}
+
+static __inline__ size_t __change_add(const int32_t* bins, uint64_t bin, uint32_t width, cms_change* changes, size_t max_changes, size_t found) {
+    if (found < max_changes) {
+        changes[found].row = (uint32_t)(bin / width);
+        changes[found].bin = (uint32_t)(bin % width);
+        changes[found].delta = bins[bin];
+    }
+    return found + 1;
+}
+
+#if defined(CMS_X86_KERNELS)
+#if !defined(__clang__)
+/* g++ 12 warns on the undefined vectors its own AVX-512 intrinsics start from */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+/*  FNV-1a of `lanes` seeds at once; the 64-bit multiply by the FNV prime
+    (2^40 + 0x1b3) is built from 32 x 32 -> 64 bit products as SSE2, AVX2
+    and AVX-512F have no 64-bit multiply */
+CMS_TARGET("sse2") static void __hash_sse2(const char* key, unsigned int num_hashes, uint64_t* results) {
+    size_t len = strlen(key);
+    unsigned int i = 0;
+    const __m128i prime = _mm_set1_epi64x(0x1b3);
+    for (/* skip */; i + 2 <= num_hashes; i += 2) {
+        __m128i h = _mm_set_epi64x((int64_t)(CMS_FNV_OFFSET + (31 * (int)(i + 1))), (int64_t)(CMS_FNV_OFFSET + (31 * (int)i)));
+        for (size_t j = 0; j < len; ++j) {
+            h = _mm_xor_si128(h, _mm_set1_epi64x((unsigned char)key[j]));
+            __m128i lo = _mm_mul_epu32(h, prime);
+            __m128i hi = _mm_slli_epi64(_mm_mul_epu32(_mm_srli_epi64(h, 32), prime), 32);
+            h = _mm_add_epi64(_mm_add_epi64(lo, hi), _mm_slli_epi64(h, 40));
+        }
+        _mm_storeu_si128((__m128i*)(results + i), h);
+    }
+    for (/* skip */; i < num_hashes; ++i) {
+        results[i] = __fnv_1a(key, i);
+    }
+}
+
+CMS_TARGET("avx2") static void __hash_avx2(const char* key, unsigned int num_hashes, uint64_t* results) {
+    size_t len = strlen(key);
+    const __m256i prime = _mm256_set1_epi64x(0x1b3);
+    const __m256i lanes = _mm256_set_epi64x(3 * 31, 2 * 31, 31, 0);
+    for (unsigned int i = 0; i < num_hashes; i += 4) {
+        __m256i h = _mm256_add_epi64(_mm256_set1_epi64x((int64_t)(CMS_FNV_OFFSET + (31 * (int)i))), lanes);
+        for (size_t j = 0; j < len; ++j) {
+            h = _mm256_xor_si256(h, _mm256_set1_epi64x((unsigned char)key[j]));
+            __m256i lo = _mm256_mul_epu32(h, prime);
+            __m256i hi = _mm256_slli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(h, 32), prime), 32);
+            h = _mm256_add_epi64(_mm256_add_epi64(lo, hi), _mm256_slli_epi64(h, 40));
+        }
+        /* only the lanes of the requested hashes are stored */
+        __m256i store = _mm256_cmpgt_epi64(_mm256_set1_epi64x(num_hashes - i), _mm256_set_epi64x(3, 2, 1, 0));
+        _mm256_maskstore_epi64((long long*)(results + i), store, h);
+    }
+}
+
+CMS_TARGET("avx512f") static void __hash_avx512(const char* key, unsigned int num_hashes, uint64_t* results) {
+    size_t len = strlen(key);
+    const __m512i prime = _mm512_set1_epi64(0x1b3);
+    const __m512i lanes = _mm512_set_epi64(7 * 31, 6 * 31, 5 * 31, 4 * 31, 3 * 31, 2 * 31, 31, 0);
+    for (unsigned int i = 0; i < num_hashes; i += 8) {
+        __m512i h = _mm512_add_epi64(_mm512_set1_epi64((int64_t)(CMS_FNV_OFFSET + (31 * (int)i))), lanes);
+        for (size_t j = 0; j < len; ++j) {
+            h = _mm512_xor_si512(h, _mm512_set1_epi64((unsigned char)key[j]));
+            __m512i lo = _mm512_mul_epu32(h, prime);
+            __m512i hi = _mm512_slli_epi64(_mm512_mul_epu32(_mm512_srli_epi64(h, 32), prime), 32);
+            h = _mm512_add_epi64(_mm512_add_epi64(lo, hi), _mm512_slli_epi64(h, 40));
+        }
+        __mmask8 store = (num_hashes - i >= 8) ? 0xFF : (__mmask8)((1U << (num_hashes - i)) - 1);
+        _mm512_mask_storeu_epi64((void*)(results + i), store, h);
+    }
+}
+
+CMS_TARGET("sse2") static void __age_bins_sse2(int32_t* bins, uint64_t len, unsigned int shift) {
+    uint64_t i = 0;
+    const __m128i max = _mm_set1_epi32(INT32_MAX);
+    const __m128i min = _mm_set1_epi32(INT32_MIN);
+    const __m128i round = _mm_set1_epi32((int32_t)((1U << shift) - 1));
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    for (/* skip */; i + 4 <= len; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(bins + i));
+        __m128i sticky = _mm_or_si128(_mm_cmpeq_epi32(v, max), _mm_cmpeq_epi32(v, min));
+        __m128i bias = _mm_and_si128(_mm_srai_epi32(v, 31), round);
+        __m128i aged = _mm_sra_epi32(_mm_add_epi32(v, bias), count);
+        _mm_storeu_si128((__m128i*)(bins + i), _mm_or_si128(_mm_and_si128(sticky, v), _mm_andnot_si128(sticky, aged)));
+    }
+    __age_bins_scalar(bins + i, len - i, shift);
+}
+
+CMS_TARGET("avx2") static void __age_bins_avx2(int32_t* bins, uint64_t len, unsigned int shift) {
+    uint64_t i = 0;
+    const __m256i max = _mm256_set1_epi32(INT32_MAX);
+    const __m256i min = _mm256_set1_epi32(INT32_MIN);
+    const __m256i round = _mm256_set1_epi32((int32_t)((1U << shift) - 1));
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    for (/* skip */; i + 8 <= len; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(bins + i));
+        __m256i sticky = _mm256_or_si256(_mm256_cmpeq_epi32(v, max), _mm256_cmpeq_epi32(v, min));
+        __m256i bias = _mm256_and_si256(_mm256_srai_epi32(v, 31), round);
+        __m256i aged = _mm256_sra_epi32(_mm256_add_epi32(v, bias), count);
+        _mm256_storeu_si256((__m256i*)(bins + i), _mm256_blendv_epi8(aged, v, sticky));
+    }
+    __age_bins_scalar(bins + i, len - i, shift);
+}
+
+CMS_TARGET("avx2") static int64_t __dot_product_avx2(const int32_t* a, const int32_t* b, uint64_t len) {
+    uint64_t i = 0;
+    /* signed 32 x 32 -> 64 bit products of the even then the odd lanes */
+    __m256i even = _mm256_setzero_si256();
+    __m256i odd = _mm256_setzero_si256();
+    for (/* skip */; i + 8 <= len; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+        even = _mm256_add_epi64(even, _mm256_mul_epi32(x, y));
+        odd = _mm256_add_epi64(odd, _mm256_mul_epi32(_mm256_srli_epi64(x, 32), _mm256_srli_epi64(y, 32)));
+    }
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, _mm256_add_epi64(even, odd));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + __dot_product_scalar(a + i, b + i, len - i);
+}
+
+CMS_TARGET("sse2") static void __add_bins_sse2(int32_t* dst, const int32_t* a, const int32_t* b, uint64_t len) {
+    uint64_t i = 0;
+    const __m128i max = _mm_set1_epi32(INT32_MAX);
+    const __m128i min = _mm_set1_epi32(INT32_MIN);
+    for (/* skip */; i + 4 <= len; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+        __m128i s = _mm_add_epi32(x, y);
+        /* overflowed when the operands' signs match and the result's sign differs from x */
+        __m128i overflow = _mm_srai_epi32(_mm_andnot_si128(_mm_xor_si128(x, y), _mm_xor_si128(x, s)), 31);
+        __m128i saturated = _mm_xor_si128(max, _mm_srai_epi32(x, 31));  /* MAX if x >= 0 else MIN */
+        __m128i sticky = _mm_or_si128(_mm_cmpeq_epi32(x, max), _mm_cmpeq_epi32(x, min));
+        s = _mm_or_si128(_mm_and_si128(overflow, saturated), _mm_andnot_si128(overflow, s));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_and_si128(sticky, x), _mm_andnot_si128(sticky, s)));
+    }
+    __add_bins_scalar(dst + i, a + i, b + i, len - i);
+}
+
+CMS_TARGET("avx2") static void __add_bins_avx2(int32_t* dst, const int32_t* a, const int32_t* b, uint64_t len) {
+    uint64_t i = 0;
+    const __m256i max = _mm256_set1_epi32(INT32_MAX);
+    const __m256i min = _mm256_set1_epi32(INT32_MIN);
+    for (/* skip */; i + 8 <= len; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+        __m256i s = _mm256_add_epi32(x, y);
+        __m256i overflow = _mm256_srai_epi32(_mm256_andnot_si256(_mm256_xor_si256(x, y), _mm256_xor_si256(x, s)), 31);
+        __m256i saturated = _mm256_xor_si256(max, _mm256_srai_epi32(x, 31));
+        __m256i sticky = _mm256_or_si256(_mm256_cmpeq_epi32(x, max), _mm256_cmpeq_epi32(x, min));
+        s = _mm256_blendv_epi8(s, saturated, overflow);
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_blendv_epi8(s, x, sticky));
+    }
+    __add_bins_scalar(dst + i, a + i, b + i, len - i);
+}
+
+CMS_TARGET("avx512f") static void __add_bins_avx512(int32_t* dst, const int32_t* a, const int32_t* b, uint64_t len) {
+    uint64_t i = 0;
+    const __m512i max = _mm512_set1_epi32(INT32_MAX);
+    const __m512i min = _mm512_set1_epi32(INT32_MIN);
+    const __m512i zero = _mm512_setzero_si512();
+    for (/* skip */; i + 16 <= len; i += 16) {
+        __m512i x = _mm512_loadu_si512((const void*)(a + i));
+        __m512i y = _mm512_loadu_si512((const void*)(b + i));
+        __m512i s = _mm512_add_epi32(x, y);
+        __mmask16 overflow = _mm512_cmplt_epi32_mask(_mm512_andnot_si512(_mm512_xor_si512(x, y), _mm512_xor_si512(x, s)), zero);
+        __mmask16 sticky = _mm512_cmpeq_epi32_mask(x, max) | _mm512_cmpeq_epi32_mask(x, min);
+        __m512i saturated = _mm512_xor_si512(max, _mm512_srai_epi32(x, 31));
+        s = _mm512_mask_blend_epi32(overflow, s, saturated);
+        _mm512_storeu_si512((void*)(dst + i), _mm512_mask_blend_epi32(sticky, s, x));
+    }
+    __add_bins_scalar(dst + i, a + i, b + i, len - i);
+}
+
+CMS_TARGET("sse2") static void __subtract_bins_sse2(int32_t* dst, const int32_t* a, const int32_t* b, uint64_t len) {
+    uint64_t i = 0;
+    const __m128i max = _mm_set1_epi32(INT32_MAX);
+    const __m128i min = _mm_set1_epi32(INT32_MIN);
+    for (/* skip */; i + 4 <= len; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+        __m128i d = _mm_sub_epi32(x, y);
+        /* overflowed when the operands' signs differ and the result's sign differs from x */
+        __m128i overflow = _mm_srai_epi32(_mm_and_si128(_mm_xor_si128(x, y), _mm_xor_si128(x, d)), 31);
+        __m128i saturated = _mm_xor_si128(max, _mm_srai_epi32(x, 31));
+        __m128i sticky = _mm_or_si128(_mm_cmpeq_epi32(x, max), _mm_cmpeq_epi32(x, min));
+        d = _mm_or_si128(_mm_and_si128(overflow, saturated), _mm_andnot_si128(overflow, d));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_and_si128(sticky, x), _mm_andnot_si128(sticky, d)));
+    }
+    __subtract_bins_scalar(dst + i, a + i, b + i, len - i);
+}
+
+CMS_TARGET("avx2") static void __subtract_bins_avx2(int32_t* dst, const int32_t* a, const int32_t* b, uint64_t len) {
+    uint64_t i = 0;
+    const __m256i max = _mm256_set1_epi32(INT32_MAX);
+    const __m256i min = _mm256_set1_epi32(INT32_MIN);
+    for (/* skip */; i + 8 <= len; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+        __m256i d = _mm256_sub_epi32(x, y);
+        __m256i overflow = _mm256_srai_epi32(_mm256_and_si256(_mm256_xor_si256(x, y), _mm256_xor_si256(x, d)), 31);
+        __m256i saturated = _mm256_xor_si256(max, _mm256_srai_epi32(x, 31));
+        __m256i sticky = _mm256_or_si256(_mm256_cmpeq_epi32(x, max), _mm256_cmpeq_epi32(x, min));
+        d = _mm256_blendv_epi8(d, saturated, overflow);
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_blendv_epi8(d, x, sticky));
+    }
+    __subtract_bins_scalar(dst + i, a + i, b + i, len - i);
+}
+
+CMS_TARGET("avx512f") static void __subtract_bins_avx512(int32_t* dst, const int32_t* a, const int32_t* b, uint64_t len) {
+    uint64_t i = 0;
+    const __m512i max = _mm512_set1_epi32(INT32_MAX);
+    const __m512i min = _mm512_set1_epi32(INT32_MIN);
+    const __m512i zero = _mm512_setzero_si512();
+    for (/* skip */; i + 16 <= len; i += 16) {
+        __m512i x = _mm512_loadu_si512((const void*)(a + i));
+        __m512i y = _mm512_loadu_si512((const void*)(b + i));
+        __m512i d = _mm512_sub_epi32(x, y);
+        __mmask16 overflow = _mm512_cmplt_epi32_mask(_mm512_and_si512(_mm512_xor_si512(x, y), _mm512_xor_si512(x, d)), zero);
+        __mmask16 sticky = _mm512_cmpeq_epi32_mask(x, max) | _mm512_cmpeq_epi32_mask(x, min);
+        __m512i saturated = _mm512_xor_si512(max, _mm512_srai_epi32(x, 31));
+        d = _mm512_mask_blend_epi32(overflow, d, saturated);
+        _mm512_storeu_si512((void*)(dst + i), _mm512_mask_blend_epi32(sticky, d, x));
+    }
+    __subtract_bins_scalar(dst + i, a + i, b + i, len - i);
+}
+
+/* Power of two widths map four rows at a time with a mask; others need the 64-bit modulo */
+CMS_TARGET("avx2") static void __bin_indexes_avx2(uint32_t width, uint32_t depth, const uint64_t* hashes, unsigned int stride, size_t num_keys, uint64_t* bins) {
+    if ((width & (width - 1)) != 0) {
+        __bin_indexes_scalar(width, depth, hashes, stride, num_keys, bins);
+        return;
+    }
+    const __m256i mask = _mm256_set1_epi64x((int64_t)width - 1);
+    const __m256i first = _mm256_set_epi64x((int64_t)width * 3, (int64_t)width * 2, (int64_t)width, 0);
+    const __m256i step = _mm256_set1_epi64x((int64_t)width * 4);
+    for (size_t k = 0; k < num_keys; ++k) {
+        const uint64_t* h = hashes + k * stride;
+        uint64_t* out = bins + k * depth;
+        __m256i offsets = first;
+        uint32_t r = 0;
+        for (/* skip */; r + 4 <= depth; r += 4) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(h + r));
+            _mm256_storeu_si256((__m256i*)(out + r), _mm256_add_epi64(_mm256_and_si256(v, mask), offsets));
+            offsets = _mm256_add_epi64(offsets, step);
+        }
+        for (/* skip */; r < depth; ++r) {
+            out[r] = __bin_index(width, r, h[r]);
+        }
+    }
+}
+
+/* Gather the bins of four rows at a time and keep the running minimum */
+CMS_TARGET("avx2") static void __check_batch_avx2(const int32_t* bins, uint32_t depth, const uint64_t* indexes, size_t num_keys, int32_t* results) {
+    for (size_t k = 0; k < num_keys; ++k) {
+        if (k + CMS_BATCH_PREFETCH < num_keys) {
+            for (uint32_t r = 0; r < depth; ++r) {
+                CMS_PREFETCH(bins + indexes[(k + CMS_BATCH_PREFETCH) * depth + r]);
+            }
+        }
+        const uint64_t* idx = indexes + k * depth;
+        __m128i mins = _mm_set1_epi32(INT32_MAX);
+        uint32_t r = 0;
+        for (/* skip */; r + 4 <= depth; r += 4) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(idx + r));
+            mins = _mm_min_epi32(mins, _mm256_i64gather_epi32((const int*)bins, v, 4));
+        }
+        mins = _mm_min_epi32(mins, _mm_shuffle_epi32(mins, _MM_SHUFFLE(1, 0, 3, 2)));
+        mins = _mm_min_epi32(mins, _mm_shuffle_epi32(mins, _MM_SHUFFLE(2, 3, 0, 1)));
+        int32_t num_add = _mm_cvtsi128_si32(mins);
+        for (/* skip */; r < depth; ++r) {
+            if (bins[idx[r]] < num_add) {
+                num_add = bins[idx[r]];
+            }
+        }
+        results[k] = num_add;
+    }
+}
+
+/*  The row offsets of up to eight rows of a key in one register; widths that
+    are not a power of two need a 64-bit modulo, which has no SIMD form */
+CMS_TARGET("avx512f") static void __bin_indexes_avx512(uint32_t width, uint32_t depth, const uint64_t* hashes, unsigned int stride, size_t num_keys, uint64_t* bins) {
+    if ((width & (width - 1)) != 0) {
+        __bin_indexes_scalar(width, depth, hashes, stride, num_keys, bins);
+        return;
+    }
+    const __m512i mask = _mm512_set1_epi64((int64_t)width - 1);
+    const __m512i first = _mm512_set_epi64((int64_t)width * 7, (int64_t)width * 6, (int64_t)width * 5, (int64_t)width * 4,
+                                           (int64_t)width * 3, (int64_t)width * 2, (int64_t)width, 0);
+    const __m512i step = _mm512_set1_epi64((int64_t)width * 8);
+    for (size_t k = 0; k < num_keys; ++k) {
+        const uint64_t* h = hashes + k * stride;
+        uint64_t* out = bins + k * depth;
+        __m512i offsets = first;
+        for (uint32_t r = 0; r < depth; r += 8) {
+            __mmask8 rows = (depth - r >= 8) ? 0xFF : (__mmask8)((1U << (depth - r)) - 1);
+            __m512i v = _mm512_maskz_loadu_epi64(rows, h + r);
+            _mm512_mask_storeu_epi64(out + r, rows, _mm512_add_epi64(_mm512_and_si512(v, mask), offsets));
+            offsets = _mm512_add_epi64(offsets, step);
+        }
+    }
+}
+
+/*  Insert each key with its rows' bins gathered, incremented and scattered
+    eight at a time; the bins of a key are in different rows so the scatter
+    never has conflicts, and the keys stay in order for the estimates */
+CMS_TARGET("avx512f") static void __add_batch_avx512(int32_t* bins, uint32_t depth, const uint64_t* indexes, size_t num_keys, uint32_t x, int32_t* results) {
+    const __m512i inc = _mm512_set1_epi64(x);
+    const __m512i max = _mm512_set1_epi64(INT32_MAX);
+    const __m512i min = _mm512_set1_epi64(INT32_MIN);
+    for (size_t k = 0; k < num_keys; ++k) {
+        if (k + CMS_BATCH_PREFETCH < num_keys) {
+            for (uint32_t r = 0; r < depth; ++r) {
+                CMS_PREFETCH(bins + indexes[(k + CMS_BATCH_PREFETCH) * depth + r]);
+            }
+        }
+        __m512i mins = max;
+        for (uint32_t r = 0; r < depth; r += 8) {
+            __mmask8 rows = (depth - r >= 8) ? 0xFF : (__mmask8)((1U << (depth - r)) - 1);
+            __m512i idx = _mm512_maskz_loadu_epi64(rows, indexes + k * depth + r);
+            __m512i val = _mm512_cvtepi32_epi64(_mm512_mask_i64gather_epi32(_mm256_setzero_si256(), rows, idx, (const int*)bins, 4));
+            __mmask8 sticky = _mm512_cmpeq_epi64_mask(val, max) | _mm512_cmpeq_epi64_mask(val, min);
+            __m512i sum = _mm512_mask_mov_epi64(_mm512_min_epi64(_mm512_add_epi64(val, inc), max), sticky, val);
+            _mm512_mask_i64scatter_epi32(bins, rows, idx, _mm512_cvtepi64_epi32(sum), 4);
+            mins = _mm512_mask_min_epi64(mins, rows, mins, sum);
+        }
+        if (results != NULL) {
+            results[k] = (int32_t)_mm512_reduce_min_epi64(mins);
+        }
+    }
+}
+
+/* Gather the bins of a row for eight keys at a time and keep their minimums */
+CMS_TARGET("avx512f") static void __check_batch_avx512(const int32_t* bins, uint32_t depth, const uint64_t* indexes, size_t num_keys, int32_t* results) {
+    const __m512i keys = _mm512_set_epi64((int64_t)depth * 7, (int64_t)depth * 6, (int64_t)depth * 5, (int64_t)depth * 4,
+                                          (int64_t)depth * 3, (int64_t)depth * 2, (int64_t)depth, 0);
+    for (size_t k = 0; k < num_keys; k += 8) {
+        __mmask8 active = (num_keys - k >= 8) ? 0xFF : (__mmask8)((1U << (num_keys - k)) - 1);
+        for (size_t p = k + CMS_BATCH_PREFETCH; p < k + CMS_BATCH_PREFETCH + 8 && p < num_keys; ++p) {
+            for (uint32_t r = 0; r < depth; ++r) {
+                CMS_PREFETCH(bins + indexes[p * depth + r]);
+            }
+        }
+        __m256i mins = _mm256_set1_epi32(INT32_MAX);
+        for (uint32_t r = 0; r < depth; ++r) {
+            __m512i idx = _mm512_mask_i64gather_epi64(_mm512_setzero_si512(), active, keys, (const long long*)(indexes + k * depth + r), 8);
+            mins = _mm256_min_epi32(mins, _mm512_mask_i64gather_epi32(mins, active, idx, (const int*)bins, 4));
+        }
+        _mm512_mask_cvtepi64_storeu_epi32(results + k, active, _mm512_cvtepi32_epi64(mins));
+    }
+}
+
+/*  SSE2 has no unsigned compare or absolute value; |bin| > threshold becomes
+    a signed compare once the sign bits of both sides are flipped */
+CMS_TARGET("sse2") static size_t __changes_sse2(const int32_t* bins, uint64_t len, uint32_t width, uint32_t threshold, cms_change* changes, size_t max_changes) {
+    uint64_t i = 0;
+    size_t found = 0;
+    const __m128i flip = _mm_set1_epi32(INT32_MIN);
+    const __m128i limit = _mm_set1_epi32((int32_t)(threshold ^ 0x80000000U));
+    for (/* skip */; i + 4 <= len; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(bins + i));
+        __m128i sign = _mm_srai_epi32(v, 31);
+        v = _mm_sub_epi32(_mm_xor_si128(v, sign), sign);
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(_mm_xor_si128(v, flip), limit)));
+        while (mask != 0) {  /* rare; only the changed bins */
+            found = __change_add(bins, i + __builtin_ctz(mask), width, changes, max_changes, found);
+            mask &= mask - 1;
+        }
+    }
+    return __changes_range(bins, i, len, width, threshold, changes, max_changes, found);
+}
+
+CMS_TARGET("avx2") static size_t __changes_avx2(const int32_t* bins, uint64_t len, uint32_t width, uint32_t threshold, cms_change* changes, size_t max_changes) {
+    uint64_t i = 0;
+    size_t found = 0;
+    const __m256i flip = _mm256_set1_epi32(INT32_MIN);
+    const __m256i limit = _mm256_set1_epi32((int32_t)(threshold ^ 0x80000000U));
+    for (/* skip */; i + 8 <= len; i += 8) {
+        __m256i v = _mm256_abs_epi32(_mm256_loadu_si256((const __m256i*)(bins + i)));
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_xor_si256(v, flip), limit)));
+        while (mask != 0) {
+            found = __change_add(bins, i + __builtin_ctz(mask), width, changes, max_changes, found);
+            mask &= mask - 1;
+        }
+    }
+    return __changes_range(bins, i, len, width, threshold, changes, max_changes, found);
+}
+
+CMS_TARGET("avx512f") static size_t __changes_avx512(const int32_t* bins, uint64_t len, uint32_t width, uint32_t threshold, cms_change* changes, size_t max_changes) {
+    uint64_t i = 0;
+    size_t found = 0;
+    const __m512i limit = _mm512_set1_epi32((int32_t)threshold);
+    for (/* skip */; i + 16 <= len; i += 16) {
+        __m512i v = _mm512_abs_epi32(_mm512_loadu_si512((const void*)(bins + i)));
+        unsigned int mask = _mm512_cmpgt_epu32_mask(v, limit);
+        while (mask != 0) {
+            found = __change_add(bins, i + __builtin_ctz(mask), width, changes, max_changes, found);
+            mask &= mask - 1;
+        }
+    }
+    return __changes_range(bins, i, len, width, threshold, changes, max_changes, found);
+}
+#if !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+static const struct cms_kernels __kernels_scalar = {
+    "scalar", __hash_scalar, __add_bins_scalar, __subtract_bins_scalar, __age_bins_scalar, __dot_product_scalar,
+    __bin_indexes_scalar, __add_batch_scalar, __check_batch_scalar, __changes_scalar
+};
+
+#if defined(CMS_X86_KERNELS)
+static const struct cms_kernels __kernels_sse2 = {
+    "sse2", __hash_sse2, __add_bins_sse2, __subtract_bins_sse2, __age_bins_sse2, __dot_product_scalar,
+    __bin_indexes_scalar, __add_batch_scalar, __check_batch_scalar, __changes_sse2
+};
+
+static const struct cms_kernels __kernels_avx2 = {
+    "avx2", __hash_avx2, __add_bins_avx2, __subtract_bins_avx2, __age_bins_avx2, __dot_product_avx2,
+    __bin_indexes_avx2, __add_batch_scalar, __check_batch_avx2, __changes_avx2
+};
+
+static const struct cms_kernels __kernels_avx512 = {
+    "avx512", __hash_avx512, __add_bins_avx512, __subtract_bins_avx512, __age_bins_avx2, __dot_product_avx2,
+    __bin_indexes_avx512, __add_batch_avx512, __check_batch_avx512, __changes_avx512
+};
+#endif
+
+/*  The kernels of the best instruction set supported by the CPU, or of the
+    one named by the CMS_SIMD environment variable if that is lower; selected
+    once on first use */
+static const struct cms_kernels* __cms_kernels(void) {
+    static const struct cms_kernels* selected = NULL;
+    const struct cms_kernels* kernels = __atomic_load_n(&selected, __ATOMIC_ACQUIRE);
+    if (kernels != NULL) {
+        return kernels;
+    }
+    /* in order of preference; CMS_SIMD names the best one to consider */
+#if defined(CMS_X86_KERNELS)
+    __builtin_cpu_init();
+    const struct cms_kernels* candidates[] = {&__kernels_avx512, &__kernels_avx2, &__kernels_sse2, &__kernels_scalar};
+    const bool supported[] = {
+        __builtin_cpu_supports("avx512f") != 0,
+        __builtin_cpu_supports("avx2") != 0,
+        __builtin_cpu_supports("sse2") != 0,
+        true};
+#else
+    const struct cms_kernels* candidates[] = {&__kernels_scalar};
+    const bool supported[] = {true};
+#endif
+    size_t i, first = 0, num_candidates = sizeof(candidates) / sizeof(candidates[0]);
+    const char* limit = getenv("CMS_SIMD");
+    for (i = 0; limit != NULL && i < num_candidates; ++i) {
+        if (strcmp(limit, candidates[i]->name) == 0) {
+            first = i;
+        }
+    }
+    for (i = first; !supported[i]; ++i) {}  /* the scalar kernels are always supported */
+    __atomic_store_n(&selected, candidates[i], __ATOMIC_RELEASE);
+    return candidates[i];
+}
+
+static __inline__ uint32_t __abs_bin(int32_t val) {
+    return (val < 0) ? 0U - (uint32_t)val : (uint32_t)val;
+}
+
+static __inline__ int32_t __age_value(int32_t val, unsigned int shift) {
+    if (shift >= CMS_AGE_CLEAR) {
+        return 0;
+    }
+    if (val == INT32_MAX || val == INT32_MIN) {
+        return val;
+    }
+    return val / ((int32_t)1 << shift);
+}
+
+/*  Subtract the next `num_bins` bins of the expiring slice from the window
+    total and zero them so the slice can be reused as the head */
+static void __window_retire(CountMinSketchWindow* win, uint64_t num_bins) {
+    uint64_t bins = (uint64_t)win->width * win->depth;
+    if (win->retire_cursor >= bins) {
+        return;
+    }
+    CountMinSketch* oldest = &win->slices[(win->head + 1) % (win->num_slices + 1)];
+    uint64_t end = (win->retire_cursor + num_bins > bins) ? bins : win->retire_cursor + num_bins;
+    int32_t* total = win->total.bins + win->retire_cursor;
+    __subtract_bins(total, total, oldest->bins + win->retire_cursor, end - win->retire_cursor);
+    memset(oldest->bins + win->retire_cursor, 0, (end - win->retire_cursor) * sizeof(int32_t));
+    win->retire_cursor = end;
+    if (end == bins) {
+        oldest->elements_added = 0;
+    }
+}
+
+/* The window value of a bin; excludes the part of the expiring slice not yet retired */
+static __inline__ int32_t __window_bin(const CountMinSketchWindow* win, uint64_t bin) {
+    if (bin < win->retire_cursor) {
+        return win->total.bins[bin];
+    }
+    const CountMinSketch* oldest = &win->slices[(win->head + 1) % (win->num_slices + 1)];
+    return __safe_sub_2(win->total.bins[bin], oldest->bins[bin]);
+}
+
+/* The factor to decay a value by after `elapsed` ticks */
+static __inline__ double __decay_factor(const CountMinSketchDecay* cds, uint32_t elapsed) {
+    if (elapsed < CMS_DECAY_POWERS) {
+        return cds->powers[elapsed];
+    }
+    return exp2(-(double)elapsed / cds->half_life);
+}
+
+/*  Update the tracked estimate of a key; the common case of a key that is
+    not heavy is a single comparison against the smallest tracked estimate */
+static void __topk_update(struct cms_topk* topk, const char* key, uint64_t hash, int32_t count, int inserted) {
+    if (inserted && topk->size == topk->k && count <= topk->heap[0].count) {
+        return;  /* cannot be tracked; a tracked key's estimate is at least the minimum */
+    }
+    uint32_t pos = __topk_find(topk, hash);
+    if (pos != UINT32_MAX) {
+        int32_t previous = topk->heap[pos].count;
+        topk->heap[pos].count = count;
+        if (count > previous) {
+            __topk_sift_down(topk, pos);
+        } else {
+            __topk_sift_up(topk, pos);
+        }
+        return;
+    }
+    if (!inserted) {
+        return;  /* removals never add new keys */
+    }
+
+    char* copy = (char*)malloc(strlen(key) + 1);
+    if (copy == NULL) {
+        return;
+    }
+    strcpy(copy, key);
+    if (topk->size < topk->k) {
+        pos = topk->size++;
+    } else {
+        /* replace the smallest */
+        pos = 0;
+        __topk_index_remove(topk, topk->heap[0].hash);
+        free(topk->heap[0].key);
+    }
+    topk->heap[pos].hash = hash;
+    topk->heap[pos].count = count;
+    topk->heap[pos].key = copy;
+    __topk_index_set(topk, hash, pos);
+    if (pos == 0) {
+        __topk_sift_down(topk, pos);
+    } else {
+        __topk_sift_up(topk, pos);
+    }
+}
+
+static uint32_t __topk_find(const struct cms_topk* topk, uint64_t hash) {
+    uint32_t slot = (uint32_t)__mix64(hash) & topk->index_mask;
+    while (topk->index_pos[slot] != UINT32_MAX) {
+        if (topk->index_hash[slot] == hash) {
+            return topk->index_pos[slot];
+        }
+        slot = (slot + 1) & topk->index_mask;
+    }
+    return UINT32_MAX;
+}
+
+/* Insert or update the heap position of the hash */
+static void __topk_index_set(struct cms_topk* topk, uint64_t hash, uint32_t pos) {
+    uint32_t slot = (uint32_t)__mix64(hash) & topk->index_mask;
+    while (topk->index_pos[slot] != UINT32_MAX && topk->index_hash[slot] != hash) {
+        slot = (slot + 1) & topk->index_mask;
+    }
+    topk->index_hash[slot] = hash;
+    topk->index_pos[slot] = pos;
+}
+
+/* Remove using backward shift deletion so that no tombstones are needed */
+static void __topk_index_remove(struct cms_topk* topk, uint64_t hash) {
+    uint32_t slot = (uint32_t)__mix64(hash) & topk->index_mask;
+    while (topk->index_pos[slot] != UINT32_MAX && topk->index_hash[slot] != hash) {
+        slot = (slot + 1) & topk->index_mask;
+    }
+    if (topk->index_pos[slot] == UINT32_MAX) {
+        return;
+    }
+    uint32_t hole = slot;
+    for (;;) {
+        slot = (slot + 1) & topk->index_mask;
+        if (topk->index_pos[slot] == UINT32_MAX) {
+            break;
+        }
+        uint32_t home = (uint32_t)__mix64(topk->index_hash[slot]) & topk->index_mask;
+        /* move the entry back unless its home lies cyclically in (hole, slot] */
+        if (((slot - home) & topk->index_mask) >= ((slot - hole) & topk->index_mask)) {
+            topk->index_hash[hole] = topk->index_hash[slot];
+            topk->index_pos[hole] = topk->index_pos[slot];
+            hole = slot;
+        }
+    }
+    topk->index_pos[hole] = UINT32_MAX;
+}
+
+static void __topk_sift_down(struct cms_topk* topk, uint32_t pos) {
+    for (;;) {
+        uint32_t smallest = pos, left = 2 * pos + 1, right = 2 * pos + 2;
+        if (left < topk->size && topk->heap[left].count < topk->heap[smallest].count) {
+            smallest = left;
+        }
+        if (right < topk->size && topk->heap[right].count < topk->heap[smallest].count) {
+            smallest = right;
+        }
+        if (smallest == pos) {
+            return;
+        }
+        __topk_swap(topk, pos, smallest);
+        pos = smallest;
+    }
+}
+
+static void __topk_sift_up(struct cms_topk* topk, uint32_t pos) {
+    while (pos > 0) {
+        uint32_t parent = (pos - 1) / 2;
+        if (topk->heap[parent].count <= topk->heap[pos].count) {
+            return;
+        }
+        __topk_swap(topk, pos, parent);
+        pos = parent;
+    }
+}
+
+static void __topk_swap(struct cms_topk* topk, uint32_t a, uint32_t b) {
+    cms_topk_entry tmp = topk->heap[a];
+    topk->heap[a] = topk->heap[b];
+    topk->heap[b] = tmp;
+    __topk_index_set(topk, topk->heap[a].hash, a);
+    __topk_index_set(topk, topk->heap[b].hash, b);
+}
+
+static void __topk_clear(struct cms_topk* topk) {
+    for (uint32_t i = 0; i < topk->size; ++i) {
+        free(topk->heap[i].key);
+        topk->heap[i].key = NULL;
+    }
+    topk->size = 0;
+    memset(topk->index_pos, 0xFF, ((uint64_t)topk->index_mask + 1) * sizeof(uint32_t));
+}
+
+/* sort heavy hitters by count descending */
+static int __compare_heavy_hitters(const void* a, const void* b) {
+    int32_t x = ((const cms_heavy_hitter*)a)->count, y = ((const cms_heavy_hitter*)b)->count;
+    return (x < y) - (x > y);
+}
+
+/* Find the key in the filter; the first hashes are scanned and the rest only compared on a match */
+static uint32_t __augmented_find(const CountMinSketchAugmented* acms, const uint64_t* hashes) {
+    for (uint32_t i = 0; i < acms->filter_used; ++i) {
+        if (acms->filter_ids[i] == hashes[0] &&
+            memcmp(&acms->filter_hashes[(uint64_t)i * acms->depth], hashes, acms->depth * sizeof(uint64_t)) == 0) {
+            return i;
+        }
+    }
+    return UINT32_MAX;
+}
+
+/* Place the key in the filter with `count` already held in the sketch */
+static void __augmented_set(CountMinSketchAugmented* acms, uint32_t pos, const uint64_t* hashes, int32_t count) {
+    acms->filter_ids[pos] = hashes[0];
+    memcpy(&acms->filter_hashes[(uint64_t)pos * acms->depth], hashes, acms->depth * sizeof(uint64_t));
+    acms->new_counts[pos] = count;
+    acms->old_counts[pos] = count;
+}
+
+/* Levels with no more prefixes than the width are counted exactly */
+static __inline__ int __dyadic_exact(const CountMinSketchDyadic* dcms, unsigned int level) {
+    unsigned int prefix_bits = dcms->bits - level;
+    return prefix_bits < 32 && (1ULL << prefix_bits) <= dcms->width;
+}
+
+/*  The hashes of the prefix in the level, derived from a single 64-bit hash
+    (h1 + i * h2); exact levels index by the prefix itself */
+static __inline__ uint64_t* __dyadic_hashes(CountMinSketchDyadic* dcms, unsigned int level, uint64_t prefix) {
+    if (__dyadic_exact(dcms, level)) {
+        dcms->hashes[0] = prefix;
+        return dcms->hashes;
+    }
+    uint64_t h1 = __mix64(prefix ^ (0x9E3779B97F4A7C15ULL * (level + 1)));
+    uint64_t h2 = __mix64(h1) | 1;
+    for (unsigned int i = 0; i < dcms->depth; ++i) {
+        dcms->hashes[i] = h1 + i * h2;
+    }
+    return dcms->hashes;
+}
+
+static __inline__ int32_t __dyadic_count(CountMinSketchDyadic* dcms, unsigned int level, uint64_t prefix) {
+    CountMinSketch* cms = &dcms->levels[level];
+    return cms_check_alt(cms, __dyadic_hashes(dcms, level, prefix), cms->depth);
+}
+
+/*  Add (or remove) `x` to each row with the sign given by the top bit of the
+    row's hash; the low bits choose the bin */
+static int32_t __countsketch_update(CountSketch* cs, uint64_t* hashes, uint32_t x, int remove) {
+    CountMinSketch* cms = &cs->cms;
+    for (unsigned int i = 0; i < cms->depth; ++i) {
+        uint64_t bin = __bin_index(cms->width, i, hashes[i]);
+        __bin_prepare(cms, bin);
+        if ((hashes[i] >> 63) ^ (uint64_t)remove) {
+            cms->bins[bin] = __safe_sub(cms->bins[bin], x);
+        } else {
+            cms->bins[bin] = __safe_add(cms->bins[bin], x);
+        }
+    }
+    cms->elements_added += remove ? -(int64_t)x : (int64_t)x;
+    if (cms->age_shift != 0) {
+        __age_step(cms, CMS_AGE_STEP);
+    }
+    return __countsketch_median(cs, hashes);
+}
+
+/*  The k-th smallest of the values (quickselect); on return the values left
+    of k are no larger and those right of k no smaller than it */
+static int64_t __select_int64(int64_t* values, uint32_t n, uint32_t k) {
+    int64_t lo = 0, hi = (int64_t)n - 1;
+    while (lo < hi) {
+        int64_t pivot = values[lo + (hi - lo) / 2];
+        int64_t i = lo, j = hi;
+        while (i <= j) {
+            while (values[i] < pivot) {
+                ++i;
+            }
+            while (values[j] > pivot) {
+                --j;
+            }
+            if (i <= j) {
+                int64_t tmp = values[i];
+                values[i++] = values[j];
+                values[j--] = tmp;
+            }
+        }
+        if ((int64_t)k <= j) {
+            hi = j;
+        } else if ((int64_t)k >= i) {
+            lo = i;
+        } else {
+            break;
+        }
+    }
+    return values[k];
+}
+
+static int32_t __countsketch_median(CountSketch* cs, uint64_t* hashes) {
+    CountMinSketch* cms = &cs->cms;
+    int64_t stack_values[CMS_COUNTSKETCH_STACK];
+    int64_t* values = stack_values;
+    if (cms->depth > CMS_COUNTSKETCH_STACK) {
+        values = (int64_t*)calloc(cms->depth, sizeof(int64_t));
+    }
+    for (unsigned int i = 0; i < cms->depth; ++i) {
+        int64_t val = __bin_value(cms, __bin_index(cms->width, i, hashes[i]));
+        values[i] = (hashes[i] >> 63) ? -val : val;
+    }
+    uint32_t n = cms->depth;
+    int64_t median = __select_int64(values, n, n / 2);
+    if (n % 2 == 0) {  /* the lower middle is the largest of the values left of the upper */
+        int64_t lower = values[0];
+        for (uint32_t i = 1; i < n / 2; ++i) {
+            lower = (values[i] > lower) ? values[i] : lower;
+        }
+        median = (median + lower) / 2;
+    }
+    if (values != stack_values) {
+        free(values);
+    }
+    return (median > INT32_MAX) ? INT32_MAX : (median < INT32_MIN) ? INT32_MIN : (int32_t)median;
+}
+
+static struct cms_sparse* __sparse_alloc(uint64_t slots, uint64_t threshold) {
+    struct cms_sparse* sparse = (struct cms_sparse*)malloc(sizeof(struct cms_sparse));
+    if (sparse == NULL) {
+        return NULL;
+    }
+    sparse->mask = slots - 1;
+    sparse->size = 0;
+    sparse->threshold = threshold;
+    sparse->keys = (uint64_t*)calloc(slots, sizeof(uint64_t));
+    sparse->counts = (int32_t*)calloc(slots, sizeof(int32_t));
+    if (sparse->keys == NULL || sparse->counts == NULL) {
+        __sparse_free(sparse);
+        return NULL;
+    }
+    return sparse;
+}
+
+static void __sparse_free(struct cms_sparse* sparse) {
+    if (sparse != NULL) {
+        free(sparse->keys);
+        free(sparse->counts);
+        free(sparse);
+    }
+}
+
+/* Double the slots of the map */
+static int __sparse_grow(struct cms_sparse* sparse) {
+    uint64_t slots = (sparse->mask + 1) * 2;
+    uint64_t* keys = (uint64_t*)calloc(slots, sizeof(uint64_t));
+    int32_t* counts = (int32_t*)calloc(slots, sizeof(int32_t));
+    if (keys == NULL || counts == NULL) {
+        free(keys);
+        free(counts);
+        return CMS_ERROR;
+    }
+    for (uint64_t i = 0; i <= sparse->mask; ++i) {
+        if (sparse->keys[i] != 0) {
+            uint64_t slot = __mix64(sparse->keys[i]) & (slots - 1);
+            while (keys[slot] != 0) {
+                slot = (slot + 1) & (slots - 1);
+            }
+            keys[slot] = sparse->keys[i];
+            counts[slot] = sparse->counts[i];
+        }
+    }
+    free(sparse->keys);
+    free(sparse->counts);
+    sparse->keys = keys;
+    sparse->counts = counts;
+    sparse->mask = slots - 1;
+    return CMS_SUCCESS;
+}
+
+/* The count of the bin, inserting it as 0 if not present; there must be a free slot */
+static __inline__ int32_t* __sparse_slot(struct cms_sparse* sparse, uint64_t bin) {
+    uint64_t key = bin + 1;
+    uint64_t slot = __mix64(key) & sparse->mask;
+    while (sparse->keys[slot] != key) {
+        if (sparse->keys[slot] == 0) {
+            sparse->keys[slot] = key;
+            sparse->counts[slot] = 0;
+            ++sparse->size;
+            break;
+        }
+        slot = (slot + 1) & sparse->mask;
+    }
+    return &sparse->counts[slot];
+}
+
+static __inline__ int32_t __sparse_get(const struct cms_sparse* sparse, uint64_t bin) {
+    uint64_t key = bin + 1;
+    uint64_t slot = __mix64(key) & sparse->mask;
+    while (sparse->keys[slot] != 0) {
+        if (sparse->keys[slot] == key) {
+            return sparse->counts[slot];
+        }
+        slot = (slot + 1) & sparse->mask;
+    }
+    return 0;
+}
+
+/* Insertion and removal for a sparse count-min sketch; converts to dense past the threshold */
+static int32_t __sparse_update(CountMinSketch* cms, uint64_t* hashes, uint32_t x, int remove) {
+    struct cms_sparse* sparse = cms->sparse;
+
+    /* keep the map at most half full after adding a bin for every row */
+    while ((sparse->size + cms->depth) * 2 > sparse->mask + 1) {
+        if (__sparse_grow(sparse) == CMS_ERROR) {
+            if (cms_densify(cms) == CMS_ERROR) {
+                return CMS_ERROR;
+            }
+            return remove ? cms_remove_inc_alt(cms, hashes, cms->depth, x) : cms_add_inc_alt(cms, hashes, cms->depth, x);
+        }
+    }
+
+    int32_t num_add = INT32_MAX;
+    for (unsigned int i = 0; i < cms->depth; ++i) {
+        int32_t* count = __sparse_slot(sparse, __bin_index(cms->width, i, hashes[i]));
+        *count = remove ? __safe_sub(*count, x) : __safe_add(*count, x);
+        if (*count < num_add) {
+            num_add = *count;
+        }
+    }
+    cms->elements_added += remove ? -(int64_t)x : (int64_t)x;
+    if (sparse->size > sparse->threshold) {
+        cms_densify(cms);  /* stays sparse if the bins cannot be allocated */
+    }
+    return num_add;
+}
+
+/* Write the bins of a sparse count-min sketch in the dense layout without allocating all of them */
+static void __sparse_write(CountMinSketch* cms, FILE* fp) {
+    const struct cms_sparse* sparse = cms->sparse;
+    uint64_t length = (uint64_t)cms->width * cms->depth;
+    uint64_t* bins = (uint64_t*)malloc((sparse->size + 1) * sizeof(uint64_t));
+    int32_t* chunk = (int32_t*)calloc(CMS_SPARSE_EXPORT_CHUNK, sizeof(int32_t));
+    if (bins == NULL || chunk == NULL) {
+        for (uint64_t i = 0; i < length; ++i) {  /* slow but needs no memory */
+            int32_t val = __sparse_get(sparse, i);
+            fwrite(&val, sizeof(int32_t), 1, fp);
+        }
+        free(bins);
+        free(chunk);
+        return;
+    }
+
+    uint64_t i, n = 0;
+    for (i = 0; i <= sparse->mask; ++i) {
+        if (sparse->keys[i] != 0) {
+            bins[n++] = sparse->keys[i] - 1;
+        }
+    }
+    qsort(bins, n, sizeof(uint64_t), __compare_bins);
+
+    uint64_t next = 0;
+    for (uint64_t start = 0; start < length; start += CMS_SPARSE_EXPORT_CHUNK) {
+        uint64_t len = (length - start < CMS_SPARSE_EXPORT_CHUNK) ? length - start : CMS_SPARSE_EXPORT_CHUNK;
+        uint64_t first = next;
+        for (/* skip */; next < n && bins[next] < start + len; ++next) {
+            chunk[bins[next] - start] = __sparse_get(sparse, bins[next]);
+        }
+        fwrite(chunk, sizeof(int32_t), len, fp);
+        for (i = first; i < next; ++i) {  /* back to all zeros */
+            chunk[bins[i] - start] = 0;
+        }
+    }
+    free(bins);
+    free(chunk);
+}
+
+static int __compare_bins(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+/* Append a stage twice as wide as the newest */
+static int __scalable_grow(CountMinSketchScalable* scms) {
+    uint32_t i = scms->num_stages;
+    if (i == CMS_SCALABLE_MAX_STAGES || (i > 0 && scms->stages[i - 1].width > UINT32_MAX / 2)) {
+        return CMS_ERROR;
+    }
+    uint32_t width = (i == 0) ? scms->width : scms->stages[i - 1].width * 2;
+    if (cms_init_alt(&scms->stages[i], width, scms->depth, scms->hash_function) == CMS_ERROR) {
+        return CMS_ERROR;
+    }
+    ++scms->num_stages;
+    return CMS_SUCCESS;
+}
+
+/* Add a slab of empty count-min sketches to the free ids */
+static int __arena_grow(CountMinSketchArena* arena) {
+    uint32_t slab = arena->num_slabs;
+    uint64_t num_ids = (uint64_t)(slab + 1) * arena->slab_size;
+    CountMinSketch** sketches = (CountMinSketch**)realloc(arena->sketches, (slab + 1) * sizeof(CountMinSketch*));
+    if (sketches == NULL) {
+        return CMS_ERROR;
+    }
+    arena->sketches = sketches;
+    int32_t** bins = (int32_t**)realloc(arena->bins, (slab + 1) * sizeof(int32_t*));
+    if (bins == NULL) {
+        return CMS_ERROR;
+    }
+    arena->bins = bins;
+    uint8_t* in_use = (uint8_t*)realloc(arena->in_use, num_ids * sizeof(uint8_t));
+    if (in_use == NULL) {
+        return CMS_ERROR;
+    }
+    arena->in_use = in_use;
+    uint64_t* free_ids = (uint64_t*)realloc(arena->free_ids, num_ids * sizeof(uint64_t));
+    if (free_ids == NULL) {
+        return CMS_ERROR;
+    }
+    arena->free_ids = free_ids;
+
+    arena->sketches[slab] = (CountMinSketch*)calloc(arena->slab_size, sizeof(CountMinSketch));
+    arena->bins[slab] = (int32_t*)calloc((uint64_t)arena->width * arena->depth * arena->slab_size, sizeof(int32_t));
+    if (arena->sketches[slab] == NULL || arena->bins[slab] == NULL) {
+        fprintf(stderr, "Failed to allocate a slab of %u count-min sketches!\n", arena->slab_size);
+        free(arena->sketches[slab]);
+        free(arena->bins[slab]);
+        return CMS_ERROR;
+    }
+    memset(arena->in_use + num_ids - arena->slab_size, 0, arena->slab_size);
+    /* pushed in reverse so that the lowest id is acquired first */
+    for (uint64_t id = num_ids; id-- > num_ids - arena->slab_size;) {
+        arena->free_ids[arena->num_free++] = id;
+    }
+    ++arena->num_slabs;
+    return CMS_SUCCESS;
+}
+
+/*  The size of an arena export described by its trailer (width, depth,
+    slab size, number of slabs), failing if it does not fit in 64 bits */
+static int __arena_file_size(const uint32_t trailer[4], uint64_t* size) {
+    uint64_t width = trailer[0], depth = trailer[1], slab_size = trailer[2], num_slabs = trailer[3];
+    if (width == 0 || depth == 0 || slab_size == 0) {
+        return CMS_ERROR;
+    }
+    uint64_t slab_bins = width * depth;  /* at most (2^32 - 1)^2 */
+    if (slab_bins > UINT64_MAX / sizeof(int32_t) / slab_size) {
+        return CMS_ERROR;
+    }
+    /* the bins, element counts and in use flags of each slab */
+    uint64_t slab_bytes = slab_bins * sizeof(int32_t) * slab_size;
+    if (slab_bytes > UINT64_MAX - slab_size * (sizeof(int64_t) + 1)) {
+        return CMS_ERROR;
+    }
+    slab_bytes += slab_size * (sizeof(int64_t) + 1);
+    if (num_slabs != 0 && slab_bytes > (UINT64_MAX - CMS_ARENA_FILE_TRAILER) / num_slabs) {
+        return CMS_ERROR;
+    }
+    *size = slab_bytes * num_slabs + CMS_ARENA_FILE_TRAILER;
+    return CMS_SUCCESS;
+}
+
+static void __arena_setup_sketch(CountMinSketchArena* arena, uint64_t id) {
+    uint64_t slot = id % arena->slab_size;
+    CountMinSketch* cms = &arena->sketches[id / arena->slab_size][slot];
+    __init_cms_fields(cms, arena->width, arena->depth, 2 / (double) arena->width, 1 - (1 / pow(2, arena->depth)), arena->hash_function);
+    cms->bins = arena->bins[id / arena->slab_size] + slot * arena->width * arena->depth;
+}
+
+/*  Allocate zeroed bins as set by the allocator; with no allocator, or if the
+    requested pages or alignment are not available, the bins come from calloc */
+static int32_t* __bins_alloc(struct cms_alloc* alloc, uint64_t length) {
+    uint64_t size = length * sizeof(int32_t);
+    void* bins = NULL;
+    if (alloc == NULL) {
+        return (int32_t*)calloc(length, sizeof(int32_t));
+    }
+    alloc->size = size;
+    alloc->mapped = false;
+    if (alloc->allocator.alloc != NULL) {
+        bins = alloc->allocator.alloc(size, alloc->allocator.data);
+        if (bins != NULL && !(alloc->allocator.flags & CMS_ALLOC_ZEROED)) {
+            memset(bins, 0, size);
+        }
+        return (int32_t*)bins;
+    }
+#if defined(__linux__)
+    if (alloc->allocator.flags & (CMS_ALLOC_HUGE_PAGES | CMS_ALLOC_HUGETLB)) {
+        uint64_t mapped = (size + CMS_HUGE_PAGE - 1) / CMS_HUGE_PAGE * CMS_HUGE_PAGE;
+        bins = MAP_FAILED;
+#if defined(MAP_HUGETLB)
+        if (alloc->allocator.flags & CMS_ALLOC_HUGETLB) {
+            bins = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        }
+#endif
+        if (bins == MAP_FAILED) {
+            bins = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#if defined(MADV_HUGEPAGE)
+            if (bins != MAP_FAILED) {
+                madvise(bins, mapped, MADV_HUGEPAGE);
+            }
+#endif
+        }
+        if (bins != MAP_FAILED) {  /* mapped pages are already zero */
+            alloc->size = mapped;
+            alloc->mapped = true;
+            return (int32_t*)bins;
+        }
+        bins = NULL;
+    }
+#endif
+    if (alloc->allocator.flags != 0 && posix_memalign(&bins, CMS_CACHE_LINE, size) == 0) {
+        memset(bins, 0, size);
+        return (int32_t*)bins;
+    }
+    return (int32_t*)calloc(length, sizeof(int32_t));
+}
+
+static void __bins_free(struct cms_alloc* alloc, int32_t* bins) {
+    if (alloc == NULL || bins == NULL) {
+        free(bins);
+    } else if (alloc->allocator.alloc != NULL) {
+        if (alloc->allocator.free != NULL) {
+            alloc->allocator.free(bins, alloc->size, alloc->allocator.data);
+        }
+#if defined(__linux__)
+    } else if (alloc->mapped) {
+        munmap(bins, alloc->size);
+#endif
+    } else {
+        free(bins);
+    }
+}
+
+/* Number of NUMA nodes, assuming they are numbered contiguously; 1 without NUMA */
+static uint32_t __numa_nodes(void) {
+    uint32_t num_nodes = 1;
+#if defined(__linux__) && defined(SYS_mbind)
+    char path[64];
+    while (num_nodes < CMS_NUMA_MAX_NODES) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%u", num_nodes);
+        if (access(path, F_OK) != 0) {
+            break;
+        }
+        ++num_nodes;
+    }
+#endif
+    return num_nodes;
+}
+
+/*  The NUMA node the calling thread runs on; cached per thread as threads
+    are rarely migrated between nodes and the lookup is a system call */
+static uint32_t __numa_current_node(void) {
+#if defined(__linux__) && defined(SYS_getcpu)
+    static __thread uint32_t node = 0;
+    static __thread uint32_t lookups = 0;
+    if (lookups++ % CMS_NUMA_NODE_REFRESH == 0) {
+        unsigned int cpu, current;
+        if (syscall(SYS_getcpu, &cpu, &current, NULL) == 0) {
+            node = current;
+        }
+    }
+    return node;
+#else
+    return 0;
+#endif
+}
+
+/*  Allocate bins preferably on the node passed as `data`; the pages are
+    placed when first written, which `__bins_alloc` does by zeroing them */
+static void* __numa_alloc(size_t size, void* data) {
+#if defined(__linux__) && defined(SYS_mbind)
+    void* bins = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bins == MAP_FAILED) {
+        return NULL;
+    }
+    unsigned long nodemask = 1UL << (uintptr_t)data;
+    syscall(SYS_mbind, bins, size, CMS_MPOL_PREFERRED, &nodemask, sizeof(nodemask) * CHAR_BIT, 0);
+    return bins;
+#else
+    (void)data;
+    return malloc(size);
+#endif
+}
+
+static void __numa_free(void* ptr, size_t size, void* data) {
+    (void)data;
+#if defined(__linux__) && defined(SYS_mbind)
+    munmap(ptr, size);
+#else
+    (void)size;
+    free(ptr);
+#endif
+}
+
+/*  A single 64-bit hash of the key; the default hash is called directly so
+    that no memory is allocated on the hot path */
+static __inline__ uint64_t __tinylfu_hash(const TinyLFU* tlfu, const char* key) {
+    if (tlfu->hash_function == __default_hash) {
+        return __fnv_1a(key, 0);
+    }
+    uint64_t* hashes = tlfu->hash_function(1, key);
+    uint64_t hash = hashes[0];
+    free(hashes);
+    return hash;
+}
+
+/* Test (and optionally set) the two doorkeeper bits of the hash */
+static __inline__ int __tinylfu_doorkeeper(const TinyLFU* tlfu, uint64_t hash, int set) {
+    uint64_t mixed = __mix64(hash);
+    uint64_t a = (mixed & 0xFFFFFFFF) & (tlfu->doorkeeper_bits - 1);
+    uint64_t b = (mixed >> 32) & (tlfu->doorkeeper_bits - 1);
+    uint64_t mask_a = (uint64_t)1 << (a % 64), mask_b = (uint64_t)1 << (b % 64);
+    int found = (tlfu->doorkeeper[a / 64] & mask_a) && (tlfu->doorkeeper[b / 64] & mask_b);
+    if (set && !found) {
+        tlfu->doorkeeper[a / 64] |= mask_a;
+        tlfu->doorkeeper[b / 64] |= mask_b;
+    }
+    return found;
+}
+
+/* Position of the row's 4-bit counter using double hashing of the single hash */
+static __inline__ uint64_t __tinylfu_counter(const TinyLFU* tlfu, unsigned int row, uint64_t hash) {
+    uint64_t step = ((hash >> 32) | (hash << 32)) | 1;
+    return __bin_index(tlfu->width, row, hash + row * step);
+}
+
+static uint64_t __next_power_of_two(uint64_t x) {
+    uint64_t p = 1;
+    while (p < x) {
+        p <<= 1;
+    }
+    return p;
+}
+
+/* The splitmix64 finalizer */
+static __inline__ uint64_t __mix64(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/* NOTE: The caller will free the results */
+static uint64_t* __default_hash(unsigned int num_hashes, const char* str) {
+    uint64_t* results = (uint64_t*)calloc(num_hashes, sizeof(uint64_t));
+    if (results != NULL) {
+        __cms_kernels()->hash(str, num_hashes, results);
+    }
+    return results;
+}
+
+/*  Fill the depth hashes of each key in a tile; the default hash writes them in
+    place rather than allocating and copying them a key at a time */
+static int __batch_hashes(CountMinSketch* cms, const char** keys, size_t num_keys, uint64_t* hashes) {
+    if (cms->hash_function == __default_hash) {
+        const struct cms_kernels* kernels = __cms_kernels();
+        for (size_t k = 0; k < num_keys; ++k) {
+            kernels->hash(keys[k], cms->depth, hashes + k * cms->depth);
+        }
+        return CMS_SUCCESS;
+    }
+    for (size_t k = 0; k < num_keys; ++k) {
+        uint64_t* key_hashes = cms_get_hashes(cms, keys[k]);
+        if (key_hashes == NULL) {
+            fprintf(stderr, "Failed to hash the keys of the batch!\n");
+            return CMS_ERROR;
+        }
+        memcpy(hashes + k * cms->depth, key_hashes, cms->depth * sizeof(uint64_t));
+        free(key_hashes);
+    }
+    return CMS_SUCCESS;
+}
 
 static uint64_t __fnv_1a(const char* key, int seed) {
     // FNV-1a hash (http://www.isthe.com/chongo/tech/comp/fnv/)
     int i, len = strlen(key);
-    uint64_t h = 14695981039346656037ULL + (31 * seed); // FNV_OFFSET 64 bit with magic number seed
+    uint64_t h = CMS_FNV_OFFSET + (31 * seed); // FNV_OFFSET 64 bit with magic number seed
     for (i = 0; i < len; ++i){
             h = h ^ (unsigned char) key[i];
             h = h * 1099511628211ULL; // FNV_PRIME 64 bit
@@ -410,7 +4237,8 @@ static uint64_t __fnv_1a(const char* key, int seed) {
 
 
 static int __compare(const void *a, const void *b) {
-  return ( *(int64_t*)a - *(int64_t*)b );
+  int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+  return (x > y) - (x < y);
 }
 
 
@@ -465,3 +4293,16 @@ static int32_t __safe_add_2(int32_t a, int32_t b) {
         return INT32_MAX;
     return (int32_t) c;
 }
+
+static int32_t __safe_sub_2(int32_t a, int32_t b) {
+    if (a == INT32_MAX || a == INT32_MIN) {
+        return a;
+    }
+
+    int64_t c = (int64_t) a - (int64_t) b;
+    if (c <= INT32_MIN)
+        return INT32_MIN;
+    else if (c >= INT32_MAX)
+        return INT32_MAX;
+    return (int32_t) c;
+}
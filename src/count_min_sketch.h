@@ -13,6 +13,7 @@ extern "C" {
 #endif
 
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define COUNT_MIN_SKETCH_VERSION "0.1.8"
@@ -24,6 +25,9 @@ extern "C" {
 #define CMS_SUCCESS  0
 #define CMS_ERROR   INT32_MIN
 
+/* number of precomputed decay factors in a `CountMinSketchDecay` */
+#define CMS_DECAY_POWERS 64
+
 
 
 /* https://gcc.gnu.org/onlinedocs/gcc/Alternate-Keywords.html#Alternate-Keywords */
@@ -34,6 +38,18 @@ extern "C" {
 /* hashing function type */
 typedef uint64_t* (*cms_hash_function) (unsigned int num_hashes, const char* key);
 
+/* private state of an in-flight background export */
+struct cms_snapshot;
+
+/* private state of the heavy hitter tracker */
+struct cms_topk;
+
+/* private map of the non-zero bins of a sparse count-min sketch */
+struct cms_sparse;
+
+/* private state of bins allocated with a `cms_allocator` */
+struct cms_alloc;
+
 typedef struct {
     uint32_t depth;
     uint32_t width;
@@ -42,8 +58,52 @@ typedef struct {
     double error_rate;
     cms_hash_function hash_function;
     int32_t* bins;
+    struct cms_snapshot* snapshot;
+    uint32_t age_shift;         /* shift of the lazy aging pass in progress; 0 if none */
+    uint8_t age_epoch;          /* epoch of the current lazy aging pass */
+    uint64_t age_cursor;        /* blocks swept by the lazy aging pass */
+    uint8_t* age_blocks;        /* epoch of the last aging pass applied to each block */
+    struct cms_topk* topk;
+    struct cms_sparse* sparse;  /* NULL once the bins are dense */
+    struct cms_alloc* alloc;    /* NULL if the bins use malloc and free */
 }  CountMinSketch, count_min_sketch;
 
+/* a heavy hitter as reported by `cms_topk` */
+typedef struct {
+    const char* key;
+    int32_t count;
+} cms_heavy_hitter;
+
+/* allocation options of `cms_allocator` */
+#define CMS_ALLOC_ALIGNED    1  /* align the bins to a 64 byte cache line */
+#define CMS_ALLOC_HUGE_PAGES 2  /* back the bins with transparent huge pages */
+#define CMS_ALLOC_HUGETLB    4  /* back the bins with explicit (reserved) huge pages if
+                                   available, otherwise transparent huge pages */
+#define CMS_ALLOC_ZEROED     8  /* the custom `alloc` returns zeroed memory (such as new
+                                   mappings) so the bins are not zeroed again */
+
+/*  custom allocator for the bins; `alloc` need not return zeroed memory and
+    `free` is passed the size that was allocated */
+typedef void* (*cms_alloc_function) (size_t size, void* data);
+typedef void (*cms_free_function) (void* ptr, size_t size, void* data);
+
+/*  How the bins of a count-min sketch are allocated; either a custom `alloc`
+    and `free` pair or, if `alloc` is NULL, a combination of the
+    `CMS_ALLOC_*` flags */
+typedef struct {
+    cms_alloc_function alloc;
+    cms_free_function free;
+    void* data;                 /* passed to alloc and free */
+    uint32_t flags;
+} cms_allocator;
+
+/* a bin reported by `cms_changes` */
+typedef struct {
+    uint32_t row;
+    uint32_t bin;               /* bin within the row */
+    int32_t delta;
+} cms_change;
+
 
 /*  Initialize the count-min sketch based on user defined width and depth
     Alternatively, one can also pass in a custom hash function
@@ -70,6 +130,48 @@ static __inline__ int cms_init_optimal(CountMinSketch* cms, float error_rate, fl
 }
 
 
+/*  Initialize a sparse count-min sketch that stores only the touched bins in
+    a hash map until more than `threshold` bins have been touched, at which
+    point it converts to the usual dense bins; a threshold of 0 uses
+    width * depth / 16, where the map still uses less memory than the bins.
+
+    Insertions, removals, lookups, export, merging, clearing and aging work on
+    the sparse map directly. Other operations that work on all the bins
+    convert the count-min sketch to dense first.
+
+    Returns:
+        CMS_SUCCESS
+        CMS_ERROR   -   when unable to allocate the map or when width or depth are 0 */
+int cms_init_sparse_alt(CountMinSketch* cms, unsigned int width, unsigned int depth, uint64_t threshold, cms_hash_function hash_function);
+static __inline__ int cms_init_sparse(CountMinSketch* cms, unsigned int width, unsigned int depth) {
+    return cms_init_sparse_alt(cms, width, depth, 0, NULL);
+}
+
+/*  Convert a sparse count-min sketch to dense bins; does nothing if already dense
+
+    Returns:
+        CMS_SUCCESS
+        CMS_ERROR   -   when unable to allocate the bins; the count-min sketch
+                        stays sparse */
+int cms_densify(CountMinSketch* cms);
+
+
+/*  Initialize the count-min sketch based on user defined width and depth with
+    the bins allocated by the allocator; either custom functions or built-in
+    cache line alignment or huge pages. Huge pages reduce the TLB misses of
+    the random accesses to large count-min sketches. The allocator is copied;
+    a NULL allocator uses calloc and free as `cms_init` does.
+    Alternatively, one can also pass in a custom hash function
+
+    Returns:
+        CMS_SUCCESS
+        CMS_ERROR   -   when unable to allocate the bins or when width or depth are 0 */
+int cms_init_allocator_alt(CountMinSketch* cms, unsigned int width, unsigned int depth, const cms_allocator* allocator, cms_hash_function hash_function);
+static __inline__ int cms_init_allocator(CountMinSketch* cms, unsigned int width, unsigned int depth, const cms_allocator* allocator) {
+    return cms_init_allocator_alt(cms, width, depth, allocator, NULL);
+}
+
+
 /*  Free all memory used in the count-min sketch
 
     Return:
@@ -79,28 +181,120 @@ int cms_destroy(CountMinSketch* cms);
 
 /*  Reset the count-min sketch to zero elements inserted
 
+    `cms_clear_lazy` returns immediately; the bins are zeroed in small blocks
+    on first touch and a few blocks per insertion or removal, in the same way
+    as `cms_age_lazy`, and lookups treat the blocks not yet zeroed as empty.
+    Any lazy aging still pending is dropped as its bins are now zero.
+
     Return:
         CMS_SUCCESS */
 int cms_clear(CountMinSketch* cms);
+int cms_clear_lazy(CountMinSketch* cms);
+
+/*  Age the count-min sketch by dividing every bin and the number of elements
+    added by 2^shift (rounding towards zero), e.g. a shift of 1 halves all
+    counts as used for periodic resets in cache admission policies. Bins that
+    have saturated at INT32_MAX or INT32_MIN remain saturated.
 
-/* Export count-min sketch to file
+    `cms_age` ages all the bins immediately using SIMD instructions where
+    available. `cms_age_lazy` returns immediately and the bins are aged in
+    small blocks on first touch and a few blocks per insertion or removal, so
+    no single call pays for a full pass; lookups account for the pending
+    aging so the results are the same as `cms_age`. Any pass still pending is
+    finished before a new one starts or before a bulk operation (merge,
+    export, fold, etc).
+
+    Return:
+        CMS_SUCCESS
+        CMS_ERROR   - When the shift is larger than 31 */
+int cms_age(CountMinSketch* cms, unsigned int shift);
+int cms_age_lazy(CountMinSketch* cms, unsigned int shift);
+
+/* Export count-min sketch to file; chunks of zero bins are seeked over so
+   the untouched bins of large count-min sketches become holes in the file
 
     Return:
         CMS_SUCCESS - When file is opened and written
-        CMS_ERROR   - When file is unable to be opened */
+        CMS_ERROR   - When file is unable to be opened or written */
 int cms_export(CountMinSketch* cms, const char* filepath);
 
-/*  Import count-min sketch from file
+/*  Export count-min sketch to file on a background thread
+
+    A point-in-time view of the count-min sketch is captured using chunked
+    copy-on-write: the background thread copies the bins a chunk at a time and
+    any insertion or removal that touches a chunk not yet copied copies that
+    chunk first. Writers only ever wait on a single chunk copy and never on
+    the disk write. The resulting file is identical to `cms_export`.
+
+    The optional `callback` is called from the background thread once the
+    file is written with the status (CMS_SUCCESS or CMS_ERROR) of the export.
 
     Return:
-        CMS_SUCCESS - When file is opened and written
-        CMS_ERROR   - When file is unable to be opened
+        CMS_SUCCESS - When file is opened and the background export started
+        CMS_ERROR   - When file is unable to be opened or the thread could
+                      not be started
+
+    NOTE: Only one background export per count-min sketch; starting another
+          waits for the previous one to finish
+    NOTE: The count-min sketch must not be modified from more than one thread
+          at a time while the export is running */
+typedef void (*cms_export_callback) (CountMinSketch* cms, const char* filepath, int status, void* data);
+int cms_export_async(CountMinSketch* cms, const char* filepath, cms_export_callback callback, void* data);
+
+/*  Wait for the background export, if any, to finish and release its resources
+
+    Return:
+        CMS_SUCCESS - When there is no background export or it was written
+        CMS_ERROR   - When the background export failed to write the file
+
+    NOTE: Do not call from within the `cms_export_callback` */
+int cms_export_wait(CountMinSketch* cms);
+
+/*  Fold the count-min sketch to `width / factor` bins per row by summing the
+    bins that map together; the result is the same as if every element had
+    been added to a count-min sketch of the narrower width. Trades accuracy
+    (the error rate grows by `factor`) for memory when archiving.
+    Return:
+        CMS_SUCCESS - When the count-min sketch was folded
+        CMS_ERROR   - When `factor` does not evenly divide the width
+
+    NOTE: Power of two widths can always be halved and use faster indexing */
+int cms_fold(CountMinSketch* cms, unsigned int factor);
+
+/*  Merge previously exported count-min sketch files into a new exported file
+    without importing them; the bins are streamed from all the files a chunk
+    at a time so memory use is bounded regardless of the size or number of
+    count-min sketches
+
+    Return:
+        CMS_SUCCESS - When all files are of the same dimensions and were
+                      successfully merged into `filepath`
+        CMS_ERROR   - When a file is unable to be opened or read, is not a
+                      valid export, the dimensions do not match, or
+                      `filepath` is also one of the inputs
+
+    NOTE: It is up to the caller to ensure all files used the same hashing
+          algorithm */
+int cms_merge_files(const char* filepath, const char** filepaths, size_t num_files);
+
+/*  Import count-min sketch from file; the `_allocator` functions allocate
+    the bins as `cms_init_allocator` does, and only the bins that are not
+    zero are stored into them
+
+    Return:
+        CMS_SUCCESS - When file is opened and read
+        CMS_ERROR   - When file is unable to be opened or read, is not a
+                      valid export, or the bins cannot be allocated
 
     NOTE: It is up to the caller to provide the correct hashing algorithm */
 int cms_import_alt(CountMinSketch* cms, const char* filepath, cms_hash_function hash_function);
 static __inline__ int cms_import(CountMinSketch* cms, const char* filepath) {
     return cms_import_alt(cms, filepath, NULL);
 }
+int cms_import_allocator_alt(CountMinSketch* cms, const char* filepath, const cms_allocator* allocator, cms_hash_function hash_function);
+static __inline__ int cms_import_allocator(CountMinSketch* cms, const char* filepath, const cms_allocator* allocator) {
+    return cms_import_allocator_alt(cms, filepath, allocator, NULL);
+}
 
 /*  Insertion family of functions:
 
@@ -178,6 +372,61 @@ static __inline__ uint64_t* cms_get_hashes(CountMinSketch* cms, const char* key)
     return cms_get_hashes_alt(cms, cms->depth, key);
 }
 
+/*  Insert or lookup a batch of keys; the same as calling `cms_add_inc` or
+    `cms_check` on each key in order, but the bins of all the rows of the
+    keys are mapped with SIMD instructions and fetched ahead of their use.
+    For the `_alt` functions, `hashes` holds `num_hashes` hashes for each key,
+    one key after the other. `results` receives the estimate of each key and
+    may be NULL when inserting.
+
+    Returns:
+        CMS_SUCCESS
+        CMS_ERROR   -   when fewer hashes than the depth are provided per key or
+                        unable to allocate the hashes of the batch */
+int cms_add_inc_batch(CountMinSketch* cms, const char** keys, size_t num_keys, uint32_t x, int32_t* results);
+int cms_add_inc_batch_alt(CountMinSketch* cms, const uint64_t* hashes, unsigned int num_hashes, size_t num_keys, uint32_t x, int32_t* results);
+static __inline__ int cms_add_batch(CountMinSketch* cms, const char** keys, size_t num_keys, int32_t* results) {
+    return cms_add_inc_batch(cms, keys, num_keys, 1, results);
+}
+static __inline__ int cms_add_batch_alt(CountMinSketch* cms, const uint64_t* hashes, unsigned int num_hashes, size_t num_keys, int32_t* results) {
+    return cms_add_inc_batch_alt(cms, hashes, num_hashes, num_keys, 1, results);
+}
+int cms_check_batch(CountMinSketch* cms, const char** keys, size_t num_keys, int32_t* results);
+int cms_check_batch_alt(CountMinSketch* cms, const uint64_t* hashes, unsigned int num_hashes, size_t num_keys, int32_t* results);
+
+/*  The SIMD instruction set used for hashing, batches, merging, aging and
+    clearing: "avx512", "avx2", "sse2" or "scalar". It is selected on first
+    use as the best supported by the CPU, so the library need not be built
+    for the host; setting the CMS_SIMD environment variable to one of these
+    names limits the selection to that level. */
+const char* cms_simd_level(void);
+
+/*  Track the `k` keys with the largest estimates, updated from the estimate
+    computed by `cms_add_inc` and `cms_remove_inc`; keys added using only
+    their hashes (the `_alt` functions) cannot be tracked. Keys are identified
+    by their first hash. Inserting a key that is not heavy costs a single
+    comparison.
+
+    Return:
+        CMS_SUCCESS
+        CMS_ERROR   - When k is 0 or the tracker cannot be allocated
+
+    NOTE: Calling again replaces the current tracker
+    NOTE: Merging into the count-min sketch does not update the tracker */
+int cms_topk_enable(CountMinSketch* cms, unsigned int k);
+
+/* Stop tracking heavy hitters and free the tracker */
+int cms_topk_disable(CountMinSketch* cms);
+
+/*  List up to `max_results` tracked heavy hitters ordered by count,
+    largest first, into `results`
+
+    Returns the number of heavy hitters written to results
+
+    NOTE: The keys are owned by the count-min sketch and are only valid until
+          the next insertion or removal */
+size_t cms_topk(CountMinSketch* cms, cms_heavy_hitter* results, size_t max_results);
+
 /*  Initialized count-min sketch and merge the cms' directly into the newly
     initialized object
     Return:
@@ -200,6 +449,772 @@ int cms_merge(CountMinSketch* cms, int num_sketches, ...);
 */
 int cms_merge_into(CountMinSketch* cms, int num_sketches, ...);
 
+/*  Array versions of `cms_merge` and `cms_merge_into` for merging a runtime
+    sized collection of count-min sketches. The bins are merged in cache sized
+    tiles across all the count-min sketches and, for large count-min sketches,
+    split across up to `num_threads` threads (0 or 1 to merge on the calling
+    thread). The result is identical regardless of the number of threads.
+    Return:
+        CMS_SUCCESS - When all count-min sketches are of the same size, etc and
+                      were successfully merged
+        CMS_ERROR   - When there was an error completing the merge; including
+                      when the cms' are not all of the same demensions, unable
+                      to allocate the correct memory, or no sketches provided
+*/
+int cms_merge_array(CountMinSketch* cms, CountMinSketch** sketches, size_t num_sketches, unsigned int num_threads);
+int cms_merge_into_array(CountMinSketch* cms, CountMinSketch** sketches, size_t num_sketches, unsigned int num_threads);
+
+/*  Merge count-min sketches of different widths into a previously initialized
+    object by folding each of them to its width on the fly; the width of each
+    count-min sketch must be a multiple of the width of `cms`
+    Return:
+        CMS_SUCCESS - When all count-min sketches were successfully merged
+        CMS_ERROR   - When the depth or hash function differ or a width is
+                      not a multiple of the width of `cms`
+*/
+int cms_merge_into_folded(CountMinSketch* cms, CountMinSketch** sketches, size_t num_sketches);
+
+/*  Estimate the inner product of the frequencies of two count-min sketches,
+    such as the size of a join between the two streams, as the minimum over
+    the rows of the dot products of the rows; an over estimate for streams
+    without removals
+    Return:
+        The estimate accumulated in 64 bits, or CMS_ERROR when the count-min
+        sketches are not of the same dimensions and hash function
+*/
+int64_t cms_inner_product(CountMinSketch* a, CountMinSketch* b);
+
+/*  Subtract count-min sketch `b` from `a`, either into a newly initialized
+    count-min sketch `cms` (`cms_subtract`) or in place (`cms_subtract_into`),
+    e.g. to compare this hour's counts to the previous hour's. The bins
+    saturate at INT32_MAX and INT32_MIN as with all other operations.
+    Return:
+        CMS_SUCCESS - When the count-min sketches were successfully subtracted
+        CMS_ERROR   - When the count-min sketches are not of the same
+                      dimensions and hash function or on allocation failure
+    NOTE: Subtracting does not update the heavy hitter tracker
+*/
+int cms_subtract(CountMinSketch* cms, CountMinSketch* a, CountMinSketch* b);
+int cms_subtract_into(CountMinSketch* a, CountMinSketch* b);
+
+/*  Find the bins whose absolute value is larger than `threshold`, such as
+    the changed bins of a difference produced by `cms_subtract`; up to
+    `max_changes` are written to `changes` in row order
+    Return:
+        The number of bins larger than `threshold`, which may be more than
+        `max_changes`
+*/
+size_t cms_changes(CountMinSketch* cms, uint32_t threshold, cms_change* changes, size_t max_changes);
+
+
+
+/*******************************************************************************
+*    SLIDING WINDOW COUNT-MIN SKETCH
+*******************************************************************************/
+
+/*  A count-min sketch over the most recent `num_slices` time slices; the
+    caller starts a new slice with `cms_window_rotate` (e.g. every 30 seconds
+    with 10 slices for the last 5 minutes) and the oldest slice expires.
+
+    A running total of the live slices is kept so that lookups are a single
+    count-min sketch lookup. Expiring a slice is done incrementally: a few of
+    its bins are subtracted from the total on each insertion so rotating does
+    not pay for a full pass over the bins.
+
+    NOTE: As with merge, a bin that saturates at INT32_MAX or INT32_MIN in the
+          total stays saturated after the slice that saturated it expires */
+typedef struct {
+    uint32_t depth;
+    uint32_t width;
+    uint32_t num_slices;
+    uint32_t head;              /* slice receiving insertions */
+    int64_t elements_added;     /* elements added within the window */
+    uint64_t retire_cursor;     /* bins of the expiring slice already retired */
+    CountMinSketch total;       /* sum of the live slices and the unretired bins */
+    CountMinSketch* slices;     /* ring of `num_slices + 1` slices */
+} CountMinSketchWindow, count_min_sketch_window;
+
+/*  Initialize the sliding window count-min sketch with `num_slices` slices of
+    the user defined width and depth
+    Alternatively, one can also pass in a custom hash function
+
+    Returns:
+        CMS_SUCCESS
+        CMS_ERROR   -   when unable to allocate the slices or when width,
+                        depth or num_slices are 0 */
+int cms_window_init_alt(CountMinSketchWindow* win, unsigned int width, unsigned int depth, unsigned int num_slices, cms_hash_function hash_function);
+static __inline__ int cms_window_init(CountMinSketchWindow* win, unsigned int width, unsigned int depth, unsigned int num_slices) {
+    return cms_window_init_alt(win, width, depth, num_slices, NULL);
+}
+
+/* Free all memory used in the sliding window count-min sketch */
+int cms_window_destroy(CountMinSketchWindow* win);
+
+/* Reset the sliding window count-min sketch to zero elements inserted */
+int cms_window_clear(CountMinSketchWindow* win);
+
+/*  Start a new slice for insertions and expire the oldest slice from the window
+
+    Return:
+        CMS_SUCCESS */
+int cms_window_rotate(CountMinSketchWindow* win);
+
+/*  Add the provided key or hashes to the current slice `x` times
+
+    Returns the number of times the key has been inserted within the window
+    using `min` estimation or CMS_ERROR if insufficient hashes are provided */
+int32_t cms_window_add_inc(CountMinSketchWindow* win, const char* key, uint32_t x);
+int32_t cms_window_add_inc_alt(CountMinSketchWindow* win, uint64_t* hashes, unsigned int num_hashes, uint32_t x);
+static __inline__ int32_t cms_window_add(CountMinSketchWindow* win, const char* key) {
+    return cms_window_add_inc(win, key, 1);
+}
+static __inline__ int32_t cms_window_add_alt(CountMinSketchWindow* win, uint64_t* hashes, unsigned int num_hashes) {
+    return cms_window_add_inc_alt(win, hashes, num_hashes, 1);
+}
+
+/* Determine the maximum number of times the key may have been inserted within the window */
+int32_t cms_window_check(CountMinSketchWindow* win, const char* key);
+int32_t cms_window_check_alt(CountMinSketchWindow* win, uint64_t* hashes, unsigned int num_hashes);
+
+
+/*******************************************************************************
+*    TIME DECAYED COUNT-MIN SKETCH
+*******************************************************************************/
+
+/*  A count-min sketch whose counts decay exponentially with time, halving
+    every `half_life` ticks; the caller moves time forward using
+    `cms_decay_advance` (e.g. one tick per second).
+
+    Decay is lazy: each bin records the tick it was last decayed to and is
+    only brought up to date when it is next inserted into, so advancing time
+    is constant time and untouched bins cost nothing.
+
+    NOTE: Bins not touched for 2^32 ticks are decayed incorrectly; at any
+          sensible half life they will have decayed to 0 long before */
+typedef struct {
+    uint32_t depth;
+    uint32_t width;
+    uint32_t now;               /* current tick */
+    double half_life;           /* ticks for a count to decay by half */
+    double elements_added;      /* decayed total of the elements added */
+    double powers[CMS_DECAY_POWERS];
+    cms_hash_function hash_function;
+    double* bins;
+    uint32_t* ticks;            /* tick each bin was last decayed to */
+} CountMinSketchDecay, count_min_sketch_decay;
+
+/*  Initialize the decayed count-min sketch based on user defined width, depth
+    and half life (in ticks)
+    Alternatively, one can also pass in a custom hash function
+
+    Returns:
+        CMS_SUCCESS
+        CMS_ERROR   -   when unable to allocate the bins or when width, depth,
+                        or half_life are 0 */
+int cms_decay_init_alt(CountMinSketchDecay* cds, unsigned int width, unsigned int depth, double half_life, cms_hash_function hash_function);
+static __inline__ int cms_decay_init(CountMinSketchDecay* cds, unsigned int width, unsigned int depth, double half_life) {
+    return cms_decay_init_alt(cds, width, depth, half_life, NULL);
+}
+
+/* Free all memory used in the decayed count-min sketch */
+int cms_decay_destroy(CountMinSketchDecay* cds);
+
+/* Reset the decayed count-min sketch to zero elements inserted and tick 0 */
+int cms_decay_clear(CountMinSketchDecay* cds);
+
+/*  Move time forward by `ticks`; constant time regardless of size
+
+    Return:
+        CMS_SUCCESS */
+int cms_decay_advance(CountMinSketchDecay* cds, uint32_t ticks);
+
+/*  Add the provided key or hashes with a weight of `x` at the current tick
+
+    Returns the decayed count of the key using `min` estimation or CMS_ERROR
+    if insufficient hashes are provided */
+double cms_decay_add_inc(CountMinSketchDecay* cds, const char* key, double x);
+double cms_decay_add_inc_alt(CountMinSketchDecay* cds, uint64_t* hashes, unsigned int num_hashes, double x);
+static __inline__ double cms_decay_add(CountMinSketchDecay* cds, const char* key) {
+    return cms_decay_add_inc(cds, key, 1.0);
+}
+static __inline__ double cms_decay_add_alt(CountMinSketchDecay* cds, uint64_t* hashes, unsigned int num_hashes) {
+    return cms_decay_add_inc_alt(cds, hashes, num_hashes, 1.0);
+}
+
+/* Determine the maximum decayed count of the key at the current tick */
+double cms_decay_check(CountMinSketchDecay* cds, const char* key);
+double cms_decay_check_alt(CountMinSketchDecay* cds, uint64_t* hashes, unsigned int num_hashes);
+
+
+/*******************************************************************************
+*    TINYLFU ADMISSION FILTER
+*******************************************************************************/
+
+/*  A TinyLFU cache admission filter: a doorkeeper Bloom filter in front of a
+    count-min sketch of 4-bit saturating counters that is halved every
+    `sample_size` recorded accesses so that old popularity fades.
+
+    The first access of a key within a sample only sets the doorkeeper; later
+    accesses increment the counters. A candidate is admitted into the cache
+    over the eviction victim when it has been accessed more often.
+
+    All operations work on a single 64-bit hash and never allocate memory when
+    using the default hash function. */
+typedef struct {
+    uint32_t depth;
+    uint32_t width;             /* 4-bit counters per row; a power of two */
+    uint64_t sample_size;       /* recorded accesses between resets */
+    uint64_t additions;         /* recorded accesses since the last reset */
+    uint64_t doorkeeper_bits;
+    cms_hash_function hash_function;
+    uint64_t* counters;         /* sixteen 4-bit counters per word */
+    uint64_t* doorkeeper;
+} TinyLFU, tiny_lfu;
+
+/*  Initialize the TinyLFU for a cache holding `capacity` entries; the
+    default sample size is 10 times the capacity
+    Alternatively, one can also pass in a custom hash function
+
+    Returns:
+        CMS_SUCCESS
+        CMS_ERROR   -   when unable to allocate the counters or when capacity
+                        or sample_size are 0 */
+int cms_tinylfu_init_alt(TinyLFU* tlfu, uint64_t capacity, uint64_t sample_size, cms_hash_function hash_function);
+static __inline__ int cms_tinylfu_init(TinyLFU* tlfu, uint64_t capacity) {
+    return cms_tinylfu_init_alt(tlfu, capacity, capacity * 10, NULL);
+}
+
+/* Free all memory used in the TinyLFU */
+int cms_tinylfu_destroy(TinyLFU* tlfu);
+
+/* Reset the TinyLFU to no accesses recorded */
+int cms_tinylfu_clear(TinyLFU* tlfu);
+
+/*  Halve all the counters and clear the doorkeeper; done automatically every
+    `sample_size` recorded accesses */
+int cms_tinylfu_reset(TinyLFU* tlfu);
+
+/*  Record an access of the key or hash
+
+    Return:
+        CMS_SUCCESS */
+int cms_tinylfu_record(TinyLFU* tlfu, const char* key);
+int cms_tinylfu_record_alt(TinyLFU* tlfu, uint64_t hash);
+
+/* Estimate the number of accesses of the key or hash; at most 16 */
+uint32_t cms_tinylfu_frequency(const TinyLFU* tlfu, const char* key);
+uint32_t cms_tinylfu_frequency_alt(const TinyLFU* tlfu, uint64_t hash);
+
+/*  Determine if the candidate should replace the victim in the cache
+
+    Return:
+        1   -   When the candidate is estimated to be more frequent
+        0   -   Otherwise */
+int cms_tinylfu_admit(const TinyLFU* tlfu, const char* candidate, const char* victim);
+int cms_tinylfu_admit_alt(const TinyLFU* tlfu, uint64_t candidate, uint64_t victim);
+
+
+/*******************************************************************************
+*    AUGMENTED COUNT-MIN SKETCH
+*******************************************************************************/
+
+/*  A count-min sketch with a small exact filter of hot keys in front of it.
+    Keys in the filter are counted exactly with a single update instead of
+    `depth` scattered bin updates; all other keys fall through to the sketch.
+    A key whose sketch estimate grows larger than the smallest count in the
+    filter replaces it, and the evicted key's filtered updates are then added
+    to the sketch.
+
+    With skewed data most updates hit the filter, which raises throughput and
+    gives exact counts for the heaviest keys once they are in the filter.
+
+    NOTE: A filter of 16 to 64 keys fits in a few cache lines; larger filters
+          make every update to a cold key slower
+    NOTE: Call `cms_augmented_flush` before exporting or merging `cms` */
+typedef struct {
+    uint32_t depth;
+    uint32_t width;
+    uint32_t filter_size;
+    uint32_t filter_used;
+    int64_t elements_added;
+    CountMinSketch cms;         /* counts of the keys not in the filter */
+    uint64_t* filter_ids;       /* first hash of each key in the filter */
+    uint64_t* filter_hashes;    /* all `depth` hashes of each key in the filter */
+    int32_t* new_counts;        /* count of each key in the filter */
+    int32_t* old_counts;        /* part of the count already in the sketch */
+} CountMinSketchAugmented, count_min_sketch_augmented;
+
+/*  Initialize the augmented count-min sketch based on user defined width,
+    depth and the number of keys held in the filter
+    Alternatively, one can also pass in a custom hash function
+
+    Returns:
+        CMS_SUCCESS
+        CMS_ERROR   -   when unable to allocate the bins or filter or when
+                        width, depth or filter_size are 0 */
+int cms_augmented_init_alt(CountMinSketchAugmented* acms, unsigned int width, unsigned int depth, unsigned int filter_size, cms_hash_function hash_function);
+static __inline__ int cms_augmented_init(CountMinSketchAugmented* acms, unsigned int width, unsigned int depth, unsigned int filter_size) {
+    return cms_augmented_init_alt(acms, width, depth, filter_size, NULL);
+}
+
+/* Free all memory used in the augmented count-min sketch */
+int cms_augmented_destroy(CountMinSketchAugmented* acms);
+
+/* Reset the augmented count-min sketch, including the filter, to zero elements inserted */
+int cms_augmented_clear(CountMinSketchAugmented* acms);
+
+/*  Add the counts held in the filter to the sketch so that `cms` holds the
+    counts of all keys; the keys stay in the filter
+
+    Return:
+        CMS_SUCCESS */
+int cms_augmented_flush(CountMinSketchAugmented* acms);
+
+/*  Add the provided key or hashes `x` times
+
+    Returns the number of times the key has been inserted; exact when the key
+    is in the filter and using `min` estimation otherwise, or CMS_ERROR if
+    insufficient hashes are provided */
+int32_t cms_augmented_add_inc(CountMinSketchAugmented* acms, const char* key, uint32_t x);
+int32_t cms_augmented_add_inc_alt(CountMinSketchAugmented* acms, uint64_t* hashes, unsigned int num_hashes, uint32_t x);
+static __inline__ int32_t cms_augmented_add(CountMinSketchAugmented* acms, const char* key) {
+    return cms_augmented_add_inc(acms, key, 1);
+}
+static __inline__ int32_t cms_augmented_add_alt(CountMinSketchAugmented* acms, uint64_t* hashes, unsigned int num_hashes) {
+    return cms_augmented_add_inc_alt(acms, hashes, num_hashes, 1);
+}
+
+/* Determine the maximum number of times the key may have been inserted; the filter is consulted first */
+int32_t cms_augmented_check(CountMinSketchAugmented* acms, const char* key);
+int32_t cms_augmented_check_alt(CountMinSketchAugmented* acms, uint64_t* hashes, unsigned int num_hashes);
+
+
+/*******************************************************************************
+*    DYADIC RANGE COUNT-MIN SKETCH
+*******************************************************************************/
+
+/*  A hierarchy of count-min sketches over integer values in [0, 2^bits) for
+    approximate range counts and quantiles. Level `l` counts the prefixes
+    `value >> l`. A range decomposes into at most two dyadic intervals per
+    level, so queries read O(bits) sketch rows.
+
+    Levels with no more prefixes than `width` count them exactly in a single
+    row. All rows of a level are derived from one 64-bit hash of the prefix.
+
+    NOTE: The levels cannot use a custom hash function since they hash integers */
+typedef struct {
+    uint32_t depth;
+    uint32_t width;
+    uint32_t bits;              /* values are in [0, 2^bits) */
+    int64_t elements_added;
+    CountMinSketch* levels;     /* `bits` levels; level 0 counts the values */
+    uint64_t* hashes;           /* scratch space for the hashes of a prefix */
+} CountMinSketchDyadic, count_min_sketch_dyadic;
+
+/*  Initialize the dyadic count-min sketch for values of `bits` bits (1 - 64)
+    using levels of the user defined width and depth
+
+    Returns:
+        CMS_SUCCESS
+        CMS_ERROR   -   when unable to allocate the levels or when width or
+                        depth are 0 or bits is not in 1 - 64 */
+int cms_dyadic_init(CountMinSketchDyadic* dcms, unsigned int width, unsigned int depth, unsigned int bits);
+
+/* Free all memory used in the dyadic count-min sketch */
+int cms_dyadic_destroy(CountMinSketchDyadic* dcms);
+
+/* Reset the dyadic count-min sketch to zero elements inserted */
+int cms_dyadic_clear(CountMinSketchDyadic* dcms);
+
+/*  Add the value `x` times to every level
+
+    Returns the number of times the value has been inserted using `min`
+    estimation or CMS_ERROR if the value does not fit in `bits` bits */
+int32_t cms_dyadic_add_inc(CountMinSketchDyadic* dcms, uint64_t value, uint32_t x);
+static __inline__ int32_t cms_dyadic_add(CountMinSketchDyadic* dcms, uint64_t value) {
+    return cms_dyadic_add_inc(dcms, value, 1);
+}
+
+/* Determine the maximum number of times the value may have been inserted */
+int32_t cms_dyadic_check(CountMinSketchDyadic* dcms, uint64_t value);
+
+/*  Estimate the number of values inserted in [low, high], inclusive; an over
+    estimate like the point estimates
+
+    Returns the estimate or CMS_ERROR when low > high or high does not fit
+    in `bits` bits */
+int64_t cms_dyadic_range(CountMinSketchDyadic* dcms, uint64_t low, uint64_t high);
+
+/*  Estimate the `q` quantile (0 - 1): the smallest value such that at least
+    `q` of the inserted values are less than or equal to it; 0 when empty */
+uint64_t cms_dyadic_quantile(CountMinSketchDyadic* dcms, double q);
+
+
+/*******************************************************************************
+*    COUNT SKETCH
+*******************************************************************************/
+
+/*  A Count-Sketch: each row adds or subtracts the count according to a sign
+    taken from the top bit of the row's hash, and the estimate is the median
+    of the signed bins. Collisions cancel out on average so the estimate is
+    unbiased, which suits streams with removals better than the count-min
+    estimates, and it needs less width for the same error on skewed data.
+
+    The bins are kept in an ordinary count-min sketch so that exporting,
+    importing and merging use the count-min sketch functions on `cms`
+    directly; only sketches with the same dimensions and hash function can be
+    merged, as with count-min sketches. */
+typedef struct {
+    uint32_t depth;
+    uint32_t width;
+    CountMinSketch cms;         /* signed bins */
+} CountSketch, count_sketch;
+
+/*  Initialize the Count-Sketch based on user defined width and depth
+    Alternatively, one can also pass in a custom hash function
+
+    Returns:
+        CMS_SUCCESS
+        CMS_ERROR   -   when unable to allocate the bins or when width or depth are 0 */
+int cms_countsketch_init_alt(CountSketch* cs, unsigned int width, unsigned int depth, cms_hash_function hash_function);
+static __inline__ int cms_countsketch_init(CountSketch* cs, unsigned int width, unsigned int depth) {
+    return cms_countsketch_init_alt(cs, width, depth, NULL);
+}
+
+/* Free all memory used in the Count-Sketch */
+int cms_countsketch_destroy(CountSketch* cs);
+
+/* Reset the Count-Sketch to zero elements inserted */
+int cms_countsketch_clear(CountSketch* cs);
+
+/*  Import a Count-Sketch exported using `cms_export(&cs->cms, filepath)` */
+int cms_countsketch_import_alt(CountSketch* cs, const char* filepath, cms_hash_function hash_function);
+static __inline__ int cms_countsketch_import(CountSketch* cs, const char* filepath) {
+    return cms_countsketch_import_alt(cs, filepath, NULL);
+}
+
+/*  Add or remove the provided key or hashes `x` times
+
+    Returns the median estimate of the key or CMS_ERROR if insufficient
+    hashes are provided */
+int32_t cms_countsketch_add_inc(CountSketch* cs, const char* key, uint32_t x);
+int32_t cms_countsketch_add_inc_alt(CountSketch* cs, uint64_t* hashes, unsigned int num_hashes, uint32_t x);
+int32_t cms_countsketch_remove_inc(CountSketch* cs, const char* key, uint32_t x);
+int32_t cms_countsketch_remove_inc_alt(CountSketch* cs, uint64_t* hashes, unsigned int num_hashes, uint32_t x);
+static __inline__ int32_t cms_countsketch_add(CountSketch* cs, const char* key) {
+    return cms_countsketch_add_inc(cs, key, 1);
+}
+static __inline__ int32_t cms_countsketch_add_alt(CountSketch* cs, uint64_t* hashes, unsigned int num_hashes) {
+    return cms_countsketch_add_inc_alt(cs, hashes, num_hashes, 1);
+}
+static __inline__ int32_t cms_countsketch_remove(CountSketch* cs, const char* key) {
+    return cms_countsketch_remove_inc(cs, key, 1);
+}
+static __inline__ int32_t cms_countsketch_remove_alt(CountSketch* cs, uint64_t* hashes, unsigned int num_hashes) {
+    return cms_countsketch_remove_inc_alt(cs, hashes, num_hashes, 1);
+}
+
+/* Estimate the number of times the key has been inserted as the median of the signed bins */
+int32_t cms_countsketch_check(CountSketch* cs, const char* key);
+int32_t cms_countsketch_check_alt(CountSketch* cs, uint64_t* hashes, unsigned int num_hashes);
+
+
+/*******************************************************************************
+*    SCALABLE COUNT-MIN SKETCH
+*******************************************************************************/
+
+/*  A count-min sketch that grows with the stream. Insertions go to the newest
+    stage. Once a stage has taken its share of elements, a new stage twice as
+    wide, taking twice as many elements, is appended. Lookups sum the
+    estimates of all stages.
+
+    The absolute error of each stage stays that of the first stage, so the
+    error grows with the number of stages (the log of the stream size) rather
+    than with the stream itself, and memory is only allocated as the stream
+    grows.
+
+    All stages share the depth and hash function so the hashes of a key are
+    computed once. */
+typedef struct {
+    uint32_t depth;
+    uint32_t width;             /* width of the first stage */
+    uint32_t num_stages;
+    uint64_t stage_capacity;    /* elements taken by the first stage */
+    int64_t elements_added;
+    cms_hash_function hash_function;
+    CountMinSketch* stages;
+} CountMinSketchScalable, count_min_sketch_scalable;
+
+/*  Initialize the scalable count-min sketch with a first stage of the user
+    defined width and depth that takes `stage_capacity` elements
+    Alternatively, one can also pass in a custom hash function
+
+    Returns:
+        CMS_SUCCESS
+        CMS_ERROR   -   when unable to allocate the first stage or when width,
+                        depth or stage_capacity are 0 */
+int cms_scalable_init_alt(CountMinSketchScalable* scms, unsigned int width, unsigned int depth, uint64_t stage_capacity, cms_hash_function hash_function);
+static __inline__ int cms_scalable_init(CountMinSketchScalable* scms, unsigned int width, unsigned int depth, uint64_t stage_capacity) {
+    return cms_scalable_init_alt(scms, width, depth, stage_capacity, NULL);
+}
+
+/* Free all memory used in the scalable count-min sketch */
+int cms_scalable_destroy(CountMinSketchScalable* scms);
+
+/* Reset the scalable count-min sketch to zero elements inserted and only the first stage */
+int cms_scalable_clear(CountMinSketchScalable* scms);
+
+/*  Add the provided key or hashes `x` times to the newest stage, first
+    appending a new stage if the newest is full
+
+    Returns the number of times the key has been inserted summed across the
+    stages or CMS_ERROR if insufficient hashes are provided
+
+    NOTE: If a new stage cannot be allocated the newest stage keeps taking
+          elements with a growing error */
+int32_t cms_scalable_add_inc(CountMinSketchScalable* scms, const char* key, uint32_t x);
+int32_t cms_scalable_add_inc_alt(CountMinSketchScalable* scms, uint64_t* hashes, unsigned int num_hashes, uint32_t x);
+static __inline__ int32_t cms_scalable_add(CountMinSketchScalable* scms, const char* key) {
+    return cms_scalable_add_inc(scms, key, 1);
+}
+static __inline__ int32_t cms_scalable_add_alt(CountMinSketchScalable* scms, uint64_t* hashes, unsigned int num_hashes) {
+    return cms_scalable_add_inc_alt(scms, hashes, num_hashes, 1);
+}
+
+/* Determine the maximum number of times the key may have been inserted summed across the stages */
+int32_t cms_scalable_check(CountMinSketchScalable* scms, const char* key);
+int32_t cms_scalable_check_alt(CountMinSketchScalable* scms, uint64_t* hashes, unsigned int num_hashes);
+
+
+/*******************************************************************************
+*    COUNT-MIN SKETCH GROUP
+*******************************************************************************/
+
+/*  A group of count-min sketches of the same width, depth and hash function,
+    such as hourly or per tenant sketches, that are all updated with the same
+    element. A key is hashed and its bins located once per update for the
+    whole group.
+
+    Members are either separate count-min sketches (`sketches`), usable with
+    all the count-min sketch functions, or interleaved so that the bins of all
+    members for a cell are adjacent (`bins[cell * num_sketches + member]`) and
+    an update touches one cache line per row rather than one per member; use
+    `cms_group_extract` to get a member of an interleaved group as a
+    count-min sketch. */
+typedef struct {
+    uint32_t depth;
+    uint32_t width;
+    uint32_t num_sketches;
+    int interleaved;
+    int64_t elements_added;     /* elements added through the group */
+    cms_hash_function hash_function;
+    CountMinSketch* sketches;   /* members when not interleaved */
+    int32_t* bins;              /* interleaved bins of all members */
+} CountMinSketchGroup, count_min_sketch_group;
+
+/*  Initialize a group of `num_sketches` count-min sketches of the user defined
+    width and depth, optionally interleaved
+    Alternatively, one can also pass in a custom hash function
+
+    Returns:
+        CMS_SUCCESS
+        CMS_ERROR   -   when unable to allocate the bins or when width, depth
+                        or num_sketches are 0 */
+int cms_group_init_alt(CountMinSketchGroup* grp, unsigned int width, unsigned int depth, unsigned int num_sketches, int interleaved, cms_hash_function hash_function);
+static __inline__ int cms_group_init(CountMinSketchGroup* grp, unsigned int width, unsigned int depth, unsigned int num_sketches, int interleaved) {
+    return cms_group_init_alt(grp, width, depth, num_sketches, interleaved, NULL);
+}
+
+/* Free all memory used in the group */
+int cms_group_destroy(CountMinSketchGroup* grp);
+
+/* Reset all members of the group to zero elements inserted */
+int cms_group_clear(CountMinSketchGroup* grp);
+
+/*  Add the provided key or hashes `x` times to every member of the group
+
+    Return:
+        CMS_SUCCESS
+        CMS_ERROR   -   if insufficient hashes are provided */
+int cms_group_add_inc(CountMinSketchGroup* grp, const char* key, uint32_t x);
+int cms_group_add_inc_alt(CountMinSketchGroup* grp, uint64_t* hashes, unsigned int num_hashes, uint32_t x);
+static __inline__ int cms_group_add(CountMinSketchGroup* grp, const char* key) {
+    return cms_group_add_inc(grp, key, 1);
+}
+static __inline__ int cms_group_add_alt(CountMinSketchGroup* grp, uint64_t* hashes, unsigned int num_hashes) {
+    return cms_group_add_inc_alt(grp, hashes, num_hashes, 1);
+}
+
+/*  Determine the maximum number of times the key may have been inserted into
+    each member, written to `results` (one per member)
+
+    Return:
+        CMS_SUCCESS
+        CMS_ERROR   -   if insufficient hashes are provided */
+int cms_group_check(CountMinSketchGroup* grp, const char* key, int32_t* results);
+int cms_group_check_alt(CountMinSketchGroup* grp, uint64_t* hashes, unsigned int num_hashes, int32_t* results);
+
+/*  Initialize `cms` as a copy of the member of the group, e.g. to export or
+    merge a member of an interleaved group
+
+    Return:
+        CMS_SUCCESS
+        CMS_ERROR   -   when member is out of range or on allocation failure */
+int cms_group_extract(CountMinSketchGroup* grp, unsigned int member, CountMinSketch* cms);
+
+
+/*******************************************************************************
+*    COUNT-MIN SKETCH ARENA
+*******************************************************************************/
+
+/*  An arena of many count-min sketches of the same width, depth and hash
+    function, such as one per customer. The sketches are allocated
+    `slab_size` at a time with the bins of a slab contiguous in memory, and
+    are referred to by an id; acquiring and releasing a sketch is constant
+    time and released sketches are reused.
+
+    The sketches work with all the count-min sketch functions except
+    `cms_destroy`, `cms_fold` and importing or merging into them (which
+    replace the bins); use `cms_arena_release` instead of `cms_destroy`.
+    The whole arena can be exported to and imported from a single file. */
+typedef struct {
+    uint32_t depth;
+    uint32_t width;
+    uint32_t slab_size;         /* count-min sketches per slab */
+    uint32_t num_slabs;
+    uint64_t num_used;
+    uint64_t num_free;
+    cms_hash_function hash_function;
+    CountMinSketch** sketches;  /* per slab */
+    int32_t** bins;             /* per slab; the bins of all its sketches */
+    uint8_t* in_use;            /* per id */
+    uint64_t* free_ids;         /* stack of released ids */
+} CountMinSketchArena, count_min_sketch_arena;
+
+/*  Initialize the arena of count-min sketches of the user defined width and
+    depth, allocated `slab_size` at a time
+    Alternatively, one can also pass in a custom hash function
+
+    Returns:
+        CMS_SUCCESS
+        CMS_ERROR   -   when width, depth or slab_size are 0 */
+int cms_arena_init_alt(CountMinSketchArena* arena, unsigned int width, unsigned int depth, unsigned int slab_size, cms_hash_function hash_function);
+static __inline__ int cms_arena_init(CountMinSketchArena* arena, unsigned int width, unsigned int depth, unsigned int slab_size) {
+    return cms_arena_init_alt(arena, width, depth, slab_size, NULL);
+}
+
+/* Free all memory used in the arena, including all of its count-min sketches */
+int cms_arena_destroy(CountMinSketchArena* arena);
+
+/*  Get an empty count-min sketch from the arena, reusing a released one if
+    possible; its id is written to `id`
+
+    Returns:
+        CMS_SUCCESS
+        CMS_ERROR   -   when unable to allocate a new slab */
+int cms_arena_acquire(CountMinSketchArena* arena, uint64_t* id);
+
+/* The count-min sketch with the id; NULL if the id is not in use */
+CountMinSketch* cms_arena_get(CountMinSketchArena* arena, uint64_t id);
+
+/*  Return the count-min sketch to the arena to be reused
+
+    Returns:
+        CMS_SUCCESS
+        CMS_ERROR   -   when the id is not in use */
+int cms_arena_release(CountMinSketchArena* arena, uint64_t id);
+
+/*  Export all the count-min sketches of the arena, keeping their ids, to a
+    single file
+
+    Returns:
+        CMS_SUCCESS
+        CMS_ERROR   -   when unable to open the file */
+int cms_arena_export(CountMinSketchArena* arena, const char* filepath);
+
+/*  Import an arena exported using `cms_arena_export`
+    Alternatively, one can also pass in a custom hash function
+
+    Returns:
+        CMS_SUCCESS
+        CMS_ERROR   -   when unable to open or allocate the file or it is not
+                        an exported arena */
+int cms_arena_import_alt(CountMinSketchArena* arena, const char* filepath, cms_hash_function hash_function);
+static __inline__ int cms_arena_import(CountMinSketchArena* arena, const char* filepath) {
+    return cms_arena_import_alt(arena, filepath, NULL);
+}
+
+
+/*******************************************************************************
+*    NUMA REPLICATED COUNT-MIN SKETCH
+*******************************************************************************/
+
+/* how insertions reach the replicas of a `CountMinSketchNuma` */
+#define CMS_NUMA_WRITE_ALL  0   /* every insertion updates all replicas */
+#define CMS_NUMA_WRITE_SYNC 1   /* insertions update the first replica, which is
+                                   copied to the others by `cms_numa_sync` */
+
+/*  A count-min sketch replicated on each NUMA node, with the bins of each
+    replica allocated on its node, so that lookups from any node read local
+    memory. Lookups use the replica of the node the calling thread runs on.
+
+    Insertions either update every replica (CMS_NUMA_WRITE_ALL), or only the
+    first replica (CMS_NUMA_WRITE_SYNC); then the other replicas return the
+    counts as of the last `cms_numa_sync`, which is cheaper for write heavy
+    streams that can tolerate stale lookups.
+
+    On systems without NUMA (or other than Linux) there is a single replica. */
+typedef struct {
+    uint32_t depth;
+    uint32_t width;
+    uint32_t num_replicas;      /* one per NUMA node */
+    int mode;
+    cms_hash_function hash_function;
+    CountMinSketch* replicas;   /* indexed by node */
+} CountMinSketchNuma, count_min_sketch_numa;
+
+/*  Initialize a count-min sketch of the user defined width and depth
+    replicated on each NUMA node, with insertions propagated as set by `mode`
+    Alternatively, one can also pass in a custom hash function
+
+    Returns:
+        CMS_SUCCESS
+        CMS_ERROR   -   when unable to allocate a replica, when width or depth are 0
+                        or when mode is not CMS_NUMA_WRITE_ALL or CMS_NUMA_WRITE_SYNC */
+int cms_numa_init_alt(CountMinSketchNuma* ncms, unsigned int width, unsigned int depth, int mode, cms_hash_function hash_function);
+static __inline__ int cms_numa_init(CountMinSketchNuma* ncms, unsigned int width, unsigned int depth, int mode) {
+    return cms_numa_init_alt(ncms, width, depth, mode, NULL);
+}
+
+/* Free all memory used in the replicated count-min sketch */
+int cms_numa_destroy(CountMinSketchNuma* ncms);
+
+/* Reset all replicas to zero elements inserted */
+int cms_numa_clear(CountMinSketchNuma* ncms);
+
+/*  Copy the first replica to the others; only needed with CMS_NUMA_WRITE_SYNC
+
+    Returns:
+        CMS_SUCCESS */
+int cms_numa_sync(CountMinSketchNuma* ncms);
+
+/* The replica on the NUMA node that the calling thread runs on */
+CountMinSketch* cms_numa_local(CountMinSketchNuma* ncms);
+
+/*  Insert or lookup in the replicated count-min sketch; the results are
+    those of the local replica with CMS_NUMA_WRITE_ALL and the first replica
+    with CMS_NUMA_WRITE_SYNC */
+int32_t cms_numa_add_inc(CountMinSketchNuma* ncms, const char* key, uint32_t x);
+int32_t cms_numa_add_inc_alt(CountMinSketchNuma* ncms, uint64_t* hashes, unsigned int num_hashes, uint32_t x);
+static __inline__ int32_t cms_numa_add(CountMinSketchNuma* ncms, const char* key) {
+    return cms_numa_add_inc(ncms, key, 1);
+}
+static __inline__ int32_t cms_numa_add_alt(CountMinSketchNuma* ncms, uint64_t* hashes, unsigned int num_hashes) {
+    return cms_numa_add_inc_alt(ncms, hashes, num_hashes, 1);
+}
+int32_t cms_numa_check(CountMinSketchNuma* ncms, const char* key);
+int32_t cms_numa_check_alt(CountMinSketchNuma* ncms, uint64_t* hashes, unsigned int num_hashes);
+
 
 #ifdef __cplusplus
 } // extern "C"
@@ -295,6 +295,127 @@ int main(int argc, char** argv) {
     cms_destroy(&cmsmerged);
     cms_destroy(&cms);
 
+    /* random updates to a large count-min sketch are dominated by cache and
+       TLB misses; compare the bins on regular and huge pages */
+    const char* alloc_names[] = {"malloc", "aligned", "transparent huge pages", "explicit huge pages"};
+    uint32_t alloc_flags[] = {0, CMS_ALLOC_ALIGNED, CMS_ALLOC_HUGE_PAGES, CMS_ALLOC_HUGETLB};
+    for (i = 0; i < 4; ++i) {
+        cms_allocator allocator = {NULL, NULL, NULL, alloc_flags[i]};
+        Timing alloc_tm;
+        printf("Count-Min Sketch: 10000000 insertions into 256 MB of bins (%s): ", alloc_names[i]);
+        fflush(stdout);
+        if (cms_init_allocator(&cms, 1 << 23, 8, &allocator) == CMS_ERROR) {
+            success_or_failure(1);
+            continue;
+        }
+        timing_start(&alloc_tm);
+        for (j = 0; j < 10000000; ++j) {
+            char key[12] = {0};
+            sprintf(key, "%d", j);
+            cms_add(&cms, key);
+        }
+        timing_end(&alloc_tm);
+        printf("%f seconds ", timing_get_difference(alloc_tm));
+        success_or_failure(cms.elements_added == 10000000 ? 0 : 1);
+        cms_destroy(&cms);
+    }
+
+    /* lookups against the replica on each NUMA node from this thread */
+    CountMinSketchNuma ncms;
+    printf("Count-Min Sketch: NUMA replicated insertions: ");
+    fflush(stdout);
+    result = cms_numa_init(&ncms, 1 << 22, 8, CMS_NUMA_WRITE_ALL) == CMS_ERROR;
+    for (j = 0; result == 0 && j < 1000000; ++j) {
+        char key[12] = {0};
+        sprintf(key, "%d", j);
+        cms_numa_add(&ncms, key);
+    }
+    success_or_failure(result);
+    for (i = 0; result == 0 && i < (int)ncms.num_replicas; ++i) {
+        Timing numa_tm;
+        printf("Count-Min Sketch: 1000000 lookups on node %d (%s): ", i, &ncms.replicas[i] == cms_numa_local(&ncms) ? "local" : "remote");
+        fflush(stdout);
+        res = 0;
+        timing_start(&numa_tm);
+        for (j = 0; j < 1000000; ++j) {
+            char key[12] = {0};
+            sprintf(key, "%d", j);
+            res |= cms_check(&ncms.replicas[i], key) < 1;
+        }
+        timing_end(&numa_tm);
+        printf("%f seconds ", timing_get_difference(numa_tm));
+        success_or_failure(res);
+    }
+    cms_numa_destroy(&ncms);
+
+    /* saturating merge throughput; each pass reads two and writes one set of bins */
+    CountMinSketch merge_a, merge_b;
+    CountMinSketch* merge_sketches[1] = {&merge_b};
+    printf("Count-Min Sketch: merge throughput of 2 x 128 MB of bins: ");
+    fflush(stdout);
+    result = cms_init(&merge_a, 1 << 22, 8) == CMS_ERROR || cms_init(&merge_b, 1 << 22, 8) == CMS_ERROR;
+    for (j = 0; result == 0 && j < 100000; ++j) {
+        char key[12] = {0};
+        sprintf(key, "%d", j);
+        cms_add(&merge_a, key);
+        cms_add_inc(&merge_b, key, j);
+    }
+    if (result == 0) {
+        Timing merge_tm;
+        timing_start(&merge_tm);
+        for (i = 0; i < 20; ++i) {
+            cms_merge_into_array(&merge_a, merge_sketches, 1, 1);
+        }
+        timing_end(&merge_tm);
+        printf("%f GB/s ", 20 * 3.0 * (1 << 22) * 8 * sizeof(int32_t) / timing_get_difference(merge_tm) / 1e9);
+    }
+    success_or_failure(result);
+    cms_destroy(&merge_a);
+    cms_destroy(&merge_b);
+
+    /* per-key against batched insertions and lookups of pre-hashed keys */
+    CountMinSketch batch_cms;
+    uint64_t* batch_hashes = (uint64_t*)malloc(1000000 * 8 * sizeof(uint64_t));
+    int32_t* batch_results = (int32_t*)malloc(1000000 * sizeof(int32_t));
+    printf("Count-Min Sketch: kernels selected at runtime: %s\n", cms_simd_level());
+    result = batch_hashes == NULL || batch_results == NULL || cms_init(&batch_cms, 1 << 22, 8) == CMS_ERROR;
+    for (j = 0; result == 0 && j < 1000000; ++j) {
+        char key[12] = {0};
+        sprintf(key, "%d", j);
+        uint64_t* key_hashes = cms_get_hashes(&batch_cms, key);
+        memcpy(batch_hashes + (uint64_t)j * 8, key_hashes, 8 * sizeof(uint64_t));
+        free(key_hashes);
+    }
+    if (result == 0) {
+        Timing batch_tm;
+        printf("Count-Min Sketch: 1000000 per-key insertions and lookups: ");
+        fflush(stdout);
+        timing_start(&batch_tm);
+        for (j = 0; j < 1000000; ++j) {
+            cms_add_alt(&batch_cms, batch_hashes + (uint64_t)j * 8, 8);
+        }
+        for (j = 0; j < 1000000; ++j) {
+            batch_results[j] = cms_check_alt(&batch_cms, batch_hashes + (uint64_t)j * 8, 8);
+        }
+        timing_end(&batch_tm);
+        printf("%f seconds ", timing_get_difference(batch_tm));
+        success_or_failure(batch_results[0] < 1);
+
+        printf("Count-Min Sketch: 1000000 batched insertions and lookups: ");
+        fflush(stdout);
+        timing_start(&batch_tm);
+        cms_add_batch_alt(&batch_cms, batch_hashes, 8, 1000000, NULL);
+        cms_check_batch_alt(&batch_cms, batch_hashes, 8, 1000000, batch_results);
+        timing_end(&batch_tm);
+        printf("%f seconds ", timing_get_difference(batch_tm));
+        success_or_failure(batch_results[0] < 2);
+    } else {
+        success_or_failure(result);
+    }
+    cms_destroy(&batch_cms);
+    free(batch_hashes);
+    free(batch_results);
+
     timing_end(&tm);
     printf("\nCompleted Count-Min Sketch tests in %f seconds!\n", timing_get_difference(tm));
     printf("\nCompleted tests!\n");
@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
 
 #include <openssl/md5.h>
 
@@ -14,6 +16,9 @@ const int depth = 5;
 
 
 static int calculate_md5sum(const char* filename, char* digest);
+static void export_callback(CountMinSketch* c, const char* filepath, int status, void* data);
+static uint64_t* test_hash(unsigned int num_hashes, const char* key);
+static uint64_t* test_hash_null(unsigned int num_hashes, const char* key);
 
 
 void test_setup(void) {
@@ -71,6 +76,19 @@ MU_TEST(test_init_optimal_bad) {
     mu_assert_int_eq(CMS_ERROR, cms_init_optimal(&c, -0.001, 0.99999));
     mu_assert_int_eq(CMS_ERROR, cms_init_optimal(&c, 0.001, -0.99999));
 }
+MU_TEST(test_sparse_setup) {
+    CountMinSketch sparse;
+    mu_assert_int_eq(CMS_SUCCESS, cms_init_sparse(&sparse, 10000, 7));
+    mu_assert_int_eq(10000, sparse.width);
+    mu_assert_int_eq(7, sparse.depth);
+    mu_assert_null(sparse.bins);
+    mu_assert_not_null(sparse.sparse);
+    mu_assert_int_eq(0, cms_check(&sparse, "this is a test"));
+    cms_destroy(&sparse);
+
+    mu_assert_int_eq(CMS_ERROR, cms_init_sparse(&sparse, 0, 7));
+}
+
 
 /*******************************************************************************
 *   Test Insertions
@@ -249,6 +267,174 @@ MU_TEST(test_check_mean_min_error) {
     free(hashes);
 }
 
+/*******************************************************************************
+*   Test Heavy Hitters
+*******************************************************************************/
+MU_TEST(test_topk) {
+    cms_heavy_hitter results[3];
+    mu_assert_int_eq(0, cms_topk(&cms, results, 3));
+    mu_assert_int_eq(CMS_ERROR, cms_topk_enable(&cms, 0));
+    mu_assert_int_eq(CMS_SUCCESS, cms_topk_enable(&cms, 3));
+
+    cms_add_inc(&cms, "this is a test", 5);
+    cms_add_inc(&cms, "this is another test", 50);
+    cms_add_inc(&cms, "this is also a test", 20);
+    cms_add_inc(&cms, "this is something to test", 1);  /* not heavy */
+    cms_add_inc(&cms, "this is a test", 60);  /* now the heaviest */
+
+    mu_assert_int_eq(3, cms_topk(&cms, results, 3));
+    mu_assert_string_eq("this is a test", results[0].key);
+    mu_assert_int_eq(65, results[0].count);
+    mu_assert_string_eq("this is another test", results[1].key);
+    mu_assert_int_eq(50, results[1].count);
+    mu_assert_string_eq("this is also a test", results[2].key);
+    mu_assert_int_eq(20, results[2].count);
+
+    /* evicts the smallest */
+    cms_add_inc(&cms, "this is something to test", 40);
+    mu_assert_int_eq(2, cms_topk(&cms, results, 2));
+    mu_assert_int_eq(3, cms_topk(&cms, results, 3));
+
+    /* only `max_results` entries are written */
+    cms_heavy_hitter fewer[2] = {{NULL, 0}, {NULL, -1}};
+    mu_assert_int_eq(1, cms_topk(&cms, fewer, 1));
+    mu_assert_string_eq("this is a test", fewer[0].key);
+    mu_assert_null(fewer[1].key);
+    mu_assert_int_eq(-1, fewer[1].count);
+    mu_assert_string_eq("this is something to test", results[2].key);
+    mu_assert_int_eq(41, results[2].count);
+
+    /* removals lower the count */
+    cms_remove_inc(&cms, "this is a test", 30);
+    cms_topk(&cms, results, 3);
+    mu_assert_string_eq("this is another test", results[0].key);
+    mu_assert_string_eq("this is something to test", results[1].key);
+    mu_assert_string_eq("this is a test", results[2].key);
+    mu_assert_int_eq(35, results[2].count);
+
+    cms_clear(&cms);
+    mu_assert_int_eq(0, cms_topk(&cms, results, 3));
+}
+
+MU_TEST(test_topk_many) {
+    /* exercise the index with many evictions */
+    char key[16];
+    cms_heavy_hitter results[8];
+    cms_topk_enable(&cms, 8);
+    for (int i = 1; i <= 200; ++i) {
+        sprintf(key, "key-%d", i);
+        cms_add_inc(&cms, key, i);
+    }
+    mu_assert_int_eq(8, cms_topk(&cms, results, 8));
+    for (int i = 0; i < 8; ++i) {
+        sprintf(key, "key-%d", 200 - i);
+        mu_assert_string_eq(key, results[i].key);
+        mu_assert_int_eq(cms_check(&cms, key), results[i].count);
+    }
+    mu_assert_int_eq(CMS_SUCCESS, cms_topk_disable(&cms));
+    mu_assert_null(cms.topk);
+}
+
+MU_TEST(test_sparse_merge_order) {
+    /* saturation depends on the order, which mixes sparse and dense sketches */
+    CountMinSketch up, down, sparse, merged, sequential;
+    cms_init(&up, width, depth);
+    cms_init(&down, width, depth);
+    cms_init_sparse(&sparse, width, depth);
+    cms_add_inc(&up, "this is a test", 2000000000);
+    cms_remove_inc(&down, "this is a test", 2000000000);
+    cms_add_inc(&sparse, "this is a test", 2000000000);
+
+    mu_assert_int_eq(CMS_SUCCESS, cms_merge(&merged, 4, &up, &down, &sparse, &up));
+    cms_init(&sequential, width, depth);
+    cms_merge_into(&sequential, 1, &up);
+    cms_merge_into(&sequential, 1, &down);
+    cms_merge_into(&sequential, 1, &sparse);
+    cms_merge_into(&sequential, 1, &up);
+    mu_assert_int_eq(INT32_MAX, cms_check(&merged, "this is a test"));
+    for (int i = 0; i < width * depth; ++i) {
+        mu_assert_int_eq(sequential.bins[i], merged.bins[i]);
+    }
+    cms_destroy(&merged);
+
+    /* 0 + 2e9 - 2e9 + 2e9 does not saturate */
+    mu_assert_int_eq(CMS_SUCCESS, cms_merge(&merged, 3, &up, &down, &sparse));
+    mu_assert_int_eq(2000000000, cms_check(&merged, "this is a test"));
+    cms_destroy(&merged);
+    cms_destroy(&sequential);
+    cms_destroy(&up);
+    cms_destroy(&down);
+    cms_destroy(&sparse);
+}
+
+MU_TEST(test_sparse_insertions) {
+    CountMinSketch sparse;
+    cms_init_sparse_alt(&sparse, width, depth, 50, NULL);
+    mu_assert_int_eq(5, cms_add_inc(&sparse, "this is a test", 5));
+    mu_assert_int_eq(3, cms_remove_inc(&sparse, "this is a test", 2));
+    mu_assert_int_eq(-4, cms_remove_inc(&sparse, "this is another test", 4));
+    mu_assert_int_eq(3, cms_check(&sparse, "this is a test"));
+    mu_assert_int_eq(-1, sparse.elements_added);
+    mu_assert_null(sparse.bins);
+
+    /* matches a dense count-min sketch until and after converting to dense */
+    char key[16];
+    for (int i = 0; i < 20; ++i) {
+        sprintf(key, "key-%d", i);
+        cms_add_inc(&sparse, key, i);
+        cms_add_inc(&cms, key, i);
+    }
+    mu_assert_not_null(sparse.bins);  /* more than 50 bins touched */
+    mu_assert_null(sparse.sparse);
+    cms_remove_inc(&cms, "this is another test", 4);
+    cms_add_inc(&cms, "this is a test", 3);
+    mu_assert_int_eq(0, memcmp(cms.bins, sparse.bins, width * depth * sizeof(int32_t)));
+    cms_destroy(&sparse);
+}
+
+MU_TEST(test_sparse_bulk) {
+    CountMinSketch sparse, merged, imported;
+    char digest[33] = {0}, dense_digest[33] = {0};
+    cms_init_sparse(&sparse, width, depth);
+    cms_add_inc(&sparse, "this is a test", 10);
+    cms_add_inc(&sparse, "this is another test", 3);
+    cms_add_inc(&cms, "this is a test", 10);
+    cms_add_inc(&cms, "this is another test", 3);
+
+    /* exported in the same layout as a dense count-min sketch */
+    cms_export(&sparse, "./tests/test.cms");
+    calculate_md5sum("./tests/test.cms", digest);
+    cms_export(&cms, "./tests/test.cms");
+    calculate_md5sum("./tests/test.cms", dense_digest);
+    mu_assert_string_eq(dense_digest, digest);
+    cms_import(&imported, "./tests/test.cms");
+    mu_assert_int_eq(10, cms_check(&imported, "this is a test"));
+    cms_destroy(&imported);
+
+    /* merged without converting the sources */
+    mu_assert_int_eq(CMS_SUCCESS, cms_merge(&merged, 2, &sparse, &cms));
+    mu_assert_int_eq(20, cms_check(&merged, "this is a test"));
+    mu_assert_int_eq(26, merged.elements_added);
+    mu_assert_not_null(sparse.sparse);
+    cms_destroy(&merged);
+
+    cms_age(&sparse, 1);
+    mu_assert_int_eq(5, cms_check(&sparse, "this is a test"));
+    cms_age_lazy(&sparse, 1);
+    mu_assert_int_eq(2, cms_check(&sparse, "this is a test"));
+    cms_clear(&sparse);
+    mu_assert_int_eq(0, cms_check(&sparse, "this is a test"));
+    mu_assert_not_null(sparse.sparse);
+
+    /* whole sketch operations convert to dense first */
+    cms_add_inc(&sparse, "this is a test", 10);
+    mu_assert_int_eq(100, cms_inner_product(&sparse, &sparse));
+    mu_assert_null(sparse.sparse);
+    mu_assert_int_eq(10, cms_check(&sparse, "this is a test"));
+    mu_assert_int_eq(CMS_SUCCESS, cms_densify(&sparse));
+    cms_destroy(&sparse);
+}
+
 /*******************************************************************************
 *   Test Clear / Reset
 *******************************************************************************/
@@ -262,6 +448,159 @@ MU_TEST(test_clear) {
     mu_assert_int_eq(0, cms_check(&cms, "this is a test"));
 }
 
+MU_TEST(test_clear_lazy) {
+    CountMinSketch empty;
+    cms_init(&empty, width, depth);
+    cms_add_inc(&cms, "this is a test", 100);
+    cms_add_inc(&cms, "this is another test", INT32_MAX);  /* saturated bins are cleared too */
+    cms_age_lazy(&cms, 1);  /* dropped by the clear */
+
+    mu_assert_int_eq(CMS_SUCCESS, cms_clear_lazy(&cms));
+    mu_assert_int_not_eq(0, cms.age_shift);
+    mu_assert_int_eq(0, cms.elements_added);
+    mu_assert_int_eq(0, cms_check(&cms, "this is a test"));
+    mu_assert_int_eq(0, cms_check_mean(&cms, "this is another test"));
+    mu_assert_int_eq(1, cms_add(&cms, "this is a test"));
+
+    /* repeated clears that never finish their sweep, past the epoch wrap */
+    for (int i = 0; i < 600; ++i) {
+        char key[16];
+        sprintf(key, "%d", i);
+        mu_assert_int_eq(0, cms_check(&cms, key));
+        mu_assert_int_eq(i + 1, cms_add_inc(&cms, key, i + 1));
+        cms_clear_lazy(&cms);
+    }
+    cms_export(&cms, "./tests/test.cms");  /* finishes the sweep */
+    mu_assert_int_eq(0, cms.age_shift);
+    mu_assert_int_eq(0, memcmp(empty.bins, cms.bins, (size_t)width * depth * sizeof(int32_t)));
+    remove("./tests/test.cms");
+    cms_destroy(&empty);
+}
+
+/*******************************************************************************
+*   Test Aging
+*******************************************************************************/
+MU_TEST(test_age) {
+    cms_add_inc(&cms, "this is a test", 255);
+    cms_remove_inc(&cms, "this is another test", 15);
+    cms_add_inc(&cms, "this is also a test", INT32_MAX);
+    int64_t elements = cms.elements_added;
+
+    mu_assert_int_eq(CMS_SUCCESS, cms_age(&cms, 1));
+    mu_assert_int_eq(127, cms_check(&cms, "this is a test"));
+    mu_assert_int_eq(-7, cms_check(&cms, "this is another test"));
+    mu_assert_int_eq(INT32_MAX, cms_check(&cms, "this is also a test"));
+    mu_assert(elements / 2 == cms.elements_added, "elements_added not aged");
+
+    mu_assert_int_eq(CMS_SUCCESS, cms_age(&cms, 3));
+    mu_assert_int_eq(15, cms_check(&cms, "this is a test"));
+    mu_assert_int_eq(0, cms_check(&cms, "this is another test"));
+    mu_assert_int_eq(CMS_ERROR, cms_age(&cms, 32));
+}
+
+MU_TEST(test_age_lazy) {
+    CountMinSketch full;
+    cms_init(&full, width, depth);
+    const char* keys[] = {"this is a test", "this is another test", "this is also a test"};
+    for (int i = 0; i < 3; ++i) {
+        cms_add_inc(&cms, keys[i], 100 * (i + 1));
+        cms_add_inc(&full, keys[i], 100 * (i + 1));
+    }
+
+    cms_age(&full, 1);
+    mu_assert_int_eq(CMS_SUCCESS, cms_age_lazy(&cms, 1));
+    mu_assert_int_not_eq(0, cms.age_shift);
+    mu_assert_int_eq(full.elements_added, cms.elements_added);
+    mu_assert_int_eq(50, cms_check(&cms, "this is a test"));
+    mu_assert_int_eq(100, cms_check_mean(&cms, "this is another test"));
+    mu_assert_int_eq(150, cms_check_mean_min(&cms, "this is also a test"));
+
+    /* touched blocks are aged before the insertion */
+    mu_assert_int_eq(51, cms_add(&cms, "this is a test"));
+    cms_add(&full, "this is a test");
+    mu_assert_int_eq(99, cms_remove(&cms, "this is another test"));
+    cms_remove(&full, "this is another test");
+
+    /* the sweep finishes after enough insertions */
+    for (int i = 0; i < 100; ++i) {
+        cms_add(&cms, "this is something to test");
+        cms_add(&full, "this is something to test");
+    }
+    mu_assert_int_eq(0, cms.age_shift);
+    mu_assert_int_eq(0, memcmp(full.bins, cms.bins, (size_t)full.width * full.depth * sizeof(int32_t)));
+
+    /* bulk operations finish the pass first */
+    cms_age_lazy(&cms, 2);
+    cms_age(&full, 2);
+    cms_export(&cms, "./tests/test.cms");
+    mu_assert_int_eq(0, cms.age_shift);
+    mu_assert_int_eq(0, memcmp(full.bins, cms.bins, (size_t)full.width * full.depth * sizeof(int32_t)));
+    remove("./tests/test.cms");
+    cms_destroy(&full);
+}
+
+/*******************************************************************************
+*   Test Fold
+*******************************************************************************/
+MU_TEST(test_fold) {
+    CountMinSketch narrow;
+    cms_init(&narrow, width / 4, depth);
+    cms_add_inc(&cms, "this is a test", 255);
+    cms_add_inc(&cms, "this is another test", 189);
+    cms_add_inc(&narrow, "this is a test", 255);
+    cms_add_inc(&narrow, "this is another test", 189);
+
+    mu_assert_int_eq(CMS_SUCCESS, cms_fold(&cms, 4));
+    mu_assert_int_eq(width / 4, cms.width);
+    mu_assert_int_eq(depth, cms.depth);
+    mu_assert_double_eq(0.008, cms.error_rate);
+    mu_assert_int_eq(444, cms.elements_added);
+    mu_assert_int_eq(255, cms_check(&cms, "this is a test"));
+    mu_assert_int_eq(189, cms_check(&cms, "this is another test"));
+    /* identical to having inserted into the narrower count-min sketch */
+    mu_assert_int_eq(0, memcmp(narrow.bins, cms.bins, (size_t)narrow.width * narrow.depth * sizeof(int32_t)));
+    cms_destroy(&narrow);
+}
+
+MU_TEST(test_fold_power_of_two) {
+    CountMinSketch c;
+    cms_init(&c, 1024, depth);
+    cms_add_inc(&c, "this is a test", 255);
+    mu_assert_int_eq(CMS_SUCCESS, cms_fold(&c, 2));
+    mu_assert_int_eq(CMS_SUCCESS, cms_fold(&c, 8));
+    mu_assert_int_eq(64, c.width);
+    mu_assert_int_eq(255, cms_check(&c, "this is a test"));
+    cms_destroy(&c);
+}
+
+MU_TEST(test_fold_error) {
+    mu_assert_int_eq(CMS_ERROR, cms_fold(&cms, 3));
+    mu_assert_int_eq(CMS_ERROR, cms_fold(&cms, 0));
+    mu_assert_int_eq(width, cms.width);
+}
+
+MU_TEST(test_cms_merge_into_folded) {
+    CountMinSketch wide, narrow;
+    cms_init(&wide, width * 2, depth);
+    cms_init(&narrow, width / 2, depth);
+    cms_add_inc(&cms, "this is a test", 255);
+    cms_add_inc(&wide, "this is a test", 45);
+    cms_add_inc(&wide, "this is another test", 10);
+
+    CountMinSketch* sketches[] = {&cms, &wide};
+    mu_assert_int_eq(CMS_SUCCESS, cms_merge_into_folded(&narrow, sketches, 2));
+    mu_assert_int_eq(310, narrow.elements_added);
+    mu_assert_int_eq(300, cms_check(&narrow, "this is a test"));
+    mu_assert_int_eq(10, cms_check(&narrow, "this is another test"));
+
+    /* the narrower one cannot be merged into the wider ones */
+    CountMinSketch* bad[] = {&narrow};
+    mu_assert_int_eq(CMS_ERROR, cms_merge_into_folded(&wide, bad, 1));
+    mu_assert_int_eq(CMS_ERROR, cms_merge_into_folded(&wide, bad, 0));
+    cms_destroy(&wide);
+    cms_destroy(&narrow);
+}
+
 /*******************************************************************************
 *   Test Export / Import
 *******************************************************************************/
@@ -274,6 +613,54 @@ MU_TEST(test_cms_export) {
     remove("./tests/test.cms");
 }
 
+MU_TEST(test_cms_export_async) {
+    cms_add_inc(&cms, "this is a test", 100);
+
+    int status = CMS_ERROR;
+    mu_assert_int_eq(CMS_SUCCESS, cms_export_async(&cms, "./tests/test.cms", &export_callback, &status));
+    /* changes after the export starts are not part of the snapshot */
+    cms_add_inc(&cms, "this is a test", 100);
+    cms_add_inc(&cms, "this is another test", 5);
+    mu_assert_int_eq(CMS_SUCCESS, cms_export_wait(&cms));
+    mu_assert_int_eq(CMS_SUCCESS, status);
+    mu_assert_null(cms.snapshot);
+    mu_assert_int_eq(200, cms_check(&cms, "this is a test"));
+
+    char digest[33] = {0};
+    calculate_md5sum("./tests/test.cms", digest);
+    mu_assert_string_eq("fb1c39dd1a73f1ef0d7fc79f60fc028e", digest);
+    remove("./tests/test.cms");
+}
+
+MU_TEST(test_cms_export_async_large) {
+    CountMinSketch c;
+    cms_init(&c, 100000, 7);  /* spans many copy-on-write chunks */
+    cms_add_inc(&c, "this is a test", 100);
+
+    mu_assert_int_eq(CMS_SUCCESS, cms_export_async(&c, "./tests/test.cms", NULL, NULL));
+    for (int i = 0; i < 1000; ++i) {
+        cms_add(&c, "this is a test");
+        cms_remove(&c, "this is another test");
+    }
+    cms_clear(&c);
+    mu_assert_int_eq(CMS_SUCCESS, cms_export_wait(&c));
+
+    CountMinSketch imp;
+    cms_import(&imp, "./tests/test.cms");
+    mu_assert_int_eq(100, imp.elements_added);
+    mu_assert_int_eq(100, cms_check(&imp, "this is a test"));
+    mu_assert_int_eq(0, cms_check(&imp, "this is another test"));
+    cms_destroy(&imp);
+    cms_destroy(&c);
+    remove("./tests/test.cms");
+}
+
+MU_TEST(test_cms_export_async_error) {
+    mu_assert_int_eq(CMS_ERROR, cms_export_async(&cms, "./does/not/exist/test.cms", NULL, NULL));
+    mu_assert_null(cms.snapshot);
+    mu_assert_int_eq(CMS_SUCCESS, cms_export_wait(&cms));
+}
+
 MU_TEST(test_cms_import) {
     cms_add_inc(&cms, "this is a test", 100);
     cms_export(&cms, "./tests/test.cms");
@@ -294,6 +681,27 @@ MU_TEST(test_cms_import_error) {
     mu_assert_int_eq(CMS_ERROR, res);
 }
 
+MU_TEST(test_cms_import_invalid) {
+    CountMinSketch imp;
+    /* too short to hold the trailer */
+    FILE* fp = fopen("./tests/test.cms", "wb");
+    fputs("bad", fp);
+    fclose(fp);
+    mu_assert_int_eq(CMS_ERROR, cms_import(&imp, "./tests/test.cms"));
+
+    /* a truncated export no longer matches the size in its trailer */
+    cms_export(&cms, "./tests/test.cms");
+    fp = fopen("./tests/test.cms", "r+b");
+    uint32_t dims[2] = {cms.width + 1, cms.depth};
+    fseek(fp, -(long)(2 * sizeof(uint32_t) + sizeof(int64_t)), SEEK_END);
+    fwrite(dims, sizeof(uint32_t), 2, fp);
+    fclose(fp);
+    mu_assert_int_eq(CMS_ERROR, cms_import(&imp, "./tests/test.cms"));
+    remove("./tests/test.cms");
+
+    mu_assert_int_eq(CMS_ERROR, cms_export(&cms, "/dev/full"));
+}
+
 
 /*******************************************************************************
 *   Test Merge
@@ -340,6 +748,31 @@ MU_TEST(test_cms_merge_overflow_down) {
     cms_destroy(&n);
 }
 
+/* every pair of edge values against the scalar saturating add and subtract */
+MU_TEST(test_cms_merge_saturate) {
+    const int32_t values[] = {0, 7, -7, INT32_MAX, INT32_MIN, INT32_MAX - 5, INT32_MIN + 5, INT32_MAX / 2 + 1};
+    CountMinSketch other, diff;
+    cms_init(&other, width, depth);
+    cms_init(&diff, width, depth);
+    for (int i = 0; i < width * depth; ++i) {
+        cms.bins[i] = values[i % 8];
+        diff.bins[i] = values[i % 8];
+        other.bins[i] = values[(i / 8) % 8];
+    }
+    cms_merge_into(&cms, 1, &other);
+    cms_subtract_into(&diff, &other);
+    for (int i = 0; i < width * depth; ++i) {
+        int64_t a = values[i % 8], b = values[(i / 8) % 8];
+        int sticky = (a == INT32_MAX || a == INT32_MIN);
+        int64_t sum = sticky ? a : (a + b > INT32_MAX) ? INT32_MAX : (a + b < INT32_MIN) ? INT32_MIN : a + b;
+        int64_t dif = sticky ? a : (a - b > INT32_MAX) ? INT32_MAX : (a - b < INT32_MIN) ? INT32_MIN : a - b;
+        mu_assert_int_eq(sum, cms.bins[i]);
+        mu_assert_int_eq(dif, diff.bins[i]);
+    }
+    cms_destroy(&other);
+    cms_destroy(&diff);
+}
+
 MU_TEST(test_cms_merge_into) {
     cms_add_inc(&cms, "this is a test", 255);
 
@@ -374,6 +807,1062 @@ MU_TEST(test_cms_merge_mismatch) {
 }
 
 
+MU_TEST(test_cms_merge_array) {
+    CountMinSketch c, n;
+    cms_init(&c, width, depth);
+    cms_add_inc(&cms, "this is a test", 255);
+    cms_add_inc(&c, "this is another test", 10);
+
+    CountMinSketch* sketches[] = {&cms, &c, &cms};
+    mu_assert_int_eq(CMS_SUCCESS, cms_merge_array(&n, sketches, 3, 1));
+    mu_assert_int_eq(520, n.elements_added);
+    mu_assert_int_eq(510, cms_check(&n, "this is a test"));
+    mu_assert_int_eq(10, cms_check(&n, "this is another test"));
+
+    mu_assert_int_eq(CMS_SUCCESS, cms_merge_into_array(&n, sketches, 2, 1));
+    mu_assert_int_eq(785, n.elements_added);
+    mu_assert_int_eq(765, cms_check(&n, "this is a test"));
+    mu_assert_int_eq(20, cms_check(&n, "this is another test"));
+
+    mu_assert_int_eq(CMS_ERROR, cms_merge_into_array(&n, sketches, 0, 1));
+    cms_destroy(&n);
+    cms_destroy(&c);
+}
+
+MU_TEST(test_cms_merge_array_threads) {
+    /* large enough to be split across threads */
+    CountMinSketch a, b, single, threaded;
+    cms_init(&a, 1 << 19, 4);
+    cms_init(&b, 1 << 19, 4);
+    cms_add_inc(&a, "this is a test", 255);
+    cms_add_inc(&b, "this is a test", INT32_MAX);
+    cms_remove_inc(&b, "this is another test", 20);
+
+    CountMinSketch* sketches[] = {&a, &b, &a};
+    mu_assert_int_eq(CMS_SUCCESS, cms_merge_array(&single, sketches, 3, 1));
+    mu_assert_int_eq(CMS_SUCCESS, cms_merge_array(&threaded, sketches, 3, 4));
+    mu_assert_int_eq(INT32_MAX, cms_check(&threaded, "this is a test"));
+    mu_assert_int_eq(-20, cms_check(&threaded, "this is another test"));
+    mu_assert_int_eq(0, memcmp(single.bins, threaded.bins, (size_t)single.width * single.depth * sizeof(int32_t)));
+    mu_assert_int_eq(single.elements_added, threaded.elements_added);
+
+    cms_destroy(&a);
+    cms_destroy(&b);
+    cms_destroy(&single);
+    cms_destroy(&threaded);
+}
+
+MU_TEST(test_cms_merge_array_mismatch) {
+    CountMinSketch c, n;
+    cms_init(&c, width*2, depth);  // twice as wide!
+
+    CountMinSketch* sketches[] = {&cms, &c};
+    mu_assert_int_eq(CMS_ERROR, cms_merge_array(&n, sketches, 2, 2));
+    mu_assert_int_eq(CMS_ERROR, cms_merge_into_array(&cms, sketches + 1, 1, 2));
+    cms_destroy(&c);
+}
+
+MU_TEST(test_cms_merge_files) {
+    CountMinSketch c, m;
+    cms_init(&c, width, depth);
+    cms_add_inc(&cms, "this is a test", 255);
+    cms_add_inc(&c, "this is a test", 45);
+    cms_add_inc(&c, "this is another test", 10);
+    cms_export(&cms, "./tests/test1.cms");
+    cms_export(&c, "./tests/test2.cms");
+
+    const char* files[] = {"./tests/test1.cms", "./tests/test2.cms", "./tests/test1.cms"};
+    mu_assert_int_eq(CMS_SUCCESS, cms_merge_files("./tests/test.cms", files, 3));
+
+    cms_import(&m, "./tests/test.cms");
+    mu_assert_int_eq(width, m.width);
+    mu_assert_int_eq(depth, m.depth);
+    mu_assert_int_eq(565, m.elements_added);
+    mu_assert_int_eq(555, cms_check(&m, "this is a test"));
+    mu_assert_int_eq(10, cms_check(&m, "this is another test"));
+
+    cms_destroy(&m);
+    cms_destroy(&c);
+    remove("./tests/test.cms");
+    remove("./tests/test1.cms");
+    remove("./tests/test2.cms");
+}
+
+MU_TEST(test_cms_merge_files_mismatch) {
+    CountMinSketch c;
+    cms_init(&c, width*2, depth);  // twice as wide!
+    cms_export(&cms, "./tests/test1.cms");
+    cms_export(&c, "./tests/test2.cms");
+
+    const char* files[] = {"./tests/test1.cms", "./tests/test2.cms"};
+    mu_assert_int_eq(CMS_ERROR, cms_merge_files("./tests/test.cms", files, 2));
+    mu_assert_int_eq(CMS_ERROR, cms_merge_files("./tests/test1.cms", files, 1));
+    const char* missing[] = {"./tests/test1.cms", "./tests/missing.cms"};
+    mu_assert_int_eq(CMS_ERROR, cms_merge_files("./tests/test.cms", missing, 2));
+
+    FILE* fp = fopen("./tests/test.cms", "rb");
+    mu_assert_null(fp);
+
+    cms_destroy(&c);
+    remove("./tests/test1.cms");
+    remove("./tests/test2.cms");
+}
+
+MU_TEST(test_cms_inner_product) {
+    CountMinSketch other;
+    cms_init(&other, width, depth);
+    cms_add_inc(&cms, "this is a test", 3);
+    cms_add_inc(&cms, "this is another test", 2);
+    cms_add_inc(&other, "this is a test", 5);
+    cms_add_inc(&other, "this is also a test", 7);
+    mu_assert_int_eq(15, cms_inner_product(&cms, &other));
+    mu_assert_int_eq(13, cms_inner_product(&cms, &cms));
+
+    /* each row against a plain dot product, including negative bins */
+    for (int i = 0; i < width * depth; ++i) {
+        cms.bins[i] = (i * 7919) % 65536 - 1000;
+        other.bins[i] = (i * 104729) % 50000;
+    }
+    int64_t expected = INT64_MAX;
+    for (int i = 0; i < depth; ++i) {
+        int64_t row = 0;
+        for (int j = 0; j < width; ++j) {
+            row += (int64_t)cms.bins[i * width + j] * other.bins[i * width + j];
+        }
+        expected = (row < expected) ? row : expected;
+    }
+    mu_assert(expected == cms_inner_product(&cms, &other), "Inner product does not match the dot products of the rows");
+    cms_destroy(&other);
+}
+
+MU_TEST(test_cms_inner_product_mismatch) {
+    CountMinSketch other;
+    cms_init(&other, width, depth + 1);
+    mu_assert_int_eq(CMS_ERROR, cms_inner_product(&cms, &other));
+    cms_destroy(&other);
+}
+
+MU_TEST(test_cms_subtract) {
+    CountMinSketch previous, diff;
+    cms_init(&previous, width, depth);
+    cms_add_inc(&cms, "this is a test", 10);
+    cms_add_inc(&cms, "this is another test", 3);
+    cms_add_inc(&previous, "this is a test", 4);
+    cms_add_inc(&previous, "this is also a test", 5);
+
+    mu_assert_int_eq(CMS_SUCCESS, cms_subtract(&diff, &cms, &previous));
+    mu_assert_int_eq(6, cms_check(&diff, "this is a test"));
+    mu_assert_int_eq(3, cms_check(&diff, "this is another test"));
+    mu_assert_int_eq(-5, cms_check(&diff, "this is also a test"));
+    mu_assert_int_eq(4, diff.elements_added);
+
+    /* three keys changed in every row */
+    cms_change changes[3 * 5];
+    mu_assert_int_eq(15, cms_changes(&diff, 2, changes, 15));
+    mu_assert_int_eq(0, changes[0].row);
+    mu_assert_int_eq(4, changes[14].row);
+    mu_assert_int_eq(10, cms_changes(&diff, 3, changes, 4));  /* only 4 written */
+    mu_assert_int_eq(5, cms_changes(&diff, 5, changes, 15));
+    mu_assert_int_eq(6, changes[0].delta);
+    mu_assert_int_eq(0, cms_changes(&diff, 6, changes, 15));
+
+    mu_assert_int_eq(CMS_SUCCESS, cms_subtract_into(&cms, &previous));
+    mu_assert_int_eq(0, memcmp(cms.bins, diff.bins, width * depth * sizeof(int32_t)));
+    mu_assert_int_eq(4, cms.elements_added);
+    cms_destroy(&diff);
+    cms_destroy(&previous);
+}
+
+MU_TEST(test_cms_subtract_saturate) {
+    CountMinSketch other;
+    cms_init(&other, width, depth);
+    for (int i = 0; i < width * depth; ++i) {
+        cms.bins[i] = (i % 3 == 0) ? INT32_MIN + 5 : (i % 3 == 1) ? INT32_MAX : INT32_MAX - 5;
+        other.bins[i] = (i % 3 == 0) ? 10 : (i % 3 == 1) ? 7 : -10;
+    }
+    cms_subtract_into(&cms, &other);
+    for (int i = 0; i < width * depth; ++i) {
+        mu_assert_int_eq((i % 3 == 0) ? INT32_MIN : INT32_MAX, cms.bins[i]);
+    }
+    cms_destroy(&other);
+}
+
+MU_TEST(test_cms_subtract_mismatch) {
+    CountMinSketch other, diff;
+    cms_init(&other, width + 1, depth);
+    mu_assert_int_eq(CMS_ERROR, cms_subtract(&diff, &cms, &other));
+    mu_assert_int_eq(CMS_ERROR, cms_subtract_into(&cms, &other));
+    cms_destroy(&other);
+}
+
+MU_TEST(test_cms_changes_kernels) {
+    /* 111 bins leave a tail after the 4, 8 and 16 bin vectors of every CMS_SIMD level */
+    CountMinSketch c;
+    cms_init(&c, 37, 3);
+    const uint64_t hits[] = {0, 3, 9, 17, 40, 97, 105, 109, 110};
+    const int32_t values[] = {6, -6, INT32_MIN, INT32_MAX, 5, -5, 7, INT32_MIN + 1, -100};
+    for (int i = 0; i < 9; ++i) {
+        c.bins[hits[i]] = values[i];
+    }
+    const uint32_t thresholds[] = {0, 5, 6, INT32_MAX, 0x80000000U};
+    cms_change changes[9];
+    for (int t = 0; t < 5; ++t) {
+        size_t expected = 0, found = cms_changes(&c, thresholds[t], changes, 9);
+        for (int i = 0; i < 9; ++i) {
+            uint32_t mag = (values[i] < 0) ? 0U - (uint32_t)values[i] : (uint32_t)values[i];
+            if (mag <= thresholds[t]) {
+                continue;
+            }
+            mu_assert(expected < found, "cms_changes missed a changed bin");
+            mu_assert_int_eq(hits[i] / 37, changes[expected].row);
+            mu_assert_int_eq(hits[i] % 37, changes[expected].bin);
+            mu_assert_int_eq(values[i], changes[expected].delta);
+            ++expected;
+        }
+        mu_assert_int_eq(expected, found);
+    }
+    mu_assert_int_eq(9, cms_changes(&c, 0, changes, 2));  /* counted past max_changes */
+    cms_destroy(&c);
+}
+
+/*******************************************************************************
+*   Test Sliding Window
+*******************************************************************************/
+MU_TEST(test_window_setup) {
+    CountMinSketchWindow win;
+    mu_assert_int_eq(CMS_SUCCESS, cms_window_init(&win, width, depth, 4));
+    mu_assert_int_eq(width, win.width);
+    mu_assert_int_eq(depth, win.depth);
+    mu_assert_int_eq(4, win.num_slices);
+    mu_assert_int_eq(0, win.elements_added);
+    cms_window_destroy(&win);
+
+    mu_assert_int_eq(CMS_ERROR, cms_window_init(&win, width, depth, 0));
+    mu_assert_int_eq(CMS_ERROR, cms_window_init(&win, 0, depth, 4));
+}
+
+MU_TEST(test_window_expire) {
+    CountMinSketchWindow win;
+    cms_window_init(&win, width, depth, 3);
+
+    mu_assert_int_eq(10, cms_window_add_inc(&win, "this is a test", 10));
+    cms_window_rotate(&win);
+    mu_assert_int_eq(15, cms_window_add_inc(&win, "this is a test", 5));
+    mu_assert_int_eq(1, cms_window_add(&win, "this is another test"));
+    cms_window_rotate(&win);
+    mu_assert_int_eq(17, cms_window_add_inc(&win, "this is a test", 2));
+    mu_assert_int_eq(18, win.elements_added);
+
+    cms_window_rotate(&win);  /* the first slice expires */
+    mu_assert_int_eq(7, cms_window_check(&win, "this is a test"));
+    mu_assert_int_eq(1, cms_window_check(&win, "this is another test"));
+    mu_assert_int_eq(8, win.elements_added);
+
+    cms_window_rotate(&win);
+    mu_assert_int_eq(2, cms_window_check(&win, "this is a test"));
+    mu_assert_int_eq(0, cms_window_check(&win, "this is another test"));
+    cms_window_rotate(&win);
+    mu_assert_int_eq(0, cms_window_check(&win, "this is a test"));
+    mu_assert_int_eq(0, win.elements_added);
+
+    cms_window_destroy(&win);
+}
+
+MU_TEST(test_window_incremental_retire) {
+    /* enough insertions between rotations to retire the slice incrementally */
+    CountMinSketchWindow win;
+    cms_window_init(&win, width, depth, 2);
+    cms_window_add_inc(&win, "this is a test", 100);
+    cms_window_rotate(&win);
+    cms_window_add_inc(&win, "this is a test", 50);
+    cms_window_rotate(&win);
+    for (int i = 0; i < 20; ++i) {
+        cms_window_add(&win, "this is another test");
+    }
+    mu_assert_int_eq(win.width * win.depth, win.retire_cursor);
+    mu_assert_int_eq(50, cms_window_check(&win, "this is a test"));
+    mu_assert_int_eq(20, cms_window_check(&win, "this is another test"));
+
+    cms_window_clear(&win);
+    mu_assert_int_eq(0, cms_window_check(&win, "this is a test"));
+    mu_assert_int_eq(0, win.elements_added);
+    cms_window_destroy(&win);
+}
+
+MU_TEST(test_window_error) {
+    CountMinSketchWindow win;
+    cms_window_init(&win, width, depth, 2);
+    uint64_t* hashes = cms_get_hashes_alt(&cms, 2, "this is a test");
+    mu_assert_int_eq(CMS_ERROR, cms_window_add_alt(&win, hashes, 2));
+    mu_assert_int_eq(CMS_ERROR, cms_window_check_alt(&win, hashes, 2));
+    free(hashes);
+    cms_window_destroy(&win);
+}
+
+/*******************************************************************************
+*   Test Time Decay
+*******************************************************************************/
+MU_TEST(test_decay_setup) {
+    CountMinSketchDecay cds;
+    mu_assert_int_eq(CMS_SUCCESS, cms_decay_init(&cds, width, depth, 10));
+    mu_assert_int_eq(width, cds.width);
+    mu_assert_int_eq(depth, cds.depth);
+    mu_assert_double_eq(1.0, cds.powers[0]);
+    mu_assert_double_eq(0.5, cds.powers[10]);
+    mu_assert_double_eq(0.0, cds.elements_added);
+    cms_decay_destroy(&cds);
+
+    mu_assert_int_eq(CMS_ERROR, cms_decay_init(&cds, width, depth, 0));
+    mu_assert_int_eq(CMS_ERROR, cms_decay_init(&cds, 0, depth, 10));
+}
+
+MU_TEST(test_decay_half_life) {
+    CountMinSketchDecay cds;
+    cms_decay_init(&cds, width, depth, 10);
+    mu_assert_double_eq(100.0, cms_decay_add_inc(&cds, "this is a test", 100));
+    cms_decay_advance(&cds, 10);
+    mu_assert_double_eq(50.0, cms_decay_check(&cds, "this is a test"));
+    mu_assert_double_eq(50.0, cds.elements_added);
+    mu_assert_double_eq(51.0, cms_decay_add(&cds, "this is a test"));
+    cms_decay_advance(&cds, 100);  /* beyond the precomputed factors */
+    mu_assert_double_eq(51.0 / 1024, cms_decay_check(&cds, "this is a test"));
+    mu_assert_double_eq(51.0 / 1024, cds.elements_added);
+    mu_assert_double_eq(0.0, cms_decay_check(&cds, "this is another test"));
+
+    cms_decay_clear(&cds);
+    mu_assert_double_eq(0.0, cms_decay_check(&cds, "this is a test"));
+    mu_assert_int_eq(0, cds.now);
+    cms_decay_destroy(&cds);
+}
+
+MU_TEST(test_decay_error) {
+    CountMinSketchDecay cds;
+    cms_decay_init(&cds, width, depth, 10);
+    uint64_t* hashes = cms_get_hashes_alt(&cms, 2, "this is a test");
+    mu_assert_double_eq(CMS_ERROR, cms_decay_add_alt(&cds, hashes, 2));
+    mu_assert_double_eq(CMS_ERROR, cms_decay_check_alt(&cds, hashes, 2));
+    free(hashes);
+    cms_decay_destroy(&cds);
+}
+
+/*******************************************************************************
+*   Test TinyLFU
+*******************************************************************************/
+MU_TEST(test_tinylfu_setup) {
+    TinyLFU tlfu;
+    mu_assert_int_eq(CMS_SUCCESS, cms_tinylfu_init(&tlfu, 1000));
+    mu_assert_int_eq(4, tlfu.depth);
+    mu_assert_int_eq(1024, tlfu.width);
+    mu_assert_int_eq(10000, tlfu.sample_size);
+    mu_assert_int_eq(0, cms_tinylfu_frequency(&tlfu, "this is a test"));
+    cms_tinylfu_destroy(&tlfu);
+
+    mu_assert_int_eq(CMS_ERROR, cms_tinylfu_init(&tlfu, 0));
+    mu_assert_int_eq(CMS_ERROR, cms_tinylfu_init_alt(&tlfu, 1000, 0, NULL));
+}
+
+MU_TEST(test_tinylfu_frequency) {
+    TinyLFU tlfu;
+    cms_tinylfu_init(&tlfu, 1000);
+    cms_tinylfu_record(&tlfu, "this is a test");
+    mu_assert_int_eq(1, cms_tinylfu_frequency(&tlfu, "this is a test"));  /* doorkeeper only */
+    for (int i = 0; i < 4; ++i) {
+        cms_tinylfu_record(&tlfu, "this is a test");
+    }
+    mu_assert_int_eq(5, cms_tinylfu_frequency(&tlfu, "this is a test"));
+    for (int i = 0; i < 20; ++i) {
+        cms_tinylfu_record(&tlfu, "this is a test");
+    }
+    mu_assert_int_eq(16, cms_tinylfu_frequency(&tlfu, "this is a test"));  /* saturated */
+
+    cms_tinylfu_record(&tlfu, "this is another test");
+    mu_assert_int_eq(1, cms_tinylfu_admit(&tlfu, "this is a test", "this is another test"));
+    mu_assert_int_eq(0, cms_tinylfu_admit(&tlfu, "this is another test", "this is a test"));
+    mu_assert_int_eq(0, cms_tinylfu_admit(&tlfu, "this is also a test", "this is another test"));
+
+    cms_tinylfu_clear(&tlfu);
+    mu_assert_int_eq(0, cms_tinylfu_frequency(&tlfu, "this is a test"));
+    cms_tinylfu_destroy(&tlfu);
+}
+
+MU_TEST(test_tinylfu_reset) {
+    TinyLFU tlfu;
+    cms_tinylfu_init_alt(&tlfu, 100, 20, NULL);
+    for (int i = 0; i < 11; ++i) {
+        cms_tinylfu_record(&tlfu, "this is a test");
+    }
+    mu_assert_int_eq(11, cms_tinylfu_frequency(&tlfu, "this is a test"));
+    for (int i = 0; i < 9; ++i) {
+        cms_tinylfu_record(&tlfu, "this is another test");
+    }
+    /* the 20th access halved the counters and cleared the doorkeeper */
+    mu_assert_int_eq(10, tlfu.additions);
+    mu_assert_int_eq(5, cms_tinylfu_frequency(&tlfu, "this is a test"));
+    mu_assert_int_eq(4, cms_tinylfu_frequency(&tlfu, "this is another test"));
+    cms_tinylfu_destroy(&tlfu);
+}
+
+
+/*******************************************************************************
+*   Test Augmented Sketch
+*******************************************************************************/
+MU_TEST(test_augmented_setup) {
+    CountMinSketchAugmented acms;
+    mu_assert_int_eq(CMS_SUCCESS, cms_augmented_init(&acms, 1000, 5, 32));
+    mu_assert_int_eq(1000, acms.width);
+    mu_assert_int_eq(5, acms.depth);
+    mu_assert_int_eq(32, acms.filter_size);
+    mu_assert_int_eq(0, acms.filter_used);
+    mu_assert_int_eq(0, cms_augmented_check(&acms, "this is a test"));
+    cms_augmented_destroy(&acms);
+
+    mu_assert_int_eq(CMS_ERROR, cms_augmented_init(&acms, 1000, 5, 0));
+    mu_assert_int_eq(CMS_ERROR, cms_augmented_init(&acms, 0, 5, 32));
+}
+
+MU_TEST(test_augmented_filter) {
+    CountMinSketchAugmented acms;
+    cms_augmented_init(&acms, 1000, 5, 2);
+    mu_assert_int_eq(1, cms_augmented_add(&acms, "this is a test"));
+    mu_assert_int_eq(2, cms_augmented_add_inc(&acms, "this is another test", 2));
+    mu_assert_int_eq(5, cms_augmented_add_inc(&acms, "this is another test", 3));
+    mu_assert_int_eq(0, acms.cms.elements_added);  /* all in the filter */
+    mu_assert_int_eq(6, acms.elements_added);
+
+    /* the new key out-grows the smallest filtered key and replaces it */
+    mu_assert_int_eq(4, cms_augmented_add_inc(&acms, "this is also a test", 4));
+    mu_assert_int_eq(2, acms.filter_used);
+    mu_assert_int_eq(1, cms_check(&acms.cms, "this is a test"));
+    mu_assert_int_eq(1, cms_augmented_check(&acms, "this is a test"));
+    mu_assert_int_eq(5, cms_augmented_add(&acms, "this is also a test"));
+    mu_assert_int_eq(4, cms_check(&acms.cms, "this is also a test"));
+
+    /* a key too small to be filtered stays in the sketch */
+    mu_assert_int_eq(1, cms_augmented_add(&acms, "this is something to test"));
+    mu_assert_int_eq(1, cms_augmented_check(&acms, "this is something to test"));
+
+    cms_augmented_flush(&acms);
+    mu_assert_int_eq(5, cms_check(&acms.cms, "this is also a test"));
+    mu_assert_int_eq(5, cms_check(&acms.cms, "this is another test"));
+    mu_assert_int_eq(acms.elements_added, acms.cms.elements_added);
+    cms_augmented_flush(&acms);  /* nothing more to add */
+    mu_assert_int_eq(5, cms_check(&acms.cms, "this is another test"));
+
+    cms_augmented_clear(&acms);
+    mu_assert_int_eq(0, acms.filter_used);
+    mu_assert_int_eq(0, cms_augmented_check(&acms, "this is another test"));
+    cms_augmented_destroy(&acms);
+}
+
+/*******************************************************************************
+*   Test Dyadic Range Sketch
+*******************************************************************************/
+MU_TEST(test_dyadic_setup) {
+    CountMinSketchDyadic dcms;
+    mu_assert_int_eq(CMS_SUCCESS, cms_dyadic_init(&dcms, 1000, 5, 16));
+    mu_assert_int_eq(16, dcms.bits);
+    mu_assert_int_eq(1000, dcms.levels[0].width);
+    mu_assert_int_eq(5, dcms.levels[0].depth);
+    mu_assert_int_eq(512, dcms.levels[7].width);  /* 2^9 prefixes are counted exactly */
+    mu_assert_int_eq(1, dcms.levels[7].depth);
+    mu_assert_int_eq(CMS_ERROR, cms_dyadic_add(&dcms, 1 << 16));
+    cms_dyadic_destroy(&dcms);
+
+    mu_assert_int_eq(CMS_ERROR, cms_dyadic_init(&dcms, 1000, 5, 0));
+    mu_assert_int_eq(CMS_ERROR, cms_dyadic_init(&dcms, 1000, 5, 65));
+    mu_assert_int_eq(CMS_ERROR, cms_dyadic_init(&dcms, 0, 5, 16));
+}
+
+MU_TEST(test_dyadic_range) {
+    CountMinSketchDyadic dcms;
+    cms_dyadic_init(&dcms, 4096, 5, 16);
+    for (uint64_t i = 0; i < 1000; ++i) {
+        cms_dyadic_add(&dcms, i);
+    }
+    mu_assert_int_eq(5, cms_dyadic_add_inc(&dcms, 65535, 5));
+    mu_assert_int_eq(1, cms_dyadic_check(&dcms, 10));
+    mu_assert_int_eq(1000, cms_dyadic_range(&dcms, 0, 999));
+    mu_assert_int_eq(100, cms_dyadic_range(&dcms, 100, 199));
+    mu_assert_int_eq(1, cms_dyadic_range(&dcms, 7, 7));
+    mu_assert_int_eq(0, cms_dyadic_range(&dcms, 1000, 65534));
+    mu_assert_int_eq(5, cms_dyadic_range(&dcms, 65535, 65535));
+    mu_assert_int_eq(1005, cms_dyadic_range(&dcms, 0, 65535));
+    mu_assert_int_eq(CMS_ERROR, cms_dyadic_range(&dcms, 10, 9));
+    mu_assert_int_eq(CMS_ERROR, cms_dyadic_range(&dcms, 0, 65536));
+    cms_dyadic_destroy(&dcms);
+}
+
+MU_TEST(test_dyadic_quantile) {
+    CountMinSketchDyadic dcms;
+    cms_dyadic_init(&dcms, 4096, 5, 32);
+    mu_assert_int_eq(0, cms_dyadic_quantile(&dcms, 0.5));
+    for (uint64_t i = 1; i <= 1000; ++i) {
+        cms_dyadic_add(&dcms, i * 1000);
+    }
+    mu_assert_int_eq(500000, cms_dyadic_quantile(&dcms, 0.5));
+    mu_assert_int_eq(990000, cms_dyadic_quantile(&dcms, 0.99));
+    mu_assert_int_eq(1000, cms_dyadic_quantile(&dcms, 0.0));
+    mu_assert_int_eq(1000000, cms_dyadic_quantile(&dcms, 1.0));
+
+    cms_dyadic_clear(&dcms);
+    mu_assert_int_eq(0, cms_dyadic_range(&dcms, 0, 2000000));
+    cms_dyadic_destroy(&dcms);
+}
+
+/*******************************************************************************
+*   Test Count-Sketch
+*******************************************************************************/
+MU_TEST(test_countsketch_setup) {
+    CountSketch cs;
+    mu_assert_int_eq(CMS_SUCCESS, cms_countsketch_init(&cs, 1000, 5));
+    mu_assert_int_eq(1000, cs.width);
+    mu_assert_int_eq(5, cs.depth);
+    mu_assert_int_eq(0, cms_countsketch_check(&cs, "this is a test"));
+    cms_countsketch_destroy(&cs);
+    mu_assert_int_eq(CMS_ERROR, cms_countsketch_init(&cs, 0, 5));
+}
+
+MU_TEST(test_countsketch_signed) {
+    CountSketch cs;
+    cms_countsketch_init(&cs, 1000, 5);
+    mu_assert_int_eq(5, cms_countsketch_add_inc(&cs, "this is a test", 5));
+    mu_assert_int_eq(10, cms_countsketch_add_inc(&cs, "this is another test", 10));
+    mu_assert_int_eq(3, cms_countsketch_remove_inc(&cs, "this is a test", 2));
+    mu_assert_int_eq(-4, cms_countsketch_remove_inc(&cs, "this is also a test", 4));
+    mu_assert_int_eq(3, cms_countsketch_check(&cs, "this is a test"));
+    mu_assert_int_eq(9, cs.cms.elements_added);
+
+    /* the bins of a key carry both signs */
+    uint64_t* hashes = cms_get_hashes(&cs.cms, "this is another test");
+    int positive = 0;
+    for (int i = 0; i < 5; ++i) {
+        int32_t bin = cs.cms.bins[i * 1000 + hashes[i] % 1000];
+        positive += (bin > 0);
+    }
+    mu_assert(positive > 0 && positive < 5, "Expected bins of both signs");
+    free(hashes);
+
+    cms_countsketch_clear(&cs);
+    mu_assert_int_eq(0, cms_countsketch_check(&cs, "this is another test"));
+    cms_countsketch_destroy(&cs);
+}
+
+MU_TEST(test_countsketch_median_extremes) {
+    /* row estimates far enough apart that their difference overflows 32 bits */
+    const int32_t rows[][5] = {
+        {2000000000, -2000000000, 1, 2, 3},
+        {-2000000000, 3, 2000000000, 2000000000, -2000000000},
+        {INT32_MAX, INT32_MIN + 1, INT32_MAX, INT32_MIN + 1, 7}
+    };
+    const int32_t medians[] = {2, 3, 7};
+    CountSketch cs;
+    cms_countsketch_init(&cs, 1000, 5);
+    for (int t = 0; t < 3; ++t) {
+        uint64_t hashes[5];
+        for (int i = 0; i < 5; ++i) {
+            /* odd rows have a negative sign, so their bins hold the negated estimate */
+            hashes[i] = (uint64_t)(i + 1) | ((i % 2 == 1) ? (1ULL << 63) : 0);
+            cs.cms.bins[i * 1000 + hashes[i] % 1000] = (i % 2 == 1) ? -rows[t][i] : rows[t][i];
+        }
+        mu_assert_int_eq(medians[t], cms_countsketch_check_alt(&cs, hashes, 5));
+    }
+    cms_countsketch_destroy(&cs);
+}
+
+MU_TEST(test_countsketch_unbiased) {
+    /* heavy collisions inflate the count-min estimate but cancel out here */
+    char key[16];
+    CountSketch cs;
+    CountMinSketch small;
+    cms_countsketch_init(&cs, 64, 7);
+    cms_init(&small, 64, 7);
+    for (int i = 0; i < 2000; ++i) {
+        sprintf(key, "key-%d", i);
+        cms_countsketch_add(&cs, key);
+        cms_add(&small, key);
+    }
+    cms_countsketch_add_inc(&cs, "this is a test", 100);
+    cms_add_inc(&small, "this is a test", 100);
+    int32_t estimate = cms_countsketch_check(&cs, "this is a test");
+    mu_assert(abs(estimate - 100) < abs(cms_check(&small, "this is a test") - 100), "Expected a closer estimate than the count-min sketch");
+    cms_destroy(&small);
+    cms_countsketch_destroy(&cs);
+}
+
+MU_TEST(test_countsketch_export_merge) {
+    CountSketch cs, other, res;
+    cms_countsketch_init(&cs, 1000, 5);
+    cms_countsketch_init(&other, 1000, 5);
+    cms_countsketch_add_inc(&cs, "this is a test", 5);
+    cms_countsketch_add_inc(&other, "this is a test", 7);
+    cms_countsketch_remove_inc(&other, "this is another test", 3);
+
+    CountMinSketch* sketches[] = {&other.cms};
+    mu_assert_int_eq(CMS_SUCCESS, cms_merge_into_array(&cs.cms, sketches, 1, 0));
+    mu_assert_int_eq(12, cms_countsketch_check(&cs, "this is a test"));
+    mu_assert_int_eq(-3, cms_countsketch_check(&cs, "this is another test"));
+
+    mu_assert_int_eq(CMS_SUCCESS, cms_export(&cs.cms, "./tests/test.cs"));
+    mu_assert_int_eq(CMS_SUCCESS, cms_countsketch_import(&res, "./tests/test.cs"));
+    mu_assert_int_eq(1000, res.width);
+    mu_assert_int_eq(12, cms_countsketch_check(&res, "this is a test"));
+    mu_assert_int_eq(-3, cms_countsketch_check(&res, "this is another test"));
+    remove("./tests/test.cs");
+    cms_countsketch_destroy(&res);
+    cms_countsketch_destroy(&other);
+    cms_countsketch_destroy(&cs);
+}
+
+/*******************************************************************************
+*   Test Scalable Sketch
+*******************************************************************************/
+MU_TEST(test_scalable_setup) {
+    CountMinSketchScalable scms;
+    mu_assert_int_eq(CMS_SUCCESS, cms_scalable_init(&scms, 1000, 5, 100));
+    mu_assert_int_eq(1, scms.num_stages);
+    mu_assert_int_eq(1000, scms.stages[0].width);
+    mu_assert_int_eq(0, cms_scalable_check(&scms, "this is a test"));
+    cms_scalable_destroy(&scms);
+
+    mu_assert_int_eq(CMS_ERROR, cms_scalable_init(&scms, 1000, 5, 0));
+    mu_assert_int_eq(CMS_ERROR, cms_scalable_init(&scms, 0, 5, 100));
+}
+
+MU_TEST(test_scalable_grow) {
+    CountMinSketchScalable scms;
+    cms_scalable_init(&scms, 1000, 5, 100);
+    mu_assert_int_eq(60, cms_scalable_add_inc(&scms, "this is a test", 60));
+    mu_assert_int_eq(40, cms_scalable_add_inc(&scms, "this is another test", 40));
+    mu_assert_int_eq(1, scms.num_stages);
+
+    /* the first stage is full */
+    mu_assert_int_eq(70, cms_scalable_add_inc(&scms, "this is a test", 10));
+    mu_assert_int_eq(2, scms.num_stages);
+    mu_assert_int_eq(2000, scms.stages[1].width);
+    mu_assert_int_eq(10, cms_check(&scms.stages[1], "this is a test"));
+
+    /* the second stage takes 200 */
+    cms_scalable_add_inc(&scms, "this is also a test", 190);
+    mu_assert_int_eq(2, scms.num_stages);
+    cms_scalable_add(&scms, "this is another test");
+    mu_assert_int_eq(3, scms.num_stages);
+    mu_assert_int_eq(4000, scms.stages[2].width);
+    mu_assert_int_eq(41, cms_scalable_check(&scms, "this is another test"));
+    mu_assert_int_eq(70, cms_scalable_check(&scms, "this is a test"));
+    mu_assert_int_eq(301, scms.elements_added);
+
+    cms_scalable_clear(&scms);
+    mu_assert_int_eq(1, scms.num_stages);
+    mu_assert_int_eq(0, cms_scalable_check(&scms, "this is a test"));
+    cms_scalable_destroy(&scms);
+}
+
+/*******************************************************************************
+*   Test Sketch Group
+*******************************************************************************/
+MU_TEST(test_group_setup) {
+    CountMinSketchGroup grp;
+    mu_assert_int_eq(CMS_SUCCESS, cms_group_init(&grp, 1000, 5, 24, 0));
+    mu_assert_int_eq(24, grp.num_sketches);
+    mu_assert_int_eq(1000, grp.sketches[23].width);
+    cms_group_destroy(&grp);
+    mu_assert_int_eq(CMS_SUCCESS, cms_group_init(&grp, 1000, 5, 24, 1));
+    mu_assert_null(grp.sketches);
+    mu_assert_not_null(grp.bins);
+    cms_group_destroy(&grp);
+
+    mu_assert_int_eq(CMS_ERROR, cms_group_init(&grp, 1000, 5, 0, 0));
+    mu_assert_int_eq(CMS_ERROR, cms_group_init(&grp, 0, 5, 24, 1));
+}
+
+MU_TEST(test_group_add) {
+    int32_t results[3];
+    CountMinSketch member;
+    for (int interleaved = 0; interleaved <= 1; ++interleaved) {
+        CountMinSketchGroup grp;
+        cms_group_init(&grp, width, depth, 3, interleaved);
+        mu_assert_int_eq(CMS_SUCCESS, cms_group_add_inc(&grp, "this is a test", 5));
+        mu_assert_int_eq(CMS_SUCCESS, cms_group_add(&grp, "this is another test"));
+        cms_group_check(&grp, "this is a test", results);
+        for (int i = 0; i < 3; ++i) {
+            mu_assert_int_eq(5, results[i]);
+        }
+        mu_assert_int_eq(6, grp.elements_added);
+
+        /* each member matches a count-min sketch updated directly */
+        cms_add_inc(&cms, "this is a test", 5);
+        cms_add(&cms, "this is another test");
+        mu_assert_int_eq(CMS_SUCCESS, cms_group_extract(&grp, 2, &member));
+        mu_assert_int_eq(6, member.elements_added);
+        mu_assert_int_eq(0, memcmp(cms.bins, member.bins, width * depth * sizeof(int32_t)));
+        cms_destroy(&member);
+        mu_assert_int_eq(CMS_ERROR, cms_group_extract(&grp, 3, &member));
+
+        cms_group_clear(&grp);
+        cms_clear(&cms);
+        cms_group_check(&grp, "this is a test", results);
+        mu_assert_int_eq(0, results[1]);
+        cms_group_destroy(&grp);
+    }
+}
+
+/*******************************************************************************
+*   Test Arena
+*******************************************************************************/
+MU_TEST(test_arena_acquire) {
+    CountMinSketchArena arena;
+    uint64_t ids[5];
+    mu_assert_int_eq(CMS_ERROR, cms_arena_init(&arena, 100, 3, 0));
+    mu_assert_int_eq(CMS_SUCCESS, cms_arena_init(&arena, 100, 3, 2));
+    for (int i = 0; i < 5; ++i) {
+        mu_assert_int_eq(CMS_SUCCESS, cms_arena_acquire(&arena, &ids[i]));
+        mu_assert_int_eq(i, ids[i]);
+        cms_add_inc(cms_arena_get(&arena, ids[i]), "this is a test", i + 1);
+    }
+    mu_assert_int_eq(3, arena.num_slabs);
+    mu_assert_int_eq(5, arena.num_used);
+    mu_assert_int_eq(3, cms_check(cms_arena_get(&arena, 2), "this is a test"));
+    mu_assert(cms_arena_get(&arena, 0)->bins + 300 == cms_arena_get(&arena, 1)->bins, "Expected contiguous bins");
+
+    /* released sketches are reused empty */
+    mu_assert_int_eq(CMS_SUCCESS, cms_arena_release(&arena, 1));
+    mu_assert_null(cms_arena_get(&arena, 1));
+    mu_assert_null(cms_arena_get(&arena, 6));
+    mu_assert_int_eq(CMS_ERROR, cms_arena_release(&arena, 1));
+    cms_arena_acquire(&arena, &ids[1]);
+    mu_assert_int_eq(1, ids[1]);
+    mu_assert_int_eq(0, cms_check(cms_arena_get(&arena, 1), "this is a test"));
+    mu_assert_int_eq(0, cms_arena_get(&arena, 1)->elements_added);
+    cms_arena_destroy(&arena);
+}
+
+MU_TEST(test_arena_export_import) {
+    CountMinSketchArena arena, imported;
+    uint64_t id;
+    cms_arena_init(&arena, 100, 3, 4);
+    for (int i = 0; i < 6; ++i) {
+        cms_arena_acquire(&arena, &id);
+        cms_add_inc(cms_arena_get(&arena, id), "this is a test", i + 1);
+    }
+    cms_arena_release(&arena, 4);
+    mu_assert_int_eq(CMS_SUCCESS, cms_arena_export(&arena, "./tests/test.arena"));
+
+    mu_assert_int_eq(CMS_SUCCESS, cms_arena_import(&imported, "./tests/test.arena"));
+    mu_assert_int_eq(100, imported.width);
+    mu_assert_int_eq(2, imported.num_slabs);
+    mu_assert_int_eq(5, imported.num_used);
+    mu_assert_null(cms_arena_get(&imported, 4));
+    mu_assert_int_eq(6, cms_check(cms_arena_get(&imported, 5), "this is a test"));
+    mu_assert_int_eq(6, cms_arena_get(&imported, 5)->elements_added);
+    cms_arena_acquire(&imported, &id);
+    mu_assert_int_eq(4, id);
+    cms_arena_destroy(&imported);
+    cms_arena_destroy(&arena);
+
+    mu_assert_int_eq(CMS_ERROR, cms_arena_import(&imported, "./tests/test.cms.missing"));
+
+    /* an arena without slabs */
+    cms_arena_init(&arena, 100, 3, 4);
+    mu_assert_int_eq(CMS_SUCCESS, cms_arena_export(&arena, "./tests/test.arena"));
+    mu_assert_int_eq(CMS_SUCCESS, cms_arena_import(&imported, "./tests/test.arena"));
+    mu_assert_int_eq(0, imported.num_slabs);
+    mu_assert_int_eq(0, imported.num_used);
+    cms_arena_destroy(&imported);
+
+    /* a trailer whose file size does not fit in 64 bits */
+    uint32_t trailer[4] = {UINT32_MAX, UINT32_MAX, UINT32_MAX, UINT32_MAX};
+    FILE* fp = fopen("./tests/test.arena", "wb");
+    fwrite(trailer, sizeof(uint32_t), 4, fp);
+    fclose(fp);
+    mu_assert_int_eq(CMS_ERROR, cms_arena_import(&imported, "./tests/test.arena"));
+    remove("./tests/test.arena");
+
+    /* write errors are reported */
+    fp = fopen("/dev/full", "wb");
+    if (fp != NULL) {
+        fclose(fp);
+        cms_arena_acquire(&arena, &id);
+        mu_assert_int_eq(CMS_ERROR, cms_arena_export(&arena, "/dev/full"));
+    }
+    cms_arena_destroy(&arena);
+}
+
+/*******************************************************************************
+*   Test Allocator
+*******************************************************************************/
+static uint64_t allocated_bytes = 0;
+
+static void* test_alloc(size_t size, void* data) {
+    allocated_bytes += size;
+    ++*(int*)data;
+    return malloc(size);
+}
+
+static void test_free(void* ptr, size_t size, void* data) {
+    allocated_bytes -= size;
+    --*(int*)data;
+    free(ptr);
+}
+
+MU_TEST(test_allocator_custom) {
+    CountMinSketch c;
+    int live = 0;
+    cms_allocator allocator = {test_alloc, test_free, &live, 0};
+    mu_assert_int_eq(CMS_ERROR, cms_init_allocator(&c, 0, 5, &allocator));
+    mu_assert_int_eq(CMS_SUCCESS, cms_init_allocator(&c, 1000, 5, &allocator));
+    mu_assert_int_eq(1, live);
+    mu_assert_int_eq(20000, allocated_bytes);
+    mu_assert_int_eq(0, cms_check(&c, "this is a test"));
+    cms_add_inc(&c, "this is a test", 5);
+    mu_assert_int_eq(5, cms_check(&c, "this is a test"));
+    cms_fold(&c, 2);  /* keeps the custom allocation */
+    mu_assert_int_eq(5, cms_check(&c, "this is a test"));
+    cms_destroy(&c);
+    mu_assert_int_eq(0, live);
+    mu_assert_int_eq(0, allocated_bytes);
+}
+
+static void* test_alloc_reserve(size_t size, void* data) {
+    (void)data;
+    void* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return (ptr == MAP_FAILED) ? NULL : ptr;
+}
+
+static void test_free_reserve(void* ptr, size_t size, void* data) {
+    (void)data;
+    munmap(ptr, size);
+}
+
+MU_TEST(test_allocator_large) {
+    /* 3 x 2^31 bins (24 GiB) of which only the touched pages are used */
+    CountMinSketch c;
+    uint32_t large_width = 1U << 31;
+    cms_allocator allocator = {test_alloc_reserve, test_free_reserve, NULL, CMS_ALLOC_ZEROED};
+    if (cms_init_allocator(&c, large_width, 3, &allocator) == CMS_ERROR) {
+        printf("\nSkipping the 24 GiB count-min sketch test; unable to reserve the memory\n");
+        return;
+    }
+    uint64_t hashes[] = {1, 1, 3};
+    uint64_t check[] = {1, 2, 3};
+    mu_assert_int_eq(1, cms_add_alt(&c, hashes, 3));
+    /* the last row starts past 2^32 bins; 32-bit indexes would wrap into the first */
+    mu_assert_int_eq(1, c.bins[(uint64_t)2 * large_width + 3]);
+    mu_assert_int_eq(0, c.bins[3]);
+    mu_assert_int_eq(0, cms_check_alt(&c, check, 3));
+    mu_assert_int_eq(7, cms_add_inc(&c, "this is a test", 7));
+    mu_assert_int_eq(7, cms_check(&c, "this is a test"));
+    mu_assert_int_eq(5, cms_remove_inc(&c, "this is a test", 2));
+    mu_assert_int_eq(6, c.elements_added);
+
+    /* the export is mostly holes and the import only stores the touched chunks */
+    CountMinSketch imp;
+    mu_assert_int_eq(CMS_SUCCESS, cms_export(&c, "./tests/test_large.cms"));
+    mu_assert_int_eq(CMS_SUCCESS, cms_import_allocator(&imp, "./tests/test_large.cms", &allocator));
+    mu_assert_int_eq(large_width, imp.width);
+    mu_assert_int_eq(1, imp.bins[(uint64_t)2 * large_width + 3]);
+    mu_assert_int_eq(0, imp.bins[3]);
+    mu_assert_int_eq(5, cms_check(&imp, "this is a test"));
+    mu_assert_int_eq(6, imp.elements_added);
+    cms_destroy(&imp);
+    remove("./tests/test_large.cms");
+    cms_destroy(&c);
+}
+
+MU_TEST(test_allocator_builtin) {
+    CountMinSketch c;
+    uint32_t flags[] = {CMS_ALLOC_ALIGNED, CMS_ALLOC_HUGE_PAGES, CMS_ALLOC_HUGETLB};
+    for (int i = 0; i < 3; ++i) {
+        cms_allocator allocator = {NULL, NULL, NULL, flags[i]};
+        mu_assert_int_eq(CMS_SUCCESS, cms_init_allocator(&c, 1000, 5, &allocator));
+        mu_assert_int_eq(0, (uintptr_t)c.bins % 64);
+        mu_assert_int_eq(0, cms_check(&c, "this is a test"));
+        cms_add_inc(&c, "this is a test", 5);
+        mu_assert_int_eq(5, cms_check(&c, "this is a test"));
+        cms_merge_into(&c, 1, &cms);
+        mu_assert_int_eq(5, cms_check(&c, "this is a test"));
+        cms_destroy(&c);
+    }
+
+    /* no allocator is the same as `cms_init` */
+    mu_assert_int_eq(CMS_SUCCESS, cms_init_allocator(&c, 1000, 5, NULL));
+    mu_assert_int_eq(0, cms_check(&c, "this is a test"));
+    cms_add_inc(&c, "this is a test", 5);
+    mu_assert_int_eq(5, cms_check(&c, "this is a test"));
+    cms_destroy(&c);
+}
+
+/*******************************************************************************
+*   Test NUMA
+*******************************************************************************/
+MU_TEST(test_numa_write_all) {
+    CountMinSketchNuma ncms;
+    mu_assert_int_eq(CMS_ERROR, cms_numa_init(&ncms, 0, 5, CMS_NUMA_WRITE_ALL));
+    mu_assert_int_eq(CMS_ERROR, cms_numa_init(&ncms, 1000, 5, 7));
+    mu_assert_int_eq(CMS_ERROR, cms_numa_init(&ncms, 1000, 5, -1));
+    mu_assert_int_eq(CMS_SUCCESS, cms_numa_init(&ncms, 1000, 5, CMS_NUMA_WRITE_ALL));
+    mu_assert(ncms.num_replicas >= 1, "Expected at least one replica");
+    mu_assert_not_null(cms_numa_local(&ncms));
+    mu_assert_int_eq(3, cms_numa_add_inc(&ncms, "this is a test", 3));
+    mu_assert_int_eq(4, cms_numa_add(&ncms, "this is a test"));
+    mu_assert_int_eq(4, cms_numa_check(&ncms, "this is a test"));
+    for (uint32_t i = 0; i < ncms.num_replicas; ++i) {
+        mu_assert_int_eq(4, cms_check(&ncms.replicas[i], "this is a test"));
+    }
+    cms_numa_clear(&ncms);
+    mu_assert_int_eq(0, cms_numa_check(&ncms, "this is a test"));
+    cms_numa_destroy(&ncms);
+    mu_assert_int_eq(0, ncms.width);
+    mu_assert_int_eq(0, ncms.depth);
+    mu_assert_int_eq(0, ncms.num_replicas);
+    mu_assert_null(ncms.replicas);
+}
+
+MU_TEST(test_numa_write_sync) {
+    CountMinSketchNuma ncms;
+    cms_numa_init(&ncms, 1000, 5, CMS_NUMA_WRITE_SYNC);
+    mu_assert_int_eq(3, cms_numa_add_inc(&ncms, "this is a test", 3));
+    for (uint32_t i = 1; i < ncms.num_replicas; ++i) {
+        mu_assert_int_eq(0, cms_check(&ncms.replicas[i], "this is a test"));
+    }
+    mu_assert_int_eq(CMS_SUCCESS, cms_numa_sync(&ncms));
+    mu_assert_int_eq(3, cms_numa_check(&ncms, "this is a test"));
+    for (uint32_t i = 0; i < ncms.num_replicas; ++i) {
+        mu_assert_int_eq(3, cms_check(&ncms.replicas[i], "this is a test"));
+        mu_assert_int_eq(3, ncms.replicas[i].elements_added);
+    }
+    cms_numa_destroy(&ncms);
+}
+
+/*******************************************************************************
+*   Test Batches and SIMD
+*******************************************************************************/
+static void batch_compare(CountMinSketch* batch, CountMinSketch* single) {
+    const int num_keys = 700;  /* more than one tile, with repeated keys */
+    char buf[num_keys][16];
+    const char* keys[num_keys];
+    int32_t results[num_keys];
+    for (int i = 0; i < num_keys; ++i) {
+        sprintf(buf[i], "key %d", (i * 7) % 300);
+        keys[i] = buf[i];
+    }
+    mu_assert_int_eq(CMS_SUCCESS, cms_add_inc_batch(batch, keys, num_keys, 3, results));
+    for (int i = 0; i < num_keys; ++i) {
+        mu_assert_int_eq(cms_add_inc(single, keys[i], 3), results[i]);
+    }
+    mu_assert_int_eq(single->elements_added, batch->elements_added);
+    mu_assert_int_eq(CMS_SUCCESS, cms_add_batch(batch, keys, 10, NULL));
+    for (int i = 0; i < 10; ++i) {
+        cms_add(single, keys[i]);
+    }
+    mu_assert_int_eq(CMS_SUCCESS, cms_check_batch(batch, keys, num_keys, results));
+    for (int i = 0; i < num_keys; ++i) {
+        mu_assert_int_eq(cms_check(single, keys[i]), results[i]);
+    }
+}
+
+MU_TEST(test_batch_add_check) {
+    CountMinSketch single, batch;
+    cms_init(&single, width, depth);
+    batch_compare(&cms, &single);
+    cms_destroy(&single);
+
+    /* power of two widths and a depth with a partial SIMD tail */
+    cms_init(&single, 1024, 7);
+    cms_init(&batch, 1024, 7);
+    batch_compare(&batch, &single);
+    for (uint64_t i = 0; i < 1024 * 7; ++i) {
+        mu_assert_int_eq(single.bins[i], batch.bins[i]);
+    }
+    cms_destroy(&single);
+    cms_destroy(&batch);
+}
+
+MU_TEST(test_batch_fallback) {
+    CountMinSketch single, batch;
+    cms_init_sparse(&single, 10000, 7);
+    cms_init_sparse(&batch, 10000, 7);
+    batch_compare(&batch, &single);
+    cms_destroy(&single);
+    cms_destroy(&batch);
+
+    cms_init(&single, width, depth);
+    cms_init(&batch, width, depth);
+    cms_add_inc(&single, "aged", 100);
+    cms_add_inc(&batch, "aged", 100);
+    cms_age_lazy(&single, 1);
+    cms_age_lazy(&batch, 1);
+    batch_compare(&batch, &single);
+    cms_destroy(&single);
+    cms_destroy(&batch);
+
+    /* a custom hash is called a key at a time */
+    cms_init_alt(&single, width, depth, test_hash);
+    cms_init_alt(&batch, width, depth, test_hash);
+    batch_compare(&batch, &single);
+    cms_destroy(&single);
+    cms_destroy(&batch);
+}
+
+MU_TEST(test_batch_duplicates) {
+    /* keys repeated close together and far apart, saturating partway */
+    const int num_keys = 27;
+    uint64_t hashes[num_keys * depth];
+    int32_t results[num_keys];
+    CountMinSketch single, batch;
+    cms_init(&single, 1024, depth);
+    cms_init(&batch, 1024, depth);
+    for (int i = 0; i < num_keys; ++i) {
+        for (int r = 0; r < depth; ++r) {
+            hashes[i * depth + r] = (i % 3 == 0) ? 42 : (uint64_t)((i % 5) * 7 + r);
+        }
+    }
+    mu_assert_int_eq(CMS_SUCCESS, cms_add_inc_batch_alt(&batch, hashes, depth, num_keys, INT32_MAX / 4, results));
+    for (int i = 0; i < num_keys; ++i) {
+        mu_assert_int_eq(cms_add_inc_alt(&single, hashes + i * depth, depth, INT32_MAX / 4), results[i]);
+    }
+    mu_assert_int_eq(INT32_MAX, results[num_keys - 3]);
+    for (int i = 0; i < 1024 * depth; ++i) {
+        mu_assert_int_eq(single.bins[i], batch.bins[i]);
+    }
+    cms_destroy(&single);
+    cms_destroy(&batch);
+}
+
+MU_TEST(test_batch_error) {
+    uint64_t hashes[8] = {0};
+    int32_t results[2];
+    mu_assert_int_eq(CMS_ERROR, cms_add_inc_batch_alt(&cms, hashes, depth - 1, 2, 1, results));
+    mu_assert_int_eq(CMS_ERROR, cms_check_batch_alt(&cms, hashes, depth - 1, 2, results));
+    mu_assert_int_eq(0, cms.elements_added);
+
+    /* a hash function that fails */
+    CountMinSketch c;
+    const char* keys[] = {"this is a test", "this is another test"};
+    cms_init_alt(&c, width, depth, test_hash_null);
+    mu_assert_int_eq(CMS_ERROR, cms_add_inc_batch(&c, keys, 2, 1, results));
+    mu_assert_int_eq(CMS_ERROR, cms_check_batch(&c, keys, 2, results));
+    mu_assert_int_eq(0, c.elements_added);
+    cms_destroy(&c);
+}
+
+MU_TEST(test_simd_hash) {
+    const char* keys[] = {"", "a", "this is a test", "a somewhat longer key of more than thirty two characters"};
+    for (int k = 0; k < 4; ++k) {
+        uint64_t* hashes = cms_get_hashes_alt(&cms, 19, keys[k]);
+        for (int i = 0; i < 19; ++i) {
+            uint64_t h = 14695981039346656037ULL + (31 * i);
+            for (const char* c = keys[k]; *c != '\0'; ++c) {
+                h ^= (unsigned char)*c;
+                h *= 1099511628211ULL;
+            }
+            mu_assert(h == hashes[i], "SIMD hash differs from FNV-1a");
+        }
+        free(hashes);
+    }
+    const char* level = cms_simd_level();
+    mu_assert_not_null(level);
+    mu_assert(strcmp(level, "avx512") == 0 || strcmp(level, "avx2") == 0 || strcmp(level, "sse2") == 0 || strcmp(level, "scalar") == 0, "unknown SIMD level");
+}
 
 MU_TEST_SUITE(test_suite) {
     MU_SUITE_CONFIGURE(&test_setup, &test_teardown);
@@ -383,6 +1872,7 @@ MU_TEST_SUITE(test_suite) {
     MU_RUN_TEST(test_bad_init);
     MU_RUN_TEST(test_init_optimal);
     MU_RUN_TEST(test_init_optimal_bad);
+    MU_RUN_TEST(test_sparse_setup);
 
     /* insertions (inc, add, etc) */
     MU_RUN_TEST(test_insertions_normal);
@@ -409,19 +1899,115 @@ MU_TEST_SUITE(test_suite) {
 
     /* clear / reset */
     MU_RUN_TEST(test_clear);
+    MU_RUN_TEST(test_clear_lazy);
+
+    /* sparse */
+    MU_RUN_TEST(test_sparse_insertions);
+    MU_RUN_TEST(test_sparse_bulk);
+    MU_RUN_TEST(test_sparse_merge_order);
+
+    /* heavy hitters */
+    MU_RUN_TEST(test_topk);
+    MU_RUN_TEST(test_topk_many);
+
+    /* aging */
+    MU_RUN_TEST(test_age);
+    MU_RUN_TEST(test_age_lazy);
+
+    /* fold */
+    MU_RUN_TEST(test_fold);
+    MU_RUN_TEST(test_fold_power_of_two);
+    MU_RUN_TEST(test_fold_error);
 
     /* export and import */
     MU_RUN_TEST(test_cms_export);
+    MU_RUN_TEST(test_cms_export_async);
+    MU_RUN_TEST(test_cms_export_async_large);
+    MU_RUN_TEST(test_cms_export_async_error);
     MU_RUN_TEST(test_cms_import);
     MU_RUN_TEST(test_cms_import_error);
+    MU_RUN_TEST(test_cms_import_invalid);
 
     /* merge */
     MU_RUN_TEST(test_cms_merge_simple);
     MU_RUN_TEST(test_cms_merge_overflow_up);
     MU_RUN_TEST(test_cms_merge_overflow_down);
+    MU_RUN_TEST(test_cms_merge_saturate);
     MU_RUN_TEST(test_cms_merge_into);
     MU_RUN_TEST(test_cms_merge_into_mismatch);
     MU_RUN_TEST(test_cms_merge_mismatch);
+    MU_RUN_TEST(test_cms_merge_array);
+    MU_RUN_TEST(test_cms_merge_array_threads);
+    MU_RUN_TEST(test_cms_merge_array_mismatch);
+    MU_RUN_TEST(test_cms_merge_into_folded);
+    MU_RUN_TEST(test_cms_merge_files);
+    MU_RUN_TEST(test_cms_merge_files_mismatch);
+    MU_RUN_TEST(test_cms_inner_product);
+    MU_RUN_TEST(test_cms_inner_product_mismatch);
+    MU_RUN_TEST(test_cms_subtract);
+    MU_RUN_TEST(test_cms_subtract_saturate);
+    MU_RUN_TEST(test_cms_subtract_mismatch);
+    MU_RUN_TEST(test_cms_changes_kernels);
+
+    /* sliding window */
+    MU_RUN_TEST(test_window_setup);
+    MU_RUN_TEST(test_window_expire);
+    MU_RUN_TEST(test_window_incremental_retire);
+    MU_RUN_TEST(test_window_error);
+
+    /* time decay */
+    MU_RUN_TEST(test_decay_setup);
+    MU_RUN_TEST(test_decay_half_life);
+    MU_RUN_TEST(test_decay_error);
+
+    /* tinylfu */
+    MU_RUN_TEST(test_tinylfu_setup);
+    MU_RUN_TEST(test_tinylfu_frequency);
+    MU_RUN_TEST(test_tinylfu_reset);
+
+    /* augmented */
+    MU_RUN_TEST(test_augmented_setup);
+    MU_RUN_TEST(test_augmented_filter);
+
+    /* dyadic ranges */
+    MU_RUN_TEST(test_dyadic_setup);
+    MU_RUN_TEST(test_dyadic_range);
+    MU_RUN_TEST(test_dyadic_quantile);
+
+    /* count-sketch */
+    MU_RUN_TEST(test_countsketch_setup);
+    MU_RUN_TEST(test_countsketch_signed);
+    MU_RUN_TEST(test_countsketch_median_extremes);
+    MU_RUN_TEST(test_countsketch_unbiased);
+    MU_RUN_TEST(test_countsketch_export_merge);
+
+    /* scalable */
+    MU_RUN_TEST(test_scalable_setup);
+    MU_RUN_TEST(test_scalable_grow);
+
+    /* groups */
+    MU_RUN_TEST(test_group_setup);
+    MU_RUN_TEST(test_group_add);
+
+    /* arena */
+    MU_RUN_TEST(test_arena_acquire);
+    MU_RUN_TEST(test_arena_export_import);
+
+    /* allocator */
+    MU_RUN_TEST(test_allocator_custom);
+    MU_RUN_TEST(test_allocator_builtin);
+    MU_RUN_TEST(test_allocator_large);
+
+    /* NUMA */
+    MU_RUN_TEST(test_numa_write_all);
+    MU_RUN_TEST(test_numa_write_sync);
+
+    /* batches and SIMD */
+    MU_RUN_TEST(test_batch_add_check);
+    MU_RUN_TEST(test_batch_fallback);
+    MU_RUN_TEST(test_batch_duplicates);
+    MU_RUN_TEST(test_batch_error);
+    MU_RUN_TEST(test_simd_hash);
 }
 
 int main() {
@@ -472,3 +2058,27 @@ static int calculate_md5sum(const char* filename, char* digest) {
 
     return 0;
 }
+
+static void export_callback(CountMinSketch* c, const char* filepath, int status, void* data) {
+    (void)c;
+    (void)filepath;
+    *(int*)data = status;
+}
+
+static uint64_t* test_hash(unsigned int num_hashes, const char* key) {
+    uint64_t* results = (uint64_t*)calloc(num_hashes, sizeof(uint64_t));
+    uint64_t h = 5381;
+    for (const char* c = key; *c != '\0'; ++c) {
+        h = h * 33 + (unsigned char)*c;
+    }
+    for (unsigned int i = 0; i < num_hashes; ++i) {
+        results[i] = h * (2 * i + 1);
+    }
+    return results;
+}
+
+static uint64_t* test_hash_null(unsigned int num_hashes, const char* key) {
+    (void)num_hashes;
+    (void)key;
+    return NULL;
+}